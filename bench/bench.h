@@ -0,0 +1,22 @@
+// DesktopSaver, (c)2006-2016 Nicholas Piegdon, MIT licensed
+#pragma once
+
+#include <string>
+#include <cstdio>
+
+// Each benchmark prints what it measured and returns how many of its
+// checks failed
+int PollBenchmark();
+int JitterBenchmark();
+int MenuBenchmark();
+int CoordBenchmark();
+int PackedBenchmark();
+int SnapshotBenchmark();
+int ProfileLoadBenchmark();
+
+// Prints a check that didn't hold, and counts it
+inline int Expect(bool ok, const std::wstring &what)
+{
+   if (!ok) wprintf(L"   FAILED: %ls\n", what.c_str());
+   return ok ? 0 : 1;
+}
@@ -0,0 +1,24 @@
+// DesktopSaver, (c)2006-2016 Nicholas Piegdon, MIT licensed
+
+#include <windows.h>
+#include <cstdio>
+
+#include "bench.h"
+using namespace std;
+
+// Runs every benchmark in turn.  The exit code is the number of checks
+// that failed, so this can gate a build.
+int wmain()
+{
+   int failures = 0;
+   failures += PollBenchmark();
+   failures += JitterBenchmark();
+   failures += MenuBenchmark();
+   failures += CoordBenchmark();
+   failures += PackedBenchmark();
+   failures += SnapshotBenchmark();
+   failures += ProfileLoadBenchmark();
+
+   wprintf(failures == 0 ? L"\nAll checks passed.\n" : L"\n%d checks failed.\n", failures);
+   return failures;
+}
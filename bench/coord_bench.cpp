@@ -0,0 +1,130 @@
+// DesktopSaver, (c)2006-2016 Nicholas Piegdon, MIT licensed
+
+#include <windows.h>
+#include <chrono>
+#include <vector>
+#include <random>
+
+#include "bench.h"
+#include "coord_compare.h"
+#include "string_util.h"
+using namespace std;
+
+static const int Repeats = 1000;
+
+typedef chrono::steady_clock Clock;
+
+static const wchar_t *level_name(CoordCompare::Level level)
+{
+   switch (level)
+   {
+   case CoordCompare::Avx2: return L"AVX2";
+   case CoordCompare::Sse2: return L"SSE2";
+   default: return L"scalar";
+   }
+}
+
+// What one level made of a pair of coordinate lists
+struct Answer
+{
+   bool equal;
+   size_t differences;
+   size_t last;
+   vector<size_t> positions;
+
+   bool operator==(const Answer &o) const { return equal == o.equal && differences == o.differences && last == o.last && positions == o.positions; }
+};
+
+static Answer answer(const vector<int> &xa, const vector<int> &ya, const vector<int> &xb, const vector<int> &yb)
+{
+   Answer a;
+   a.last = 0;
+   a.equal = CoordCompare::Equal(xa.data(), ya.data(), xb.data(), yb.data(), xa.size());
+   a.differences = CoordCompare::CountDifferent(xa.data(), ya.data(), xb.data(), yb.data(), xa.size(), &a.last, &a.positions);
+   return a;
+}
+
+// Comparing two snapshots' coordinates with each implementation.  Two
+// polls of an unchanged desktop are the slow case for Equal, because it
+// has to look at every icon.  Every level has to give the same answers,
+// including for lists whose lengths leave a partial vector at the end.
+int CoordBenchmark()
+{
+   wprintf(L"Coordinate compare (us per call)\n");
+   wprintf(L"   %7ls %7ls   %10ls %10ls\n", L"icons", L"level", L"Equal", L"count");
+
+   const CoordCompare::Level levels[] = { CoordCompare::Scalar, CoordCompare::Sse2, CoordCompare::Avx2 };
+   const CoordCompare::Level available = CoordCompare::DetectLevel();
+
+   int failures = 0;
+   const int sizes[] = { 10000, 50000 };
+   for (int size : sizes)
+   {
+      mt19937 random(size);
+      vector<int> xa(size), ya(size);
+      for (int i = 0; i < size; ++i) { xa[i] = random() % 2000; ya[i] = random() % 1000; }
+
+      // The same layout again, and one with a few icons moved
+      const vector<int> xb = xa, yb = ya;
+      vector<int> xc = xa;
+      size_t moved = 0;
+      for (int i = 7; i < size; i += 997, ++moved) xc[i] += 75;
+
+      vector<Answer> answers;
+      for (CoordCompare::Level level : levels)
+      {
+         if (level > available) { wprintf(L"   %7d %7ls   (not supported by this CPU)\n", size, level_name(level)); continue; }
+         CoordCompare::UseLevel(level);
+
+         size_t sink = 0;
+         Clock::time_point start = Clock::now();
+         for (int r = 0; r < Repeats; ++r) sink += CoordCompare::Equal(xa.data(), ya.data(), xb.data(), yb.data(), size);
+         const double equal = chrono::duration<double, micro>(Clock::now() - start).count() / Repeats;
+
+         size_t last;
+         start = Clock::now();
+         for (int r = 0; r < Repeats; ++r) sink += CoordCompare::CountDifferent(xa.data(), ya.data(), xc.data(), yb.data(), size, &last);
+         const double count = chrono::duration<double, micro>(Clock::now() - start).count() / Repeats;
+
+         wprintf(L"   %7d %7ls   %10.2f %10.2f\n", size, level_name(level), equal, count);
+         failures += Expect(sink == Repeats * (1 + moved), WSTRING(level_name(level) << L" miscounted at " << size << L" icons"));
+
+         answers.push_back(answer(xa, ya, xc, yb));
+      }
+
+      for (size_t a = 1; a < answers.size(); ++a)
+         failures += Expect(answers[a] == answers[0], WSTRING(level_name(levels[a]) << L" and scalar disagree at " << size << L" icons"));
+   }
+
+   // Short lists, with differences anywhere (including the leftovers
+   // after the last whole vector)
+   mt19937 random(5);
+   int disagreements = 0;
+   for (int t = 0; t < 5000; ++t)
+   {
+      const size_t size = random() % 70;
+      vector<int> xa(size), ya(size), xb(size), yb(size);
+      for (size_t i = 0; i < size; ++i)
+      {
+         xa[i] = xb[i] = random() % 3;
+         ya[i] = yb[i] = random() % 3;
+         if (random() % 5 == 0) xb[i]++;
+         if (random() % 7 == 0) yb[i]--;
+      }
+
+      CoordCompare::UseLevel(CoordCompare::Scalar);
+      const Answer expected = answer(xa, ya, xb, yb);
+      if (expected.equal != (expected.differences == 0)) disagreements++;
+
+      for (CoordCompare::Level level : levels)
+      {
+         if (level > available) continue;
+         CoordCompare::UseLevel(level);
+         if (!(answer(xa, ya, xb, yb) == expected)) disagreements++;
+      }
+   }
+   failures += Expect(disagreements == 0, WSTRING(disagreements << L" short lists got different answers from different levels"));
+
+   CoordCompare::UseLevel(available);
+   return failures;
+}
@@ -0,0 +1,94 @@
+// DesktopSaver, (c)2006-2016 Nicholas Piegdon, MIT licensed
+
+#include <random>
+
+#include "bench.h"
+#include "saver.h"
+#include "snapshot_builder.h"
+#include "string_util.h"
+using namespace std;
+
+// A simulated day: a poll every five seconds of a desktop where
+// auto-arrange (or a DPI change) nudges an icon by a couple of pixels on
+// one read in twenty, and someone really moves an icon every fifty polls
+static const int IconCount = 100;
+static const int GridColumns = 20;
+static const int GridRows = 8;
+static const int SpacingX = 75;
+static const int SpacingY = 100;
+static const int PollCount = 24 * 60 * 12;
+
+struct JitterResult
+{
+   int slices;
+   int moves;
+};
+
+// Records the simulated desktop the way PollDesktopIcons does, counting
+// how many slices would have been written.  The same seed gives the same
+// day every time.
+static JitterResult simulate_day(int tolerance, bool snap_to_grid)
+{
+   mt19937 random(5);
+   vector<int> column(IconCount), row(IconCount);
+   for (int i = 0; i < IconCount; ++i) { column[i] = i % GridColumns; row[i] = i / GridColumns; }
+
+   vector<wstring> names;
+   for (int i = 0; i < IconCount; ++i) names.push_back(WSTRING(L"Icon " << i));
+
+   JitterResult result = { 0, 0 };
+   SnapshotBuilder snapshot;
+   IconHistory last;
+   for (int poll = 0; poll < PollCount; ++poll)
+   {
+      if (random() % 50 == 0)
+      {
+         const int i = random() % IconCount;
+         column[i] = random() % GridColumns;
+         row[i] = random() % GridRows;
+         result.moves++;
+      }
+
+      snapshot.Reset();
+      for (int i = 0; i < IconCount; ++i)
+      {
+         int jitter_x = 0, jitter_y = 0;
+         if (random() % 20 == 0) { jitter_x = int(random() % 5) - 2; jitter_y = int(random() % 5) - 2; }
+         snapshot.AddIcon(names[i], 21 + column[i] * SpacingX + jitter_x, 2 + row[i] * SpacingY + jitter_y);
+      }
+
+      snapshot.Finish();
+      if (snap_to_grid && tolerance > 0) snapshot.SnapToGrid(SpacingX, SpacingY, tolerance);
+      if (result.slices > 0)
+      {
+         snapshot.Settle(last, tolerance);
+         if (snapshot.Matches(last)) continue;
+      }
+
+      snapshot.CompactInto(last);
+      result.slices++;
+   }
+
+   return result;
+}
+
+// How many history slices the movement tolerance and grid snapping save
+int JitterBenchmark()
+{
+   wprintf(L"Jitter over a simulated day (%d polls of %d icons)\n", PollCount, IconCount);
+
+   const JitterResult exact = simulate_day(0, false);
+   const JitterResult tolerant = simulate_day(DesktopSaver::DefaultMoveTolerance, false);
+   const JitterResult snapped = simulate_day(DesktopSaver::DefaultMoveTolerance, true);
+
+   wprintf(L"   exact positions:          %5d slices written (%d real moves)\n", exact.slices, exact.moves);
+   wprintf(L"   %d pixel tolerance:        %5d slices written\n", DesktopSaver::DefaultMoveTolerance, tolerant.slices);
+   wprintf(L"   tolerance and grid snap:  %5d slices written\n", snapped.slices);
+
+   // The first slice is the desktop as it started, and a move can land an
+   // icon right where it already was
+   int failures = 0;
+   failures += Expect(tolerant.slices < exact.slices, L"the tolerance didn't cut the number of slices");
+   failures += Expect(snapped.slices <= snapped.moves + 1, WSTRING(L"with grid snapping, jitter still wrote " << snapped.slices - snapped.moves - 1 << L" extra slices"));
+   return failures;
+}
@@ -0,0 +1,147 @@
+// DesktopSaver, (c)2006-2016 Nicholas Piegdon, MIT licensed
+
+#include <windows.h>
+#include <chrono>
+#include <ctime>
+#include <memory>
+
+#include "bench.h"
+#include "tray_menu.h"
+#include "snapshot_builder.h"
+#include "alloc_stats.h"
+#include "string_util.h"
+using namespace std;
+
+static const int IconCount = 50;
+static const int ClickCount = 100;
+
+typedef chrono::steady_clock Clock;
+
+static double elapsed_ms(Clock::time_point start)
+{
+   return chrono::duration<double, milli>(Clock::now() - start).count();
+}
+
+// Everything the menu shows for a desktop that has been recorded
+// 'slices' times (one icon moving each time, over the last month) and
+// has 'profiles' named profiles
+static shared_ptr<SaverView> make_view(int slices, int profiles)
+{
+   const shared_ptr<SaverView> view = make_shared<SaverView>();
+   view->rate = Interval2;
+   view->compact = false;
+   view->snap_to_grid = true;
+   view->display_restore = true;
+   view->settling = false;
+   view->history_version = 1;
+   view->profiles_version = 1;
+
+   vector<wstring> names;
+   vector<long> xs, ys;
+   for (int i = 0; i < IconCount; ++i)
+   {
+      names.push_back(WSTRING(L"Shortcut " << i));
+      xs.push_back(21 + (i % 10) * 75);
+      ys.push_back(2 + (i / 10) * 100);
+   }
+
+   const int64_t now = int64_t(time(nullptr));
+   const int64_t month = 30 * 24 * 60 * 60;
+
+   SnapshotBuilder snapshot;
+   IconHistory previous;
+   for (int s = 0; s < slices; ++s)
+   {
+      const int moved = s % IconCount;
+      xs[moved] += 75;
+
+      snapshot.Reset();
+      for (int i = 0; i < IconCount; ++i) snapshot.AddIcon(names[i], xs[i], ys[i]);
+
+      IconHistory slice;
+      snapshot.CompactInto(slice);
+      slice.SetTime(now - month + month * s / slices);
+      slice.CalculateName(previous);
+      previous = slice;
+
+      view->timeline.push_back(slice);
+      if (slices - s <= int(DesktopSaver::MaxIconHistoryCount)) view->history.push_back(slice);
+   }
+
+   for (int p = 0; p < profiles; ++p)
+   {
+      IconHistory profile = previous;
+      profile.SetProfileName(WSTRING(L"Profile " << p));
+      view->named_profiles.Put(profile);
+   }
+
+   for (size_t i = 0; i < DesktopSaver::MaxMovedIcons; ++i)
+   {
+      IconIndex::Trail trail;
+      for (int t = 0; t < MaxIconPositions + 1; ++t)
+      {
+         const IconIndex::Position p = { now - month + t * 60, true, long(t * 75), long(i * 100) };
+         trail.push_back(p);
+      }
+      const SaverView::MovedIcon moved = { names[i], MakeIconKey(names[i]), trail };
+      view->moved_icons.push_back(moved);
+   }
+
+   return view;
+}
+
+// Opening the tray menu with a large history and lots of profiles.
+// Building everything from scratch is what every click used to cost;
+// now that only happens the first time, and a click only rebuilds the
+// parts whose data changed since the last one.
+int MenuBenchmark()
+{
+   wprintf(L"Tray menu (ms to have the menu ready)\n");
+   wprintf(L"   %7ls %8ls   %10ls %10ls %10ls %10ls\n", L"slices", L"profiles", L"everything", L"no change", L"new slice", L"profiles");
+
+   const int sizes[][2] = { { 100, 10 }, { 1000, 100 }, { 10000, 1000 } };
+
+   int failures = 0;
+   for (const auto &size : sizes)
+   {
+      const shared_ptr<SaverView> view = make_view(size[0], size[1]);
+      TrayMenu menu;
+
+      Clock::time_point start = Clock::now();
+      menu.Build(view, false);
+      const double everything = elapsed_ms(start);
+
+      // Clicking again without anything having changed
+      const unsigned long rebuilt = menu.RebuildCount();
+      int allocating = 0;
+      start = Clock::now();
+      for (int i = 0; i < ClickCount; ++i)
+      {
+         menu.Build(view, false);
+         if (!AllocStats::WithinBudget(AllocStats::BuildDynamicMenu, 0)) allocating++;
+      }
+      const double unchanged = elapsed_ms(start) / ClickCount;
+      const unsigned long rebuilt_unchanged = menu.RebuildCount() - rebuilt;
+
+      // A new history slice (just the version is enough to tell the menu)
+      const shared_ptr<SaverView> appended = make_shared<SaverView>(*view);
+      appended->history_version++;
+      start = Clock::now();
+      menu.Build(appended, false);
+      const double new_slice = elapsed_ms(start);
+
+      // A profile added, renamed or deleted
+      const shared_ptr<SaverView> edited = make_shared<SaverView>(*appended);
+      edited->profiles_version++;
+      start = Clock::now();
+      menu.Build(edited, false);
+      const double profiles = elapsed_ms(start);
+
+      wprintf(L"   %7d %8d   %10.3f %10.3f %10.3f %10.3f\n", size[0], size[1], everything, unchanged, new_slice, profiles);
+
+      failures += Expect(rebuilt_unchanged == 0, WSTRING(L"the menu was rebuilt " << rebuilt_unchanged << L" times without anything changing"));
+      if (AllocStats::Enabled()) failures += Expect(allocating == 0, WSTRING(allocating << L" clicks without a change made heap allocations"));
+   }
+
+   return failures;
+}
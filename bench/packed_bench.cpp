@@ -0,0 +1,168 @@
+// DesktopSaver, (c)2006-2016 Nicholas Piegdon, MIT licensed
+
+#include <windows.h>
+#include <chrono>
+#include <random>
+#include <sstream>
+#include <vector>
+
+#include "bench.h"
+#include "packed_history.h"
+#include "block_compressor.h"
+#include "icon_history.h"
+#include "snapshot_builder.h"
+#include "string_util.h"
+using namespace std;
+
+static const int SliceCount = 30;
+
+typedef chrono::steady_clock Clock;
+
+static double elapsed_seconds(Clock::time_point start)
+{
+   return chrono::duration<double>(Clock::now() - start).count();
+}
+
+// Megabytes of plain text per second
+static double rate(size_t bytes, double seconds)
+{
+   return seconds > 0 ? bytes / seconds / 1e6 : 0;
+}
+
+// Everything a payload carries.  (The time and display are kept in the
+// history file's index instead.)
+static bool same_history(const IconHistory &a, const IconHistory &b)
+{
+   if (a.GetName() != b.GetName() || a.IsNamedProfile() != b.IsNamedProfile()) return false;
+
+   const IconRange x = a.GetIcons(), y = b.GetIcons();
+   if (x.size() != y.size()) return false;
+
+   for (size_t i = 0; i < x.size(); ++i)
+      if (x[i].name != y[i].name || x[i].key != y[i].key || x[i].x != y[i].x || x[i].y != y[i].y) return false;
+
+   return true;
+}
+
+// A history of 'slices' layouts of 'icons' icons on a desktop grid, with
+// a few of them moving each time.  Some icons have keys of their own
+// (like anything the shell gave a parsing name), and the last few slices
+// are named profiles.
+static vector<IconHistory> make_histories(int icons, int slices)
+{
+   static const wchar_t *stems[] = { L"Shortcut to ", L"Project ", L"Report ", L"Invoice ", L"Screenshot 2016-", L"Notes ", L"Setup ", L"Meeting ", L"" };
+   static const wchar_t *extensions[] = { L".lnk", L".docx", L".pdf", L".png", L".txt", L".xlsx", L"", L".zip" };
+   static const int Rows = 12;
+
+   mt19937 random(icons);
+
+   vector<wstring> names;
+   vector<uint64_t> keys;
+   vector<long> xs, ys;
+   for (int i = 0; i < icons; ++i)
+   {
+      names.push_back(stems[random() % 9] + to_wstring(random() % 100000) + extensions[random() % 8]);
+      keys.push_back(i % 4 == 0 ? MakeIconKey(L"C:\\Users\\Public\\Desktop\\" + names.back()) : MakeIconKey(names.back()));
+      xs.push_back(21 + (i / Rows) * 75);
+      ys.push_back(2 + (i % Rows) * 102);
+   }
+
+   vector<IconHistory> histories;
+   SnapshotBuilder snapshot;
+   IconHistory previous;
+   for (int s = 0; s < slices; ++s)
+   {
+      for (int m = 0; m < 3; ++m)
+      {
+         const int moved = random() % icons;
+         xs[moved] = 21 + (random() % 40) * 75;
+         ys[moved] = 2 + (random() % Rows) * 102;
+      }
+
+      snapshot.Reset();
+      for (int i = 0; i < icons; ++i) snapshot.AddIcon(names[i], keys[i], xs[i], ys[i]);
+
+      IconHistory h;
+      snapshot.CompactInto(h);
+      h.CalculateName(previous);
+      if (s >= slices - 5) h.SetProfileName(WSTRING(L"Profile " << s));
+
+      histories.push_back(h);
+      previous = h;
+   }
+
+   return histories;
+}
+
+// The compact history format against the plain text one.  Speeds are in
+// megabytes of plain text (as UTF-8, like the history file) per second,
+// first for PackedHistory as a whole and then for just the
+// BlockCompressor over the same text.  Every payload has to come back
+// exactly as it went in.
+int PackedBenchmark()
+{
+   wprintf(L"Packed history (%d slices; MB/s of plain text)\n", SliceCount);
+   wprintf(L"   %5ls %10ls %9ls %6ls   %8ls %8ls   %8ls %8ls %6ls\n", L"icons", L"text", L"packed", L"ratio", L"pack", L"unpack", L"compress", L"expand", L"ratio");
+
+   int failures = 0;
+   const int sizes[] = { 40, 300, 3000 };
+   for (int icons : sizes)
+   {
+      const vector<IconHistory> histories = make_histories(icons, SliceCount);
+
+      size_t text = 0;
+      vector<string> texts;
+      for (const auto &h : histories)
+      {
+         wostringstream out;
+         out << h;
+         texts.push_back(ToUtf8(out.str()));
+         text += texts.back().size();
+      }
+
+      Clock::time_point start = Clock::now();
+      vector<string> payloads;
+      for (const auto &h : histories) payloads.push_back(PackedHistory::Pack(h));
+      const double pack = elapsed_seconds(start);
+
+      int damaged = 0;
+      vector<IconHistory> unpacked(payloads.size());
+      start = Clock::now();
+      for (size_t i = 0; i < payloads.size(); ++i) if (!PackedHistory::Unpack(payloads[i], unpacked[i])) damaged++;
+      const double unpack = elapsed_seconds(start);
+
+      size_t packed = 0;
+      int different = 0;
+      for (size_t i = 0; i < payloads.size(); ++i)
+      {
+         packed += payloads[i].size();
+         if (!PackedHistory::IsPacked(payloads[i]) || !same_history(histories[i], unpacked[i])) different++;
+      }
+
+      // Just the compressor, over the plain text
+      start = Clock::now();
+      vector<string> blocks;
+      for (const auto &t : texts) blocks.push_back(BlockCompressor::Compress(t));
+      const double compress = elapsed_seconds(start);
+
+      int mangled = 0;
+      size_t compressed = 0;
+      start = Clock::now();
+      for (size_t i = 0; i < blocks.size(); ++i)
+      {
+         string expanded;
+         if (!BlockCompressor::Decompress(blocks[i], expanded) || expanded != texts[i]) mangled++;
+      }
+      const double expand = elapsed_seconds(start);
+      for (const auto &b : blocks) compressed += b.size();
+
+      wprintf(L"   %5d %10llu %9llu %5.1fx   %8.1f %8.1f   %8.1f %8.1f %5.1fx\n", icons, (unsigned long long)text, (unsigned long long)packed, double(text) / packed,
+         rate(text, pack), rate(text, unpack), rate(text, compress), rate(text, expand), double(text) / compressed);
+
+      failures += Expect(damaged == 0, WSTRING(damaged << L" packed slices of " << icons << L" icons couldn't be unpacked"));
+      failures += Expect(different == 0, WSTRING(different << L" packed slices of " << icons << L" icons came back different"));
+      failures += Expect(mangled == 0, WSTRING(mangled << L" compressed slices of " << icons << L" icons came back different"));
+   }
+
+   return failures;
+}
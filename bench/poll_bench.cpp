@@ -0,0 +1,57 @@
+// DesktopSaver, (c)2006-2016 Nicholas Piegdon, MIT licensed
+
+#include <windows.h>
+#include <chrono>
+
+#include "bench.h"
+#include "saver.h"
+#include "alloc_stats.h"
+#include "string_util.h"
+using namespace std;
+
+static const int PollCount = 200;
+
+// Polls the real desktop while nothing on it moves.  Once the first read
+// has filled in the caches and scratch space, that shouldn't make a
+// single heap allocation.  (Moving an icon while this runs will fail it.)
+int PollBenchmark()
+{
+   wprintf(L"No-change polls\n");
+   if (!AllocStats::Enabled()) return Expect(false, L"built without DESKTOPSAVER_ALLOC_STATS, so nothing is counted");
+
+   // A history of its own, so the real one is left alone
+   wchar_t temp[MAX_PATH + 1];
+   if (GetTempPath(MAX_PATH, temp) == 0) return Expect(false, L"no temporary folder for the history file");
+
+   const wstring path = wstring(temp) + L"DesktopSaverBench_history.txt";
+   DeleteFile(path.c_str());
+   DesktopSaver::UseHistoryPath(path);
+
+   int failures = 0;
+   {
+      // The constructor records the desktop as it is, and one more
+      // poll is the first that has everything already set up
+      DesktopSaver saver;
+      if (saver.GetPollRate() == DisableHistory) wprintf(L"   (history is disabled in the settings, so the polls don't read anything)\n");
+
+      saver.PollDesktopIcons();
+      AllocStats::Reset();
+
+      int over_budget = 0;
+      const chrono::steady_clock::time_point start = chrono::steady_clock::now();
+      for (int i = 0; i < PollCount; ++i)
+      {
+         saver.PollDesktopIcons();
+         if (!AllocStats::WithinBudget(AllocStats::PollDesktopIcons, 0)) over_budget++;
+      }
+      const double ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+
+      const AllocStats::Counts polls = AllocStats::Get(AllocStats::PollDesktopIcons);
+      wprintf(L"   %d polls, %.3f ms each, %llu allocations (%llu bytes) in all\n", PollCount, ms / PollCount, polls.allocations, polls.bytes);
+
+      failures += Expect(over_budget == 0, WSTRING(over_budget << L" polls made heap allocations (at most " << polls.max_allocations << L")"));
+   }
+
+   DeleteFile(path.c_str());
+   return failures;
+}
@@ -0,0 +1,139 @@
+// DesktopSaver, (c)2006-2016 Nicholas Piegdon, MIT licensed
+
+#include <windows.h>
+#include <chrono>
+#include <vector>
+
+#include "bench.h"
+#include "saver.h"
+#include "history_file.h"
+#include "snapshot_builder.h"
+#include "string_util.h"
+using namespace std;
+
+static const int ProfileCount = 10;
+static const int OldRepeats = 3;
+static const int NewRepeats = 10;
+
+typedef chrono::steady_clock Clock;
+
+static double elapsed_ms(Clock::time_point start)
+{
+   return chrono::duration<double, milli>(Clock::now() - start).count();
+}
+
+// A history file of 'slices' layouts of 'icons' icons, with the named
+// profiles at the end.  None of the names are on any real desktop, so
+// restoring one reads the desktop without moving anything.  Returns the
+// profile called 'wanted'.
+static IconHistory write_history(const wstring &path, int slices, int icons, const wstring &wanted)
+{
+   DeleteFile(path.c_str());
+   HistoryFileWriter file(path, false);
+
+   vector<wstring> names;
+   vector<long> xs, ys;
+   for (int i = 0; i < icons; ++i)
+   {
+      names.push_back(WSTRING(L"DesktopSaverBench icon " << i));
+      xs.push_back(21 + (i / 12) * 75);
+      ys.push_back(2 + (i % 12) * 102);
+   }
+
+   SnapshotBuilder snapshot;
+   IconHistory previous, found;
+   for (int s = 0; s < slices + ProfileCount; ++s)
+   {
+      xs[s % icons] += 75;
+
+      snapshot.Reset();
+      for (int i = 0; i < icons; ++i) snapshot.AddIcon(names[i], xs[i], ys[i]);
+
+      IconHistory h;
+      snapshot.CompactInto(h);
+      h.SetTime(1456000000 + s * 60);
+      h.CalculateName(previous);
+      if (s >= slices) h.SetProfileName(WSTRING(L"Profile " << s - slices));
+
+      file.Write(h);
+      if (h.IsNamedProfile() && h.GetName() == wanted) found = h;
+      previous = h;
+   }
+
+   file.Finish();
+   return found;
+}
+
+static uint64_t file_size(const wstring &path)
+{
+   WIN32_FILE_ATTRIBUTE_DATA data;
+   if (!GetFileAttributesEx(path.c_str(), GetFileExInfoStandard, &data)) return 0;
+   return (uint64_t(data.nFileSizeHigh) << 32) | data.nFileSizeLow;
+}
+
+// Restoring a profile from the command line, the way it used to be done
+// (a whole DesktopSaver: every slice loaded, a poll that can rewrite the
+// file, then the restore and another poll) against AutoLoadProfile's
+// path, which only reads the profile and applies it.  Both include
+// reading (and moving icons on) the real desktop.
+int ProfileLoadBenchmark()
+{
+   wprintf(L"Command-line profile restore (ms, including the desktop)\n");
+   wprintf(L"   %7ls %6ls   %10ls %10ls\n", L"slices", L"icons", L"full load", L"profile");
+
+   wchar_t temp[MAX_PATH + 1];
+   if (GetTempPath(MAX_PATH, temp) == 0) return Expect(false, L"no temporary folder for the history file");
+
+   const wstring path = wstring(temp) + L"DesktopSaverBench_profiles.txt";
+   DesktopSaver::UseHistoryPath(path);
+
+   const int sizes[][2] = { { 1000, 200 }, { 200, 2000 } };
+
+   int failures = 0;
+   for (const auto &size : sizes)
+   {
+      const wstring wanted = L"Profile 3";
+
+      // A full startup can write the file, so each run gets a fresh one
+      double old_ms = 0;
+      int old_found = 0;
+      for (int r = 0; r < OldRepeats; ++r)
+      {
+         write_history(path, size[0], size[1], wanted);
+
+         const Clock::time_point start = Clock::now();
+         DesktopSaver saver;
+         const IconHistory *profile = saver.NamedProfiles().Find(wanted);
+         if (profile) { saver.RestoreHistory(*profile); old_found++; }
+         old_ms += elapsed_ms(start);
+      }
+
+      const IconHistory expected = write_history(path, size[0], size[1], wanted);
+      const uint64_t written = file_size(path);
+
+      double new_ms = 0;
+      int new_found = 0, identical = 0;
+      for (int r = 0; r < NewRepeats; ++r)
+      {
+         const Clock::time_point start = Clock::now();
+         IconHistory profile;
+         if (DesktopSaver::LoadNamedProfile(wanted, profile))
+         {
+            SnapshotBuilder scratch;
+            DesktopSaver::ApplyLayout(profile, scratch);
+            new_found++;
+            if (profile.Identical(expected)) identical++;
+         }
+         new_ms += elapsed_ms(start);
+      }
+
+      wprintf(L"   %7d %6d   %10.1f %10.1f\n", size[0], size[1], old_ms / OldRepeats, new_ms / NewRepeats);
+
+      failures += Expect(old_found == OldRepeats, WSTRING(L"a full load of " << size[0] << L" slices didn't find the profile"));
+      failures += Expect(new_found == NewRepeats && identical == NewRepeats, WSTRING(L"reading just the profile from " << size[0] << L" slices didn't find it (or got the wrong icons)"));
+      failures += Expect(file_size(path) == written, WSTRING(L"restoring just the profile from " << size[0] << L" slices wrote to the history file"));
+   }
+
+   DeleteFile(path.c_str());
+   return failures;
+}
@@ -0,0 +1,107 @@
+// DesktopSaver, (c)2006-2016 Nicholas Piegdon, MIT licensed
+
+#include <windows.h>
+#include <algorithm>
+#include <chrono>
+#include <random>
+#include <vector>
+
+#include "bench.h"
+#include "icon_history.h"
+#include "snapshot_builder.h"
+#include "string_util.h"
+using namespace std;
+
+typedef chrono::steady_clock Clock;
+
+// Microseconds since 'start', per repeat
+static double elapsed_us(Clock::time_point start, int repeats)
+{
+   return chrono::duration<double, micro>(Clock::now() - start).count() / repeats;
+}
+
+// Building a snapshot, looking up every icon in it by name, and telling
+// whether a poll matches the last layout (both as a built IconHistory
+// and straight from the builder).  Each is checked against what it
+// should have found.
+int SnapshotBenchmark()
+{
+   wprintf(L"Snapshots (us per call; Find is for every icon)\n");
+   wprintf(L"   %6ls   %9ls %9ls   %9ls %9ls %9ls\n", L"icons", L"build", L"Find", L"Identical", L"Matches", L"moved");
+
+   int failures = 0;
+   const int sizes[] = { 100, 1000, 10000 };
+   for (int size : sizes)
+   {
+      const int repeats = 100000 / size;
+
+      mt19937 random(size);
+      vector<wstring> names;
+      vector<long> xs, ys;
+      for (int i = 0; i < size; ++i)
+      {
+         names.push_back(WSTRING(L"Shortcut to something " << random() % 1000000 << L".lnk"));
+         xs.push_back(21 + (i / 12) * 75);
+         ys.push_back(2 + (i % 12) * 102);
+      }
+
+      SnapshotBuilder snapshot;
+      IconHistory built;
+      Clock::time_point start = Clock::now();
+      for (int r = 0; r < repeats; ++r)
+      {
+         snapshot.Reset();
+         for (int i = 0; i < size; ++i) snapshot.AddIcon(names[i], xs[i], ys[i]);
+
+         IconHistory h;
+         snapshot.CompactInto(h);
+         built = h;
+      }
+      const double build = elapsed_us(start, repeats);
+
+      int missing = 0;
+      start = Clock::now();
+      for (int r = 0; r < repeats; ++r)
+         for (const auto &name : names)
+         {
+            const size_t found = built.Find(name);
+            if (found == IconHistory::npos || built.GetIcons()[found].name != name) missing++;
+         }
+      const double find = elapsed_us(start, repeats);
+
+      // The same layout again, which shares the first one's snapshot
+      IconHistory again;
+      snapshot.CompactInto(again);
+
+      int identical = 0;
+      start = Clock::now();
+      for (int r = 0; r < repeats; ++r) identical += built.Identical(again);
+      const double same = elapsed_us(start, repeats);
+
+      int matched = 0;
+      start = Clock::now();
+      for (int r = 0; r < repeats; ++r) matched += snapshot.Matches(built);
+      const double matches = elapsed_us(start, repeats);
+
+      // A poll with one icon moved (the one that sorts last, so every
+      // coordinate has to be looked at before it's turned down)
+      const size_t last = max_element(names.begin(), names.end()) - names.begin();
+      snapshot.Reset();
+      for (int i = 0; i < size; ++i) snapshot.AddIcon(names[i], xs[i] + (size_t(i) == last ? 75 : 0), ys[i]);
+      snapshot.Finish();
+
+      int moved_matched = 0;
+      start = Clock::now();
+      for (int r = 0; r < repeats; ++r) moved_matched += snapshot.Matches(built);
+      const double moved = elapsed_us(start, repeats);
+
+      wprintf(L"   %6d   %9.2f %9.2f   %9.3f %9.2f %9.2f\n", size, build, find, same, matches, moved);
+
+      failures += Expect(missing == 0, WSTRING(missing << L" lookups in " << size << L" icons didn't find the icon"));
+      failures += Expect(identical == repeats, WSTRING(L"equal layouts of " << size << L" icons weren't Identical"));
+      failures += Expect(matched == repeats, WSTRING(L"an unchanged poll of " << size << L" icons didn't match"));
+      failures += Expect(moved_matched == 0, WSTRING(L"a poll of " << size << L" icons with one moved still matched"));
+   }
+
+   return failures;
+}
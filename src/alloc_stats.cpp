@@ -0,0 +1,115 @@
+// DesktopSaver, (c)2006-2016 Nicholas Piegdon, MIT licensed
+
+#include "alloc_stats.h"
+#include "string_util.h"
+
+#include <cstdlib>
+#include <mutex>
+#include <new>
+using namespace std;
+
+// thread_local isn't there before VS2015, but plain counters don't need it
+#ifdef _MSC_VER
+#define ALLOC_THREAD_LOCAL __declspec(thread)
+#else
+#define ALLOC_THREAD_LOCAL __thread
+#endif
+
+// Zero-initialized before anything (including other static
+// constructors) gets a chance to call operator new
+static ALLOC_THREAD_LOCAL unsigned long long total_allocations;
+static ALLOC_THREAD_LOCAL unsigned long long total_bytes;
+
+#ifdef DESKTOPSAVER_ALLOC_STATS
+
+static void *counted_allocation(size_t size)
+{
+   total_allocations++;
+   total_bytes += size;
+
+   void *p = malloc(size == 0 ? 1 : size);
+   if (p == nullptr) throw bad_alloc();
+   return p;
+}
+
+void *operator new(size_t size) { return counted_allocation(size); }
+void *operator new[](size_t size) { return counted_allocation(size); }
+void operator delete(void *p) throw() { free(p); }
+void operator delete[](void *p) throw() { free(p); }
+
+#endif
+
+static mutex counts_mutex;
+static AllocStats::Counts counts[AllocStats::RegionCount];
+
+bool AllocStats::Enabled()
+{
+#ifdef DESKTOPSAVER_ALLOC_STATS
+   return true;
+#else
+   return false;
+#endif
+}
+
+AllocStats::Counts AllocStats::Get(Region r)
+{
+   lock_guard<mutex> lock(counts_mutex);
+   return counts[r];
+}
+
+const wchar_t *AllocStats::RegionName(Region r)
+{
+   switch (r)
+   {
+   case PollDesktopIcons: return L"PollDesktopIcons";
+   case ReadDesktop:      return L"ReadDesktop";
+   case Serialize:        return L"serialize";
+   case Deserialize:      return L"deserialize";
+   case RestoreHistory:   return L"RestoreHistory";
+   case BuildDynamicMenu: return L"TrayMenu::Build";
+   default:               return L"unknown";
+   }
+}
+
+void AllocStats::Reset()
+{
+   lock_guard<mutex> lock(counts_mutex);
+   for (auto &c : counts) c = Counts();
+}
+
+wstring AllocStats::Report()
+{
+   if (!Enabled()) return L"Allocation counting is not enabled in this build.";
+
+   wstring report;
+   for (int i = 0; i < RegionCount; ++i)
+   {
+      const Counts c = Get(Region(i));
+      if (c.calls == 0) { report += WSTRING(RegionName(Region(i)) << L": not called yet\n"); continue; }
+
+      report += WSTRING(RegionName(Region(i)) << L": " << c.calls << L" calls, "
+         << c.allocations / c.calls << L" allocations (" << c.bytes / c.calls << L" bytes) per call, "
+         << L"last " << c.last_allocations << L" (" << c.last_bytes << L" bytes), "
+         << L"max " << c.max_allocations << L"\n");
+   }
+
+   return report;
+}
+
+AllocStats::Scope::Scope(Region r) : m_region(r), m_allocations(total_allocations), m_bytes(total_bytes) { }
+
+AllocStats::Scope::~Scope()
+{
+   // Take the totals first so the bookkeeping below isn't counted
+   const size_t allocations = size_t(total_allocations - m_allocations);
+   const size_t bytes = size_t(total_bytes - m_bytes);
+
+   lock_guard<mutex> lock(counts_mutex);
+   Counts &c = counts[m_region];
+   c.calls++;
+   c.allocations += allocations;
+   c.bytes += bytes;
+   c.last_allocations = allocations;
+   c.last_bytes = bytes;
+   if (allocations > c.max_allocations) c.max_allocations = allocations;
+}
@@ -0,0 +1,71 @@
+// DesktopSaver, (c)2006-2016 Nicholas Piegdon, MIT licensed
+#pragma once
+
+#include <string>
+#include <cstddef>
+
+// Opt-in heap allocation counting for the hot paths.  Define
+// DESKTOPSAVER_ALLOC_STATS for the whole build to replace the global
+// operator new with a counting version and turn each ALLOC_SCOPE into a
+// tally of the allocations (and bytes) made while it was active.  Scopes
+// are inclusive: a poll's count includes the serialize() it triggers.
+// Each thread is counted on its own, so a scope on the worker thread
+// doesn't pick up anything the UI thread allocates at the same time.
+//
+// Without the define, ALLOC_SCOPE compiles away to nothing and every
+// count stays at zero.
+class AllocStats
+{
+public:
+   enum Region { PollDesktopIcons, ReadDesktop, Serialize, Deserialize, RestoreHistory, BuildDynamicMenu, RegionCount };
+
+   struct Counts
+   {
+      unsigned long long calls;
+      unsigned long long allocations;
+      unsigned long long bytes;
+
+      // Just the most recent call
+      size_t last_allocations;
+      size_t last_bytes;
+
+      size_t max_allocations;
+   };
+
+   static bool Enabled();
+
+   static Counts Get(Region r);
+   static const wchar_t *RegionName(Region r);
+
+   // True if the most recent call in this region made no more than
+   // 'allocations' allocations (e.g. zero for a poll where nothing moved,
+   // see bench/poll_bench.cpp)
+   static bool WithinBudget(Region r, size_t allocations) { return Get(r).last_allocations <= allocations; }
+
+   static void Reset();
+
+   // One line per region, for the stats output
+   static std::wstring Report();
+
+   class Scope
+   {
+   public:
+      Scope(Region r);
+      ~Scope();
+
+   private:
+      // Explicitly deny copying and assignment
+      Scope(const Scope&);
+      Scope &operator=(const Scope&);
+
+      Region m_region;
+      unsigned long long m_allocations;
+      unsigned long long m_bytes;
+   };
+};
+
+#ifdef DESKTOPSAVER_ALLOC_STATS
+#define ALLOC_SCOPE(region) AllocStats::Scope alloc_scope_##region(AllocStats::region)
+#else
+#define ALLOC_SCOPE(region)
+#endif
@@ -0,0 +1,80 @@
+// DesktopSaver, (c)2006-2016 Nicholas Piegdon, MIT licensed
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <type_traits>
+#include <vector>
+
+// A monotonic ("bump pointer") allocator for short-lived data that is all
+// thrown away at once.  Individual allocations are never freed; Reset()
+// discards everything in one step but keeps a single block around (grown
+// to fit the whole of the last round, if that took several) so the next
+// round of allocations doesn't have to go back to the heap at all.
+class Arena
+{
+public:
+   Arena(size_t block_size = 16 * 1024) : m_blockSize(block_size), m_used(0) { }
+
+   template <class T> T *Allocate(size_t count)
+   {
+      static_assert(std::is_trivially_destructible<T>::value, "Arena never runs destructors");
+      return static_cast<T*>(allocate(count * sizeof(T), sizeof(T) < MaxAlign ? sizeof(T) : MaxAlign));
+   }
+
+   void Reset()
+   {
+      if (m_blocks.size() > 1)
+      {
+         // Trade them all for one block that fits everything we needed
+         // last time, so that (next time) a single block will do.
+         size_t total = 0;
+         for (size_t size : m_sizes) total += size;
+         m_blocks.clear();
+         m_sizes.clear();
+
+         m_blockSize = total;
+         m_blocks.push_back(std::unique_ptr<char[]>(new char[total]));
+         m_sizes.push_back(total);
+      }
+
+      m_used = 0;
+   }
+
+   // Heap blocks currently held
+   size_t BlockCount() const { return m_blocks.size(); }
+
+private:
+   // Explicitly deny copying and assignment
+   Arena(const Arena&);
+   Arena &operator=(const Arena&);
+
+   static const size_t MaxAlign = 8;
+
+   void *allocate(size_t bytes, size_t align)
+   {
+      if (!m_blocks.empty())
+      {
+         const size_t start = (m_used + align - 1) & ~(align - 1);
+         if (start + bytes <= m_sizes.back())
+         {
+            m_used = start + bytes;
+            return m_blocks.back().get() + start;
+         }
+      }
+
+      const size_t size = (bytes + align > m_blockSize) ? bytes + align : m_blockSize;
+      m_blocks.push_back(std::unique_ptr<char[]>(new char[size]));
+      m_sizes.push_back(size);
+
+      char *base = m_blocks.back().get();
+      const size_t start = size_t(-reinterpret_cast<ptrdiff_t>(base)) & (align - 1);
+      m_used = start + bytes;
+      return base + start;
+   }
+
+   std::vector<std::unique_ptr<char[]>> m_blocks;
+   std::vector<size_t> m_sizes;
+   size_t m_blockSize;
+   size_t m_used;
+};
@@ -0,0 +1,159 @@
+// DesktopSaver, (c)2006-2016 Nicholas Piegdon, MIT licensed
+
+#include "block_compressor.h"
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+using namespace std;
+
+static const size_t MinMatch = 4;
+static const size_t MaxOffset = 0xFFFF;
+static const int HashBits = 12;
+
+static uint32_t read32(const unsigned char *p)
+{
+   uint32_t v;
+   memcpy(&v, p, sizeof(v));
+   return v;
+}
+
+static size_t hash_sequence(uint32_t sequence)
+{
+   return (sequence * 2654435761u) >> (32 - HashBits);
+}
+
+static void write_length(string &out, size_t length)
+{
+   for (; length >= 255; length -= 255) out += char(255);
+   out += char(length);
+}
+
+static void emit(string &out, const unsigned char *literals, size_t literal_count, size_t offset, size_t match_length)
+{
+   const size_t match_code = match_length > 0 ? match_length - MinMatch : 0;
+
+   out += char(((literal_count < 15 ? literal_count : 15) << 4) | (match_code < 15 ? match_code : 15));
+   if (literal_count >= 15) write_length(out, literal_count - 15);
+   out.append(reinterpret_cast<const char*>(literals), literal_count);
+
+   if (match_length == 0) return;
+
+   out += char(offset & 0xFF);
+   out += char(offset >> 8);
+   if (match_code >= 15) write_length(out, match_code - 15);
+}
+
+void BlockCompressor::WriteVarint(string &out, unsigned long long value)
+{
+   while (value >= 0x80)
+   {
+      out += char((value & 0x7F) | 0x80);
+      value >>= 7;
+   }
+   out += char(value);
+}
+
+bool BlockCompressor::ReadVarint(const string &in, size_t &pos, unsigned long long &value)
+{
+   value = 0;
+   for (int shift = 0; shift < 64; shift += 7)
+   {
+      if (pos >= in.size()) return false;
+
+      const unsigned char b = static_cast<unsigned char>(in[pos++]);
+      value |= (unsigned long long)(b & 0x7F) << shift;
+      if ((b & 0x80) == 0) return true;
+   }
+   return false;
+}
+
+string BlockCompressor::Compress(const string &input)
+{
+   const unsigned char *src = reinterpret_cast<const unsigned char*>(input.data());
+   const size_t n = input.size();
+
+   string out;
+   out.reserve(n / 2 + 16);
+   WriteVarint(out, n);
+
+   static const size_t Empty = size_t(-1);
+   vector<size_t> table(size_t(1) << HashBits, Empty);
+
+   size_t anchor = 0;
+   size_t i = 0;
+   while (i + MinMatch <= n)
+   {
+      const uint32_t sequence = read32(src + i);
+      const size_t h = hash_sequence(sequence);
+      const size_t candidate = table[h];
+      table[h] = i;
+
+      if (candidate == Empty || i - candidate > MaxOffset || read32(src + candidate) != sequence) { ++i; continue; }
+
+      size_t length = MinMatch;
+      while (i + length < n && src[candidate + length] == src[i + length]) ++length;
+
+      emit(out, src + anchor, i - anchor, i - candidate, length);
+      i += length;
+      anchor = i;
+   }
+
+   if (anchor < n) emit(out, src + anchor, n - anchor, 0, 0);
+   return out;
+}
+
+static bool read_length(const string &in, size_t &pos, size_t &length)
+{
+   for (;;)
+   {
+      if (pos >= in.size()) return false;
+
+      const unsigned char b = static_cast<unsigned char>(in[pos++]);
+      length += b;
+      if (b != 255) return true;
+   }
+}
+
+bool BlockCompressor::Decompress(const string &input, string &output)
+{
+   output.clear();
+
+   size_t pos = 0;
+   unsigned long long size = 0;
+   if (!ReadVarint(input, pos, size)) return false;
+
+   // Nothing we write is ever anywhere near this large
+   if (size > (1ull << 30)) return false;
+   output.reserve(size_t(size));
+
+   while (output.size() < size)
+   {
+      if (pos >= input.size()) return false;
+      const unsigned char token = static_cast<unsigned char>(input[pos++]);
+
+      size_t literals = token >> 4;
+      if (literals == 15 && !read_length(input, pos, literals)) return false;
+      if (literals > input.size() - pos || output.size() + literals > size) return false;
+
+      output.append(input, pos, literals);
+      pos += literals;
+      if (output.size() == size) break;
+
+      if (input.size() - pos < 2) return false;
+      const size_t offset = static_cast<unsigned char>(input[pos]) | (size_t(static_cast<unsigned char>(input[pos + 1])) << 8);
+      pos += 2;
+
+      size_t length = token & 0x0F;
+      if (length == 15 && !read_length(input, pos, length)) return false;
+      length += MinMatch;
+
+      if (offset == 0 || offset > output.size() || output.size() + length > size) return false;
+
+      // Matches may overlap the bytes they're producing, so copy one at a time
+      size_t from = output.size() - offset;
+      for (size_t k = 0; k < length; ++k) output += output[from + k];
+   }
+
+   return true;
+}
@@ -0,0 +1,26 @@
+// DesktopSaver, (c)2006-2016 Nicholas Piegdon, MIT licensed
+#pragma once
+
+#include <string>
+
+// A small LZ77-style byte compressor (in the spirit of LZ4) so the compact
+// history format doesn't need any outside libraries.  It is tuned for speed
+// rather than ratio: a single greedy pass with a 4K-entry hash table.
+//
+// Format: varint uncompressed size, followed by sequences of
+//    [token][extra literal length][literals][offset (2 bytes)][extra match length]
+// where the token's high nibble is the literal count and the low nibble
+// is the match length minus MinMatch (15 in either means "more follows").
+// The final sequence carries only literals.
+class BlockCompressor
+{
+public:
+   static std::string Compress(const std::string &input);
+
+   // Returns false if the input is damaged.  Anything past the end of the
+   // compressed block (e.g. padding) is ignored.
+   static bool Decompress(const std::string &input, std::string &output);
+
+   static void WriteVarint(std::string &out, unsigned long long value);
+   static bool ReadVarint(const std::string &in, size_t &pos, unsigned long long &value);
+};
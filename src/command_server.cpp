@@ -0,0 +1,479 @@
+// DesktopSaver, (c)2006-2016 Nicholas Piegdon, MIT licensed
+
+#include "command_server.h"
+#include "string_util.h"
+
+#ifdef _WIN32
+#include <sddl.h>
+#include <vector>
+#else
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#endif
+
+using namespace std;
+
+// Nobody has any business sending more than this
+static const size_t MaxRequestLength = 64 * 1024;
+
+static const size_t BufferSize = 4096;
+
+// How long a client gets to send its request (and take the answer) before
+// we hang up on it
+static const int ClientTimeoutMilliseconds = 5000;
+
+#ifdef _WIN32
+
+// Ends every response, so the client knows to hang up.  (Named pipes can't
+// be half-closed, and the server mustn't disconnect before the client has
+// read everything, because that throws away whatever is still unread.)
+static const char EndOfResponse = '\0';
+
+// How long to wait between attempts to open another pipe instance
+static const DWORD RetryMilliseconds = 1000;
+
+wstring CommandServer::DefaultName()
+{
+   wchar_t user[256] = L"";
+   DWORD length = 256;
+   GetUserName(user, &length);
+
+   // The same user can be logged in more than once (e.g. locally and over
+   // Remote Desktop), and each session has its own desktop
+   DWORD session = 0;
+   ProcessIdToSessionId(GetCurrentProcessId(), &session);
+
+   return WSTRING(L"\\\\.\\pipe\\DesktopSaver-" << session << L"-" << user);
+}
+
+// A DACL that only lets the user running this process in, or empty if
+// that user couldn't be found
+static wstring current_user_only()
+{
+   HANDLE token = NULL;
+   if (!OpenProcessToken(GetCurrentProcess(), TOKEN_QUERY, &token)) return wstring();
+
+   DWORD size = 0;
+   GetTokenInformation(token, TokenUser, NULL, 0, &size);
+   vector<char> buffer(size);
+
+   wstring sddl;
+   LPWSTR sid = NULL;
+   if (size > 0 && GetTokenInformation(token, TokenUser, buffer.data(), size, &size) && ConvertSidToStringSid(reinterpret_cast<TOKEN_USER*>(buffer.data())->User.Sid, &sid))
+   {
+      sddl = wstring(L"D:P(A;;GA;;;") + sid + L")";
+      LocalFree(sid);
+   }
+
+   CloseHandle(token);
+   return sddl;
+}
+
+static HANDLE create_pipe(const wstring &name, bool first, PSECURITY_DESCRIPTOR security)
+{
+   SECURITY_ATTRIBUTES attributes = { sizeof(SECURITY_ATTRIBUTES), security, FALSE };
+   return CreateNamedPipe(name.c_str(), PIPE_ACCESS_DUPLEX | FILE_FLAG_OVERLAPPED | (first ? FILE_FLAG_FIRST_PIPE_INSTANCE : 0),
+      PIPE_TYPE_BYTE | PIPE_READMODE_BYTE | PIPE_WAIT | PIPE_REJECT_REMOTE_CLIENTS, PIPE_UNLIMITED_INSTANCES, BufferSize, BufferSize, 0, &attributes);
+}
+
+static bool write_all(HANDLE h, const string &bytes)
+{
+   DWORD written = 0;
+   return bytes.empty() || (WriteFile(h, bytes.data(), DWORD(bytes.size()), &written, NULL) && written == bytes.size());
+}
+
+// Reads until the end of the response (or of the stream)
+static string read_response(HANDLE h)
+{
+   string bytes;
+   char buffer[BufferSize];
+
+   DWORD read = 0;
+   while (bytes.size() < MaxRequestLength && ReadFile(h, buffer, BufferSize, &read, NULL) && read > 0)
+   {
+      bytes.append(buffer, read);
+      if (bytes.back() == EndOfResponse) { bytes.pop_back(); break; }
+   }
+
+   return bytes;
+}
+
+// The server's end of the pipe is overlapped, so nothing it does can block
+// for longer than 'timeout' or past the 'stop' event.  Anything that runs
+// out of time is cancelled.
+static bool finish_io(HANDLE pipe, OVERLAPPED &o, BOOL started, HANDLE stop, DWORD timeout, DWORD &transferred)
+{
+   transferred = 0;
+   if (!started && GetLastError() != ERROR_IO_PENDING) return false;
+
+   const HANDLE events[] = { o.hEvent, stop };
+   if (WaitForMultipleObjects(2, events, FALSE, timeout) != WAIT_OBJECT_0)
+   {
+      CancelIo(pipe);
+      GetOverlappedResult(pipe, &o, &transferred, TRUE);
+      return false;
+   }
+
+   return GetOverlappedResult(pipe, &o, &transferred, FALSE) != 0;
+}
+
+// Milliseconds left until 'timeout' has passed since 'start'
+static DWORD remaining(DWORD start, DWORD timeout)
+{
+   const DWORD elapsed = GetTickCount() - start;
+   return elapsed < timeout ? timeout - elapsed : 0;
+}
+
+static bool wait_for_client(HANDLE pipe, HANDLE stop, HANDLE event)
+{
+   OVERLAPPED o = { };
+   o.hEvent = event;
+
+   // A client can connect between creating the pipe and getting here
+   if (ConnectNamedPipe(pipe, &o) || GetLastError() == ERROR_PIPE_CONNECTED) return true;
+
+   DWORD ignored;
+   return finish_io(pipe, o, FALSE, stop, INFINITE, ignored);
+}
+
+// Reads until the end of the line, or until the client runs out of time
+static string read_request(HANDLE pipe, HANDLE stop, HANDLE event)
+{
+   string bytes;
+   char buffer[BufferSize];
+
+   const DWORD start = GetTickCount();
+   while (bytes.size() < MaxRequestLength)
+   {
+      OVERLAPPED o = { };
+      o.hEvent = event;
+
+      DWORD read = 0;
+      const BOOL started = ReadFile(pipe, buffer, BufferSize, NULL, &o);
+      if (!finish_io(pipe, o, started, stop, remaining(start, ClientTimeoutMilliseconds), read) || read == 0) return string();
+
+      bytes.append(buffer, read);
+      if (bytes.back() == '\n') break;
+   }
+
+   return bytes;
+}
+
+static void write_response(HANDLE pipe, const string &bytes, HANDLE stop, HANDLE event)
+{
+   const DWORD start = GetTickCount();
+   for (size_t sent = 0; sent < bytes.size(); )
+   {
+      OVERLAPPED o = { };
+      o.hEvent = event;
+
+      DWORD written = 0;
+      const BOOL started = WriteFile(pipe, bytes.data() + sent, DWORD(bytes.size() - sent), NULL, &o);
+      if (!finish_io(pipe, o, started, stop, remaining(start, ClientTimeoutMilliseconds), written) || written == 0) return;
+
+      sent += written;
+   }
+}
+
+// Waits for the client to close its end (which it does once it has read
+// the whole response), but no longer than it gets for anything else
+static void wait_for_hangup(HANDLE pipe, HANDLE stop, HANDLE event)
+{
+   char buffer[BufferSize];
+
+   const DWORD start = GetTickCount();
+   for (;;)
+   {
+      OVERLAPPED o = { };
+      o.hEvent = event;
+
+      DWORD read = 0;
+      const BOOL started = ReadFile(pipe, buffer, BufferSize, NULL, &o);
+      if (!finish_io(pipe, o, started, stop, remaining(start, ClientTimeoutMilliseconds), read) || read == 0) return;
+   }
+}
+
+bool CommandServer::Send(const wstring &name, const wstring &request, wstring &response)
+{
+   HANDLE pipe = CreateFile(name.c_str(), GENERIC_READ | GENERIC_WRITE, 0, NULL, OPEN_EXISTING, 0, NULL);
+
+   // Every instance of the pipe is busy with some other client
+   if (pipe == INVALID_HANDLE_VALUE && GetLastError() == ERROR_PIPE_BUSY && WaitNamedPipe(name.c_str(), 5000))
+      pipe = CreateFile(name.c_str(), GENERIC_READ | GENERIC_WRITE, 0, NULL, OPEN_EXISTING, 0, NULL);
+
+   if (pipe == INVALID_HANDLE_VALUE) return false;
+
+   const bool sent = write_all(pipe, ToUtf8(request) + "\n");
+   response = sent ? FromUtf8(read_response(pipe)) : wstring();
+
+   CloseHandle(pipe);
+   return sent;
+}
+
+CommandServer::CommandServer(const wstring &name, Handler handler) : m_name(name), m_handler(handler), m_listening(false), m_stopping(false), m_pipe(INVALID_HANDLE_VALUE), m_stop(NULL), m_security(NULL)
+{
+   // Without a DACL the pipe would get the default one, which other
+   // accounts on the machine can open, so don't listen at all
+   const wstring dacl = current_user_only();
+   if (dacl.empty() || !ConvertStringSecurityDescriptorToSecurityDescriptor(dacl.c_str(), SDDL_REVISION_1, &m_security, NULL)) return;
+
+   // Only the first instance of a pipe name can be created with
+   // this flag, so this fails if someone else already has it
+   m_pipe = create_pipe(m_name, true, m_security);
+   if (m_pipe == INVALID_HANDLE_VALUE) return;
+
+   m_stop = CreateEvent(NULL, TRUE, FALSE, NULL);
+   m_listening = true;
+   m_thread = thread(&CommandServer::run, this);
+}
+
+void CommandServer::run()
+{
+   HANDLE event = CreateEvent(NULL, TRUE, FALSE, NULL);
+
+   HANDLE pipe = m_pipe;
+   while (pipe != INVALID_HANDLE_VALUE)
+   {
+      const bool connected = wait_for_client(pipe, m_stop, event);
+      if (m_stopping) { CloseHandle(pipe); break; }
+
+      // The next client can start connecting while this one is served
+      HANDLE next = create_pipe(m_name, false, m_security);
+
+      if (connected)
+      {
+         string request = read_request(pipe, m_stop, event);
+         if (!request.empty() && request.back() == '\n') request.pop_back();
+
+         // Someone who connected but never said anything gets nothing back
+         if (!request.empty())
+         {
+            write_response(pipe, ToUtf8(m_handler(FromUtf8(request))) + EndOfResponse, m_stop, event);
+            wait_for_hangup(pipe, m_stop, event);
+         }
+      }
+
+      DisconnectNamedPipe(pipe);
+
+      // If there's no new instance, this one can be connected again (it
+      // also keeps the name from being taken in the meantime).  Something
+      // is wrong if waiting failed too, so give it a moment first.
+      if (next == INVALID_HANDLE_VALUE)
+      {
+         if (!connected && WaitForSingleObject(m_stop, RetryMilliseconds) != WAIT_TIMEOUT) { CloseHandle(pipe); break; }
+         continue;
+      }
+
+      CloseHandle(pipe);
+      pipe = next;
+   }
+
+   CloseHandle(event);
+}
+
+CommandServer::~CommandServer()
+{
+   if (m_listening)
+   {
+      // Wakes the server thread from whatever it's waiting on
+      m_stopping = true;
+      SetEvent(m_stop);
+      m_thread.join();
+
+      CloseHandle(m_stop);
+   }
+
+   if (m_security) LocalFree(m_security);
+}
+
+#else
+
+wstring CommandServer::DefaultName()
+{
+   // The per-user runtime directory if there is one, or else a private
+   // directory of our own in /tmp (see private_directory)
+   const char *runtime = getenv("XDG_RUNTIME_DIR");
+   if (runtime && runtime[0] == '/') return FromUtf8(runtime) + L"/desktopsaver.sock";
+
+   return WSTRING(L"/tmp/desktopsaver-" << getuid() << L"/command.sock");
+}
+
+// Makes sure the directory holding 'path' exists and belongs to this user
+// alone (creating it if need be), so nobody else can put a socket there
+// or get at ours
+static bool private_directory(const string &path)
+{
+   const size_t slash = path.find_last_of('/');
+   if (slash == string::npos || slash == 0) return false;
+   const string directory = path.substr(0, slash);
+
+   if (mkdir(directory.c_str(), S_IRWXU) != 0 && errno != EEXIST) return false;
+
+   struct stat info;
+   if (lstat(directory.c_str(), &info) != 0) return false;
+   return S_ISDIR(info.st_mode) && info.st_uid == getuid() && (info.st_mode & (S_IRWXG | S_IRWXO)) == 0;
+}
+
+// True if whoever is on the other end of 's' is running as this user
+static bool same_user(int s)
+{
+#ifdef SO_PEERCRED
+   ucred credentials;
+   socklen_t length = sizeof(credentials);
+   if (getsockopt(s, SOL_SOCKET, SO_PEERCRED, &credentials, &length) != 0) return false;
+   return credentials.uid == getuid();
+#else
+   uid_t uid;
+   gid_t gid;
+   if (getpeereid(s, &uid, &gid) != 0) return false;
+   return uid == getuid();
+#endif
+}
+
+static bool make_address(const wstring &name, sockaddr_un &address)
+{
+   const string path = ToUtf8(name);
+   if (path.size() >= sizeof(address.sun_path)) return false;
+
+   memset(&address, 0, sizeof(address));
+   address.sun_family = AF_UNIX;
+   memcpy(address.sun_path, path.c_str(), path.size() + 1);
+   return true;
+}
+
+static int connect_to(const wstring &name)
+{
+   sockaddr_un address;
+   if (!make_address(name, address)) return -1;
+
+   const int s = socket(AF_UNIX, SOCK_STREAM, 0);
+   if (s < 0) return -1;
+
+   // Never hand a request to a server some other user is running
+   if (connect(s, reinterpret_cast<sockaddr*>(&address), sizeof(address)) == 0 && same_user(s)) return s;
+
+   close(s);
+   return -1;
+}
+
+// A client that hangs up early shouldn't take the whole process down
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+static bool write_all(int s, const string &bytes)
+{
+   for (size_t sent = 0; sent < bytes.size(); )
+   {
+      const ssize_t n = send(s, bytes.data() + sent, bytes.size() - sent, MSG_NOSIGNAL);
+      if (n <= 0) return false;
+      sent += size_t(n);
+   }
+   return true;
+}
+
+// Reads until the end of the line (or of the stream, if 'line' is false)
+static string read_all(int s, bool line)
+{
+   string bytes;
+   char buffer[BufferSize];
+
+   ssize_t n = 0;
+   while (bytes.size() < MaxRequestLength && (n = read(s, buffer, BufferSize)) > 0)
+   {
+      bytes.append(buffer, size_t(n));
+      if (line && bytes.back() == '\n') break;
+   }
+
+   return bytes;
+}
+
+bool CommandServer::Send(const wstring &name, const wstring &request, wstring &response)
+{
+   const int s = connect_to(name);
+   if (s < 0) return false;
+
+   const bool sent = write_all(s, ToUtf8(request) + "\n");
+   shutdown(s, SHUT_WR);
+   response = sent ? FromUtf8(read_all(s, false)) : wstring();
+
+   close(s);
+   return sent;
+}
+
+CommandServer::CommandServer(const wstring &name, Handler handler) : m_name(name), m_handler(handler), m_listening(false), m_stopping(false), m_socket(-1)
+{
+   sockaddr_un address;
+   if (!make_address(m_name, address) || !private_directory(address.sun_path)) return;
+
+   // A socket file nobody answers on was left behind by a crash
+   const int existing = connect_to(m_name);
+   if (existing >= 0) { close(existing); return; }
+   unlink(address.sun_path);
+
+   m_socket = socket(AF_UNIX, SOCK_STREAM, 0);
+   if (m_socket < 0) return;
+
+   // Owner-only from the moment it exists, so nobody else on the
+   // machine can connect
+   const mode_t mask = umask(S_IXUSR | S_IRWXG | S_IRWXO);
+   const bool bound = bind(m_socket, reinterpret_cast<sockaddr*>(&address), sizeof(address)) == 0;
+   umask(mask);
+
+   if (!bound || listen(m_socket, 8) != 0)
+   {
+      close(m_socket);
+      m_socket = -1;
+      return;
+   }
+
+   m_listening = true;
+   m_thread = thread(&CommandServer::run, this);
+}
+
+void CommandServer::run()
+{
+   for (;;)
+   {
+      const int client = accept(m_socket, nullptr, nullptr);
+      if (m_stopping) { if (client >= 0) close(client); break; }
+      if (client < 0) continue;
+
+      // The socket's permissions should already keep everyone else out
+      if (!same_user(client)) { close(client); continue; }
+
+      // Someone who connects but never says anything can't hold us up
+      timeval timeout = { ClientTimeoutMilliseconds / 1000, (ClientTimeoutMilliseconds % 1000) * 1000 };
+      setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+      setsockopt(client, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+      string request = read_all(client, true);
+      if (!request.empty() && request.back() == '\n') request.pop_back();
+
+      write_all(client, ToUtf8(m_handler(FromUtf8(request))));
+      close(client);
+   }
+
+   close(m_socket);
+   unlink(ToUtf8(m_name).c_str());
+}
+
+CommandServer::~CommandServer()
+{
+   if (!m_listening) return;
+
+   // The server thread is blocked waiting for a client, so be one
+   m_stopping = true;
+   wstring ignored;
+   Send(m_name, wstring(), ignored);
+
+   m_thread.join();
+}
+
+#endif
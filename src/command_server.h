@@ -0,0 +1,69 @@
+// DesktopSaver, (c)2006-2016 Nicholas Piegdon, MIT licensed
+#pragma once
+
+#include <string>
+#include <functional>
+#include <atomic>
+#include <thread>
+
+#ifdef _WIN32
+#include <windows.h>
+#endif
+
+// Lets later command-line invocations hand their work to the copy of
+// DesktopSaver that's already running, so there's only ever one process
+// writing the history file.
+//
+// Each connection carries one request: a single line of UTF-8 text from
+// the client, answered with whatever the handler returns, after which the
+// connection is closed.  A client that doesn't finish sending its request in
+// time is dropped.  It's a named pipe on Windows (one per user and login
+// session, with a DACL that only admits that user and no remote clients)
+// and an owner-only Unix domain socket in a private directory everywhere
+// else, where each end also checks that the other is the same user.
+class CommandServer
+{
+public:
+   typedef std::function<std::wstring(const std::wstring &request)> Handler;
+
+   // The channel for the current user
+   static std::wstring DefaultName();
+
+   // Sends one request to whoever is listening on 'name' and waits for the
+   // answer.  Returns false if nothing is listening.
+   static bool Send(const std::wstring &name, const std::wstring &request, std::wstring &response);
+
+   // Starts answering requests on a thread of its own.  'handler' is called
+   // on that thread, one request at a time.
+   CommandServer(const std::wstring &name, Handler handler);
+   ~CommandServer();
+
+   // False if some other process is already listening on this channel
+   // (or it couldn't be opened at all)
+   bool Listening() const { return m_listening; }
+
+private:
+   // Explicitly deny copying and assignment
+   CommandServer(const CommandServer&);
+   CommandServer &operator=(const CommandServer&);
+
+   void run();
+
+   const std::wstring m_name;
+   const Handler m_handler;
+
+   bool m_listening;
+   std::atomic<bool> m_stopping;
+
+#ifdef _WIN32
+   HANDLE m_pipe;
+
+   // Signalled to stop the server thread
+   HANDLE m_stop;
+   PSECURITY_DESCRIPTOR m_security;
+#else
+   int m_socket;
+#endif
+
+   std::thread m_thread;
+};
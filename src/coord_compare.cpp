@@ -0,0 +1,180 @@
+// DesktopSaver, (c)2006-2016 Nicholas Piegdon, MIT licensed
+
+#include "coord_compare.h"
+
+#if defined(_M_IX86) || defined(_M_X64) || defined(__i386__) || defined(__x86_64__)
+#define COORD_COMPARE_X86
+#include <immintrin.h>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#define TARGET_AVX2
+#else
+#include <cpuid.h>
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#endif
+
+using namespace std;
+
+static const size_t None = size_t(-1);
+
+static int count_bits(unsigned int v)
+{
+   int count = 0;
+   for (; v != 0; v &= v - 1) ++count;
+   return count;
+}
+
+static int highest_bit(unsigned int v)
+{
+   int bit = -1;
+   for (; v != 0; v >>= 1) ++bit;
+   return bit;
+}
+
+// Adds 'base' plus each set bit of 'mask' to 'positions', lowest first
+static void add_positions(vector<size_t> *positions, size_t base, unsigned int mask)
+{
+   if (!positions) return;
+   for (size_t bit = 0; mask != 0; ++bit, mask >>= 1) if (mask & 1) positions->push_back(base + bit);
+}
+
+// Each implementation handles as many whole vectors as it can starting at
+// 'i', stopping early at the first difference if 'first_only' is set.
+// Returns where it left off, and updates the running difference count,
+// the index of the last difference, and (if given) the list of them.
+static size_t scalar_kernel(const int *xa, const int *ya, const int *xb, const int *yb, size_t i, size_t count, bool first_only, size_t &differences, size_t &last, vector<size_t> *positions)
+{
+   for (; i < count; ++i)
+   {
+      if (xa[i] == xb[i] && ya[i] == yb[i]) continue;
+
+      differences++;
+      last = i;
+      add_positions(positions, i, 1);
+      if (first_only) return count;
+   }
+
+   return i;
+}
+
+#ifdef COORD_COMPARE_X86
+static size_t sse2_kernel(const int *xa, const int *ya, const int *xb, const int *yb, size_t i, size_t count, bool first_only, size_t &differences, size_t &last, vector<size_t> *positions)
+{
+   for (; i + 4 <= count; i += 4)
+   {
+      const __m128i same_x = _mm_cmpeq_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(xa + i)), _mm_loadu_si128(reinterpret_cast<const __m128i*>(xb + i)));
+      const __m128i same_y = _mm_cmpeq_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(ya + i)), _mm_loadu_si128(reinterpret_cast<const __m128i*>(yb + i)));
+
+      const unsigned int different = ~unsigned(_mm_movemask_ps(_mm_castsi128_ps(_mm_and_si128(same_x, same_y)))) & 0xF;
+      if (different == 0) continue;
+
+      differences += count_bits(different);
+      last = i + highest_bit(different);
+      add_positions(positions, i, different);
+      if (first_only) return count;
+   }
+
+   return i;
+}
+
+TARGET_AVX2 static size_t avx2_kernel(const int *xa, const int *ya, const int *xb, const int *yb, size_t i, size_t count, bool first_only, size_t &differences, size_t &last, vector<size_t> *positions)
+{
+   for (; i + 8 <= count; i += 8)
+   {
+      const __m256i same_x = _mm256_cmpeq_epi32(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(xa + i)), _mm256_loadu_si256(reinterpret_cast<const __m256i*>(xb + i)));
+      const __m256i same_y = _mm256_cmpeq_epi32(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(ya + i)), _mm256_loadu_si256(reinterpret_cast<const __m256i*>(yb + i)));
+
+      const unsigned int different = ~unsigned(_mm256_movemask_ps(_mm256_castsi256_ps(_mm256_and_si256(same_x, same_y)))) & 0xFF;
+      if (different == 0) continue;
+
+      differences += count_bits(different);
+      last = i + highest_bit(different);
+      add_positions(positions, i, different);
+      if (first_only) return count;
+   }
+
+   return i;
+}
+#endif
+
+CoordCompare::Level CoordCompare::DetectLevel()
+{
+#ifdef COORD_COMPARE_X86
+   bool sse2 = false, avx2 = false;
+
+#ifdef _MSC_VER
+   int info[4];
+   __cpuid(info, 0);
+   const int max_leaf = info[0];
+
+   __cpuid(info, 1);
+   sse2 = (unsigned(info[3]) & (1u << 26)) != 0;
+
+   // AVX2 also needs the OS to be saving the YMM registers
+   const bool os_avx = (unsigned(info[2]) & (1u << 27)) != 0 && (unsigned(info[2]) & (1u << 28)) != 0 && (_xgetbv(0) & 6) == 6;
+   if (max_leaf >= 7 && os_avx)
+   {
+      __cpuidex(info, 7, 0);
+      avx2 = (unsigned(info[1]) & (1u << 5)) != 0;
+   }
+#else
+   unsigned int regs[4] = { 0, 0, 0, 0 };
+   if (__get_cpuid(1, &regs[0], &regs[1], &regs[2], &regs[3])) sse2 = (regs[3] & (1u << 26)) != 0;
+
+   __builtin_cpu_init();
+   avx2 = __builtin_cpu_supports("avx2") != 0;
+#endif
+
+   if (avx2) return Avx2;
+   if (sse2) return Sse2;
+#endif
+
+   return Scalar;
+}
+
+static CoordCompare::Level level = CoordCompare::DetectLevel();
+
+CoordCompare::Level CoordCompare::CurrentLevel() { return level; }
+
+void CoordCompare::UseLevel(Level l)
+{
+   // Never pick something the CPU can't actually run
+   const Level available = DetectLevel();
+   level = (l > available) ? available : l;
+}
+
+static size_t compare(const int *xa, const int *ya, const int *xb, const int *yb, size_t count, bool first_only, size_t &last, vector<size_t> *positions)
+{
+   size_t differences = 0;
+   last = None;
+
+   size_t i = 0;
+#ifdef COORD_COMPARE_X86
+   if (level == CoordCompare::Avx2) i = avx2_kernel(xa, ya, xb, yb, i, count, first_only, differences, last, positions);
+   if (differences > 0 && first_only) return differences;
+
+   if (level >= CoordCompare::Sse2) i = sse2_kernel(xa, ya, xb, yb, i, count, first_only, differences, last, positions);
+   if (differences > 0 && first_only) return differences;
+#endif
+
+   // Whatever is left over at the end
+   scalar_kernel(xa, ya, xb, yb, i, count, first_only, differences, last, positions);
+   return differences;
+}
+
+bool CoordCompare::Equal(const int *xa, const int *ya, const int *xb, const int *yb, size_t count)
+{
+   size_t last;
+   return compare(xa, ya, xb, yb, count, true, last, nullptr) == 0;
+}
+
+size_t CoordCompare::CountDifferent(const int *xa, const int *ya, const int *xb, const int *yb, size_t count, size_t *last, vector<size_t> *positions)
+{
+   size_t index;
+   const size_t differences = compare(xa, ya, xb, yb, count, false, index, positions);
+
+   if (last && differences > 0) *last = index;
+   return differences;
+}
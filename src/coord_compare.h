@@ -0,0 +1,28 @@
+// DesktopSaver, (c)2006-2016 Nicholas Piegdon, MIT licensed
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+// Compares two snapshots' coordinate arrays (already lined up by icon) a
+// whole vector at a time.  The widest implementation the CPU supports is
+// picked once at startup: AVX2, SSE2, or plain scalar code.
+class CoordCompare
+{
+public:
+   enum Level { Scalar, Sse2, Avx2 };
+
+   // True if every (xa[i], ya[i]) matches (xb[i], yb[i])
+   static bool Equal(const int *xa, const int *ya, const int *xb, const int *yb, size_t count);
+
+   // The number of positions whose coordinates differ.  If there are any,
+   // 'last' receives the index of the final one, and each of their indices
+   // is appended to 'positions' (in order) if it's given.
+   static size_t CountDifferent(const int *xa, const int *ya, const int *xb, const int *yb, size_t count, size_t *last, std::vector<size_t> *positions = nullptr);
+
+   // The implementation currently in use (and a way to override it, which
+   // is only useful for comparing them against each other)
+   static Level CurrentLevel();
+   static Level DetectLevel();
+   static void UseLevel(Level level);
+};
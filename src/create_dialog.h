@@ -1,7 +1,7 @@
-// DesktopSaver, (c)2006-2017 Nicholas Piegdon, MIT licensed
-#pragma once
-
-#include <string>
-#include <Windows.h>
-
-std::wstring AskForNewProfileName(HINSTANCE hinst, HWND hwnd);
+// DesktopSaver, (c)2006-2017 Nicholas Piegdon, MIT licensed
+#pragma once
+
+#include <string>
+#include <Windows.h>
+
+std::wstring AskForNewProfileName(HINSTANCE hinst, HWND hwnd);
@@ -0,0 +1,94 @@
+// DesktopSaver, (c)2006-2016 Nicholas Piegdon, MIT licensed
+
+#include "display_config.h"
+#include "snapshot_store.h"
+#include "string_util.h"
+
+#include <windows.h>
+#include <algorithm>
+using namespace std;
+
+// Anything past this many monitors doesn't change the fingerprint
+static const int MaxMonitors = 16;
+
+struct MonitorList
+{
+   RECT monitors[MaxMonitors];
+   int count;
+};
+
+static BOOL CALLBACK add_monitor(HMONITOR, HDC, LPRECT rect, LPARAM lparam)
+{
+   MonitorList &list = *reinterpret_cast<MonitorList*>(lparam);
+   if (list.count < MaxMonitors) list.monitors[list.count++] = *rect;
+   return TRUE;
+}
+
+static void read_monitors(MonitorList &list)
+{
+   list.count = 0;
+   EnumDisplayMonitors(NULL, NULL, add_monitor, reinterpret_cast<LPARAM>(&list));
+
+   // Windows doesn't promise any particular order
+   sort(list.monitors, list.monitors + list.count, [](const RECT &a, const RECT &b) { return a.left != b.left ? a.left < b.left : a.top < b.top; });
+}
+
+uint64_t DisplayConfig::Fingerprint()
+{
+   MonitorList list;
+   read_monitors(list);
+
+   Fnv64 hash;
+   hash.AddUnit(uint32_t(list.count));
+   for (int i = 0; i < list.count; ++i)
+   {
+      const RECT &r = list.monitors[i];
+      const long values[] = { r.left, r.top, r.right - r.left, r.bottom - r.top };
+      for (long v : values)
+      {
+         hash.AddUnit(uint32_t(v) & 0xFFFF);
+         hash.AddUnit(uint32_t(v) >> 16);
+      }
+   }
+
+   return hash.Value() != 0 ? hash.Value() : 1;
+}
+
+wstring DisplayConfig::Describe()
+{
+   MonitorList list;
+   read_monitors(list);
+
+   wstring description;
+   for (int i = 0; i < list.count; ++i)
+   {
+      const RECT &r = list.monitors[i];
+      if (!description.empty()) description += L", ";
+      description += WSTRING(r.right - r.left << L"x" << r.bottom - r.top << L" at (" << r.left << L", " << r.top << L")");
+   }
+
+   return description;
+}
+
+int DisplayConfig::Monitors::Find(long x, long y) const
+{
+   for (size_t i = 0; i < rects.size(); ++i) if (rects[i].Contains(x + origin_x, y + origin_y)) return int(i);
+   return -1;
+}
+
+DisplayConfig::Monitors DisplayConfig::Current()
+{
+   MonitorList list;
+   read_monitors(list);
+
+   Monitors current;
+   current.origin_x = GetSystemMetrics(SM_XVIRTUALSCREEN);
+   current.origin_y = GetSystemMetrics(SM_YVIRTUALSCREEN);
+   for (int i = 0; i < list.count; ++i)
+   {
+      const RECT &r = list.monitors[i];
+      current.rects.push_back(Monitor{ r.left, r.top, r.right, r.bottom });
+   }
+
+   return current;
+}
@@ -0,0 +1,47 @@
+// DesktopSaver, (c)2006-2016 Nicholas Piegdon, MIT licensed
+#pragma once
+
+#include <string>
+#include <vector>
+#include <cstdint>
+
+// Identifies the monitor setup: how many monitors there are, and each
+// one's resolution and place on the virtual desktop.  Docking, undocking,
+// or changing a resolution gives a different fingerprint, and going back
+// gives the same one again.
+class DisplayConfig
+{
+public:
+   // One monitor, in screen coordinates
+   struct Monitor
+   {
+      long left, top, right, bottom;
+
+      bool Contains(long x, long y) const { return x >= left && x < right && y >= top && y < bottom; }
+      bool operator==(const Monitor &o) const { return left == o.left && top == o.top && right == o.right && bottom == o.bottom; }
+   };
+
+   // Every monitor (in the same order the fingerprint uses) along with
+   // where the desktop's icon coordinates start on the screen.  Icon
+   // positions are relative to the top-left of the whole virtual screen,
+   // so adding the origin puts them in screen coordinates.
+   struct Monitors
+   {
+      Monitors() : origin_x(0), origin_y(0) { }
+
+      std::vector<Monitor> rects;
+      long origin_x, origin_y;
+
+      // The monitor showing the icon at (x, y) in desktop coordinates, or
+      // -1 if it's off every screen
+      int Find(long x, long y) const;
+   };
+
+   static Monitors Current();
+
+   // Never zero, which IconHistory uses for "unknown"
+   static uint64_t Fingerprint();
+
+   // Something like "1920x1080 at (0, 0), 1280x1024 at (1920, 0)"
+   static std::wstring Describe();
+};
@@ -1,26 +1,37 @@
-// DesktopSaver, (c)2006-2016 Nicholas Piegdon, MIT licensed
-#pragma once
-
-#include <string>
-#include <memory>
-#include <sstream>
-
-// A simple file manipulation class to read the plain-text with colon (':')
-// comment line format.  (Whitespace allowed, with one data item per line)
-class FileReader
-{
-public:
-   FileReader(const std::wstring &filename);
-
-   // Will skip whitespace and comment lines
-   // On eof, will continuously return empty strings
-   const std::wstring ReadLine();
-
-private:
-   // Explicitly deny copying and assignment
-   FileReader(const FileReader&);
-
-   const static wchar_t comment_char = L':';
-
-   std::unique_ptr<std::wistringstream> stream;
-};
+// DesktopSaver, (c)2006-2016 Nicholas Piegdon, MIT licensed
+#pragma once
+
+#include <string>
+
+// A simple file manipulation class to read the plain-text with colon (':')
+// comment line format.  (Whitespace allowed, with one data item per line)
+class FileReader
+{
+public:
+   // Reads from text that has already been loaded (e.g. one history slice
+   // pulled out of the middle of a file).  The text isn't copied, so it
+   // must outlive the FileReader.
+   FileReader(const wchar_t *text, size_t length);
+
+   // Will skip whitespace and comment lines
+   // On eof, will continuously return empty strings
+   const std::wstring ReadLine();
+
+   // The same, but without any allocation: 'line' points into the text
+   // being read.  Returns false (with an empty line) on eof.
+   bool ReadLine(const wchar_t *&line, size_t &length);
+
+   // The same, also pointing 'comment' at whatever followed the comment
+   // character on that line (empty if there wasn't one)
+   bool ReadLine(const wchar_t *&line, size_t &length, const wchar_t *&comment, size_t &comment_length);
+
+private:
+   // Explicitly deny copying and assignment
+   FileReader(const FileReader&);
+
+   const static wchar_t comment_char = L':';
+
+   const wchar_t *m_text;
+   size_t m_length;
+   size_t m_position;
+};
@@ -0,0 +1,636 @@
+// DesktopSaver, (c)2006-2016 Nicholas Piegdon, MIT licensed
+
+#include "history_file.h"
+#include "file_reader.h"
+#include "icon_history.h"
+#include "packed_history.h"
+#include "string_util.h"
+#include "version.h"
+
+#include <windows.h>
+#include <algorithm>
+#include <cstring>
+#include <streambuf>
+#include <ostream>
+using namespace std;
+
+static const wstring SliceTag = L":@slice ";
+static const wstring IndexTag = L":@index ";
+static const wstring EntryTag = L":@ ";
+static const wstring EndTag = L":@end ";
+static const wstring RefTag = L":@ref ";
+static const wstring TimeTag = L":@time ";
+static const wstring DisplayTag = L":@display ";
+static const wstring LineEnd = L"\r\n";
+
+// Every framing line has a fixed width (in characters)
+static const size_t SliceLength = 8 + 8 + 1 + 8 + 2;
+static const size_t IndexLength = 8 + 8 + 2;
+static const size_t EntryLength = 3 + 16 + 2;
+static const size_t TimedEntryLength = 3 + 16 + 1 + 16 + 1 + 1 + 2;
+static const size_t EndLength = 6 + 16 + 2;
+static const size_t RefLength = 6 + 16 + 2;
+static const size_t RefFrameLength = 6 + 16 + 1 + 8 + 2;
+static const size_t TimeLength = 7 + 16 + 2;
+static const size_t DisplayLength = 10 + 16 + 2;
+
+// How many bytes make up one character in the header lines of
+// files written by older versions (which wrote raw wchar_t)
+static size_t detect_width(const string &start)
+{
+   if (start.size() >= 4 && start[1] == 0 && start[2] == 0 && start[3] == 0) return 4;
+   if (start.size() >= 2 && start[1] == 0) return 2;
+   return 1;
+}
+
+// Turns bytes from the file into text, for either UTF-8 (width 1) or the
+// little-endian UTF-16/UTF-32 that older versions wrote (width 2 or 4)
+static wstring decode(const char *bytes, size_t length, size_t width)
+{
+   if (width == 1) return FromUtf8(bytes, length);
+
+   const unsigned char *b = reinterpret_cast<const unsigned char*>(bytes);
+   wstring text;
+   text.reserve(length / width);
+
+   for (size_t i = 0; i + width <= length; i += width)
+   {
+      unsigned long c = 0;
+      for (size_t k = 0; k < width; ++k) c |= (unsigned long)b[i + k] << (8 * k);
+
+      if (width == 2 && sizeof(wchar_t) == 4 && c >= 0xD800 && c < 0xDC00 && i + 4 <= length)
+      {
+         const unsigned long low = b[i + 2] | ((unsigned long)b[i + 3] << 8);
+         if (low >= 0xDC00 && low < 0xE000) { c = 0x10000 + ((c - 0xD800) << 10) + (low - 0xDC00); i += 2; }
+      }
+
+      if (sizeof(wchar_t) == 2 && c >= 0x10000 && c <= 0x10FFFF)
+      {
+         c -= 0x10000;
+         text += wchar_t(0xD800 + (c >> 10));
+         text += wchar_t(0xDC00 + (c & 0x3FF));
+         continue;
+      }
+
+      text += wchar_t(c);
+   }
+
+   return text;
+}
+
+static string encode_tag(const wstring &tag, size_t width)
+{
+   string bytes;
+   for (wchar_t c : tag)
+   {
+      bytes += char(c);
+      bytes.append(width - 1, '\0');
+   }
+   return bytes;
+}
+
+static wstring hex(uint64_t value, int digits)
+{
+   static const wchar_t lookup[] = L"0123456789abcdef";
+
+   wstring result(digits, L'0');
+   for (int i = digits - 1; i >= 0; --i, value >>= 4) result[i] = lookup[value & 0xF];
+   return result;
+}
+
+static bool parse_hex(const wstring &text, size_t start, int digits, uint64_t &out)
+{
+   if (start + digits > text.length()) return false;
+
+   out = 0;
+   for (int i = 0; i < digits; ++i)
+   {
+      const wchar_t c = text[start + i];
+      out <<= 4;
+
+      if (c >= L'0' && c <= L'9') out |= c - L'0';
+      else if (c >= L'a' && c <= L'f') out |= c - L'a' + 10;
+      else return false;
+   }
+
+   return true;
+}
+
+// Standard (reflected, 0xEDB88320) CRC-32, built once at startup
+struct CrcTable
+{
+   uint32_t entries[256];
+
+   CrcTable()
+   {
+      for (uint32_t i = 0; i < 256; ++i)
+      {
+         uint32_t c = i;
+         for (int k = 0; k < 8; ++k) c = (c & 1) ? (0xEDB88320 ^ (c >> 1)) : (c >> 1);
+         entries[i] = c;
+      }
+   }
+};
+static const CrcTable crc_table;
+
+uint32_t HistoryFileReader::Crc32(const void *data, size_t length, uint32_t crc)
+{
+   const unsigned char *bytes = static_cast<const unsigned char*>(data);
+
+   crc = ~crc;
+   for (size_t i = 0; i < length; ++i) crc = crc_table.entries[(crc ^ bytes[i]) & 0xFF] ^ (crc >> 8);
+   return ~crc;
+}
+
+
+// Converts everything written to it into UTF-8 and sends it to the file
+// in fixed-size chunks, so writing never needs more memory than one chunk
+// no matter how large the history gets.  It also keeps a running length
+// and checksum of everything written since the last StartFrame().
+class Utf8ChunkWriter : public wstreambuf
+{
+public:
+   Utf8ChunkWriter(FILE *file) : m_file(file), m_used(0), m_position(0), m_frameLength(0), m_frameCrc(0), m_highSurrogate(0) { }
+
+   uint64_t Position() const { return m_position; }
+   uint64_t FrameLength() const { return m_frameLength; }
+   uint32_t FrameCrc() const { return m_frameCrc; }
+
+   void StartFrame() { m_frameLength = 0; m_frameCrc = 0; }
+
+   void Write(const char *bytes, size_t length)
+   {
+      m_frameCrc = HistoryFileReader::Crc32(bytes, length, m_frameCrc);
+      m_frameLength += length;
+      m_position += length;
+
+      while (length > 0)
+      {
+         const size_t count = min(length, ChunkSize - m_used);
+         memcpy(m_chunk + m_used, bytes, count);
+
+         m_used += count;
+         bytes += count;
+         length -= count;
+
+         if (m_used == ChunkSize) Flush();
+      }
+   }
+
+   void Write(const string &bytes) { Write(bytes.data(), bytes.size()); }
+
+   void Flush()
+   {
+      if (m_used > 0) fwrite(m_chunk, 1, m_used, m_file);
+      m_used = 0;
+   }
+
+protected:
+   virtual int_type overflow(int_type c)
+   {
+      if (c == traits_type::eof()) return traits_type::not_eof(c);
+
+      const wchar_t w = traits_type::to_char_type(c);
+      xsputn(&w, 1);
+      return c;
+   }
+
+   virtual streamsize xsputn(const wchar_t *text, streamsize length)
+   {
+      // Encoded into a buffer that's reused from call to call, so this
+      // only goes to the heap until it has grown to fit the longest line
+      m_encoded.clear();
+      for (streamsize i = 0; i < length; ++i)
+      {
+         unsigned long c = (unsigned long)text[i];
+
+         // A UTF-16 surrogate pair may be split across two calls.  A high
+         // surrogate that isn't followed by a low one is replaced on its
+         // own, without taking whatever comes next down with it.
+         const bool high = sizeof(wchar_t) == 2 && c >= 0xD800 && c < 0xDC00;
+         const bool low = sizeof(wchar_t) == 2 && c >= 0xDC00 && c < 0xE000;
+         if (m_highSurrogate != 0 && !low) { AppendUtf8(m_encoded, 0xFFFD); m_highSurrogate = 0; }
+         if (high) { m_highSurrogate = c; continue; }
+
+         if (low && m_highSurrogate != 0) c = 0x10000 + ((m_highSurrogate - 0xD800) << 10) + (c - 0xDC00);
+         else if ((c >= 0xD800 && c < 0xE000) || c > 0x10FFFF) c = 0xFFFD;
+         m_highSurrogate = 0;
+
+         AppendUtf8(m_encoded, c);
+      }
+
+      Write(m_encoded);
+      return length;
+   }
+
+private:
+   static const size_t ChunkSize = 64 * 1024;
+
+   FILE *m_file;
+   char m_chunk[ChunkSize];
+   size_t m_used;
+
+   uint64_t m_position;
+   uint64_t m_frameLength;
+   uint32_t m_frameCrc;
+
+   unsigned long m_highSurrogate;
+   string m_encoded;
+};
+
+static string ascii(const wstring &text) { return string(text.begin(), text.end()); }
+
+
+HistoryFileWriter::HistoryFileWriter(const wstring &filename, bool compact) : m_file(0), m_compact(compact)
+{
+   errno_t err = _wfopen_s(&m_file, filename.c_str(), L"wb");
+   if (err != 0) m_file = 0;
+   if (!m_file) return;
+
+   m_buffer = make_unique<Utf8ChunkWriter>(m_file);
+   m_stream = make_unique<wostream>(m_buffer.get());
+
+   *m_stream << L":" << LineEnd;
+   *m_stream << L": " << DesktopSaverName << L" " << DesktopSaverVersion << L" icon history file" << LineEnd;
+   *m_stream << L":" << LineEnd;
+   *m_stream << LineEnd;
+}
+
+HistoryFileWriter::~HistoryFileWriter()
+{
+   if (!m_file) return;
+
+   m_buffer->Flush();
+   fclose(m_file);
+}
+
+void HistoryFileWriter::Write(const IconHistory &h)
+{
+   if (!m_file) return;
+
+   // We don't know the length or checksum until the whole slice has gone
+   // by, so leave room for the header now and come back to fill it in
+   const uint64_t header = m_buffer->Position();
+   m_offsets.push_back(header);
+   m_times.push_back(h.GetTime());
+   m_profiles.push_back(h.IsNamedProfile());
+   m_buffer->Write(ascii(SliceTag + wstring(SliceLength - SliceTag.length() - LineEnd.length(), L' ') + LineEnd));
+
+   m_buffer->StartFrame();
+
+   // A layout that's already somewhere earlier in the file is only
+   // referred to by its hash.  The rest of the slice is written as
+   // usual, just without any icons.  Profiles are always written in
+   // full, so they never depend on any other frame.
+   const SnapshotStore::Ref &icons = h.GetSnapshot();
+   const auto written = icons && !icons->names.empty() ? m_written.insert(make_pair(icons, m_offsets.size() - 1)) : make_pair(m_written.end(), true);
+   const bool reference = !written.second && !h.IsNamedProfile();
+
+   if (h.GetTime() != 0) m_buffer->Write(ascii(TimeTag + hex(uint64_t(h.GetTime()), 16) + LineEnd));
+   if (h.GetDisplay() != 0) m_buffer->Write(ascii(DisplayTag + hex(h.GetDisplay(), 16) + LineEnd));
+
+   IconHistory stub;
+   if (reference)
+   {
+      m_buffer->Write(ascii(RefTag + hex(icons->hash, 16) + L" " + hex(written.first->second, 8) + LineEnd));
+
+      stub = h;
+      stub.ShareIcons(SnapshotStore::Ref());
+   }
+
+   const IconHistory &payload = reference ? stub : h;
+   if (m_compact) m_buffer->Write(PackedHistory::Pack(payload));
+   else *m_stream << payload << LineEnd;
+
+   const string line = ascii(SliceTag + hex(m_buffer->FrameLength(), 8) + L" " + hex(m_buffer->FrameCrc(), 8) + LineEnd);
+
+   m_buffer->Flush();
+   _fseeki64(m_file, int64_t(header), SEEK_SET);
+   fwrite(line.data(), 1, line.size(), m_file);
+   _fseeki64(m_file, 0, SEEK_END);
+}
+
+void HistoryFileWriter::Finish()
+{
+   if (!m_file) return;
+
+   const uint64_t index = m_buffer->Position();
+
+   m_buffer->Write(ascii(IndexTag + hex(m_offsets.size(), 8) + LineEnd));
+   for (size_t i = 0; i < m_offsets.size(); ++i)
+   {
+      const wstring kind = m_profiles[i] ? L"p" : L"s";
+      m_buffer->Write(ascii(EntryTag + hex(m_offsets[i], 16) + L" " + hex(uint64_t(m_times[i]), 16) + L" " + kind + LineEnd));
+   }
+   m_buffer->Write(ascii(EndTag + hex(index, 16) + LineEnd));
+
+   m_buffer->Flush();
+   fclose(m_file);
+   m_file = 0;
+}
+
+
+HistoryFileReader::HistoryFileReader(const wstring &filename) : m_file(0), m_size(0), m_width(1), m_legacy(false), m_kinds(false)
+{
+   errno_t err = _wfopen_s(&m_file, filename.c_str(), L"rb");
+   if (err != 0) m_file = 0;
+   if (!m_file) return;
+
+   _fseeki64(m_file, 0, SEEK_END);
+   m_size = uint64_t(_ftelli64(m_file));
+
+   string start;
+   read_bytes(0, size_t(min<uint64_t>(m_size, 4)), start);
+   m_width = detect_width(start);
+
+   // The trailing index lets us jump straight to each frame.  If it's
+   // missing (an old file, or a write that never finished) fall back
+   // to looking for the frame headers ourselves.
+   const bool indexed = read_index();
+   if (!indexed) scan_frames();
+   m_visited.resize(m_offsets.size(), false);
+
+   // Without an index we don't know anything about a frame until it's read
+   m_times.resize(m_offsets.size(), 0);
+   m_profiles.resize(m_offsets.size(), false);
+   if (indexed) for (size_t i = 0; i < m_offsets.size(); ++i) if (!m_profiles[i]) m_slices.push_back(i);
+}
+
+HistoryFileReader::~HistoryFileReader()
+{
+   if (m_file) fclose(m_file);
+}
+
+bool HistoryFileReader::read_bytes(uint64_t offset, size_t length, string &out)
+{
+   out.clear();
+   if (!m_file || offset > m_size || length > m_size - offset) return false;
+
+   out.resize(length);
+   if (length == 0) return true;
+
+   if (_fseeki64(m_file, int64_t(offset), SEEK_SET) != 0) return false;
+   return fread(&out[0], 1, length, m_file) == length;
+}
+
+bool HistoryFileReader::read_text(uint64_t offset, size_t length, wstring &out)
+{
+   out.clear();
+
+   string bytes;
+   if (!read_bytes(offset, length, bytes)) return false;
+
+   out = decode(bytes.data(), bytes.size(), m_width);
+   return true;
+}
+
+bool HistoryFileReader::read_index()
+{
+   const size_t w = m_width;
+   if (m_size < EndLength * w) return false;
+
+   wstring trailer;
+   if (!read_text(m_size - EndLength * w, EndLength * w, trailer)) return false;
+   if (trailer.compare(0, EndTag.length(), EndTag) != 0) return false;
+
+   uint64_t index = 0;
+   if (!parse_hex(trailer, EndTag.length(), 16, index)) return false;
+   if (index > m_size - EndLength * w) return false;
+
+   wstring header;
+   if (!read_text(index, IndexLength * w, header)) return false;
+   if (header.compare(0, IndexTag.length(), IndexTag) != 0) return false;
+
+   uint64_t count = 0;
+   if (!parse_hex(header, IndexTag.length(), 8, count)) return false;
+
+   // Older indexes only have offsets.  Newer ones add each frame's
+   // capture time and whether it's a history slice or a named profile.
+   const uint64_t entries_size = m_size - index - (IndexLength + EndLength) * w;
+   if (count == 0 && entries_size != 0) return false;
+
+   const size_t entry_length = (count == 0) ? EntryLength : size_t(entries_size / (count * w));
+   if (entry_length != EntryLength && entry_length != TimedEntryLength) return false;
+   if (count * entry_length * w != entries_size) return false;
+
+   wstring entries;
+   if (!read_text(index + IndexLength * w, size_t(entries_size), entries)) return false;
+
+   vector<uint64_t> offsets;
+   vector<int64_t> times;
+   vector<bool> profiles;
+   for (size_t i = 0; i < count; ++i)
+   {
+      const size_t start = size_t(i * entry_length);
+      if (entries.compare(start, EntryTag.length(), EntryTag) != 0) return false;
+
+      uint64_t offset = 0, time = 0;
+      if (!parse_hex(entries, start + EntryTag.length(), 16, offset) || offset >= index) return false;
+
+      bool profile = false;
+      if (entry_length == TimedEntryLength)
+      {
+         if (!parse_hex(entries, start + EntryTag.length() + 17, 16, time)) return false;
+         profile = entries[start + EntryTag.length() + 34] == L'p';
+      }
+
+      offsets.push_back(offset);
+      times.push_back(int64_t(time));
+      profiles.push_back(profile);
+   }
+
+   m_offsets.swap(offsets);
+   m_times.swap(times);
+   m_profiles.swap(profiles);
+   m_kinds = (entry_length == TimedEntryLength);
+   return true;
+}
+
+bool HistoryFileReader::read_frame_header(const string &bytes, size_t pos, uint64_t &length, uint64_t &crc) const
+{
+   const size_t w = m_width;
+   if (pos + SliceLength * w > bytes.size()) return false;
+
+   const wstring header = decode(bytes.data() + pos, SliceLength * w, w);
+   if (header.compare(0, SliceTag.length(), SliceTag) != 0 || header[SliceTag.length() + 8] != L' ') return false;
+
+   return parse_hex(header, SliceTag.length(), 8, length) && parse_hex(header, SliceTag.length() + 9, 8, crc);
+}
+
+void HistoryFileReader::scan_frames()
+{
+   string contents;
+   if (!read_bytes(0, size_t(m_size), contents)) return;
+
+   const string tag = encode_tag(SliceTag, m_width);
+
+   // Hop from frame to frame using the lengths in their headers.  If a
+   // header is damaged, search ahead for the next thing that looks like
+   // one.  Anything that merely looks like a header will be weeded out
+   // by the checksum in Read().
+   size_t pos = contents.find(tag);
+   while (pos != string::npos)
+   {
+      uint64_t length = 0, crc = 0;
+      const bool valid = read_frame_header(contents, pos, length, crc);
+      if (valid) m_offsets.push_back(pos);
+
+      const uint64_t after = pos + SliceLength * m_width + length;
+      if (valid && after < contents.size() && contents.compare(size_t(after), tag.size(), tag) == 0) pos = size_t(after);
+      else pos = contents.find(tag, pos + 1);
+   }
+
+   m_legacy = m_offsets.empty();
+}
+
+bool HistoryFileReader::Read(size_t i, IconHistory &h, bool *orphaned)
+{
+   if (orphaned) *orphaned = false;
+
+   if (i >= m_offsets.size()) return false;
+   const uint64_t offset = m_offsets[i];
+   m_visited[i] = true;
+
+   string header;
+   if (!read_bytes(offset, SliceLength * m_width, header)) return false;
+
+   uint64_t length = 0, crc = 0;
+   if (!read_frame_header(header, 0, length, crc)) return false;
+
+   string payload;
+   if (!read_bytes(offset + SliceLength * m_width, size_t(length), payload)) return false;
+   if (Crc32(payload.data(), payload.size()) != crc) return false;
+
+   // Any extra information about the slice comes first: when it was
+   // captured, on which monitors, and (if it shares its layout with an
+   // earlier slice) a reference to that layout
+   const string ref_tag = encode_tag(RefTag, m_width);
+   const string time_tag = encode_tag(TimeTag, m_width);
+   const string display_tag = encode_tag(DisplayTag, m_width);
+
+   bool reference = false;
+   uint64_t hash = 0, time = 0, display = 0, owner = npos;
+   size_t start = 0;
+   for (;;)
+   {
+      if (payload.compare(start, ref_tag.size(), ref_tag) == 0)
+      {
+         if (payload.size() - start < RefLength * m_width) return false;
+         const wstring line = decode(payload.data() + start, min(payload.size() - start, RefFrameLength * m_width), m_width);
+         if (!parse_hex(line, RefTag.length(), 16, hash)) return false;
+
+         // Older files don't say which frame the layout is in
+         const size_t after = RefTag.length() + 16;
+         const bool framed = line.length() == RefFrameLength && line[after] == L' ';
+         if (framed && !parse_hex(line, after + 1, 8, owner)) return false;
+
+         reference = true;
+         start += (framed ? RefFrameLength : RefLength) * m_width;
+         continue;
+      }
+
+      if (payload.compare(start, time_tag.size(), time_tag) == 0)
+      {
+         if (payload.size() - start < TimeLength * m_width) return false;
+         if (!parse_hex(decode(payload.data() + start, TimeLength * m_width, m_width), TimeTag.length(), 16, time)) return false;
+
+         start += TimeLength * m_width;
+         continue;
+      }
+
+      if (payload.compare(start, display_tag.size(), display_tag) == 0)
+      {
+         if (payload.size() - start < DisplayLength * m_width) return false;
+         if (!parse_hex(decode(payload.data() + start, DisplayLength * m_width, m_width), DisplayTag.length(), 16, display)) return false;
+
+         start += DisplayLength * m_width;
+         continue;
+      }
+
+      break;
+   }
+   payload.erase(0, start);
+
+   if (PackedHistory::IsPacked(payload))
+   {
+      if (!PackedHistory::Unpack(payload, h)) return false;
+   }
+   else
+   {
+      const wstring text = decode(payload.data(), payload.size(), m_width);
+      FileReader fr(text.c_str(), text.length());
+      if (!h.Deserialize(fr, m_scratch)) return false;
+   }
+
+   h.SetTime(int64_t(time));
+   h.SetDisplay(display);
+
+   if (!reference)
+   {
+      if (h.GetSnapshot()) m_layouts[h.GetSnapshot()->hash] = h.GetSnapshot();
+      return true;
+   }
+
+   const SnapshotStore::Ref layout = find_layout(hash, i, size_t(owner));
+   if (!layout)
+   {
+      if (orphaned) *orphaned = true;
+      return false;
+   }
+
+   h.ShareIcons(layout);
+   return true;
+}
+
+size_t HistoryFileReader::SliceAsOf(int64_t time) const
+{
+   // History slices are written oldest first, so their times only go up
+   const auto after = upper_bound(m_slices.begin(), m_slices.end(), time, [this](int64_t t, size_t i) { return t < m_times[i]; });
+   if (after == m_slices.begin()) return npos;
+   return *(after - 1);
+}
+
+SnapshotStore::Ref HistoryFileReader::find_layout(uint64_t hash, size_t before, size_t owner)
+{
+   const auto known = m_layouts.find(hash);
+   if (known != m_layouts.end()) return known->second;
+
+   // Newer files name the frame that has it, so only that one is read
+   if (owner < before && !m_visited[owner])
+   {
+      IconHistory earlier;
+      Read(owner, earlier);
+
+      const auto found = m_layouts.find(hash);
+      if (found != m_layouts.end()) return found->second;
+   }
+
+   // References always point backward, so if we haven't seen the layout
+   // yet, it's in one of the earlier frames that hasn't been read
+   for (size_t i = 0; i <= before; ++i)
+   {
+      const auto found = m_layouts.find(hash);
+      if (found != m_layouts.end()) return found->second;
+
+      if (i == before || m_visited[i]) continue;
+
+      IconHistory earlier;
+      Read(i, earlier);
+   }
+
+   return SnapshotStore::Ref();
+}
+
+bool HistoryFileReader::ReadLegacy(vector<IconHistory> &out)
+{
+   wstring contents;
+   if (!read_text(0, size_t(m_size), contents)) return false;
+
+   FileReader fr(contents.c_str(), contents.length());
+
+   // Read in IconHistory objects until one fails to load
+   IconHistory h;
+   while (h.Deserialize(fr, m_scratch)) out.push_back(h);
+
+   return true;
+}
@@ -0,0 +1,178 @@
+// DesktopSaver, (c)2006-2016 Nicholas Piegdon, MIT licensed
+#pragma once
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <cstdint>
+#include <cstdio>
+#include <iosfwd>
+#include <map>
+#include <unordered_map>
+#include "snapshot_builder.h"
+#include "snapshot_store.h"
+
+class IconHistory;
+class Utf8ChunkWriter;
+
+// The history file is UTF-8 text in the colon-commented format that
+// FileReader understands, with each IconHistory wrapped in a frame:
+//
+//    :@slice <payload byte length> <crc32 of payload>
+//    ...the usual IconHistory text...
+//
+// After the last slice comes an index of the byte offset, capture time,
+// and kind ('s' for a history slice, 'p' for a named profile) of every
+// frame, followed by a fixed-size trailer pointing back at the index:
+//
+//    :@index <count>
+//    :@ <offset> <time> <kind>
+//    :@end <offset of the index line>
+//
+// That's enough to find the slice in effect at any time without reading
+// any of the slices themselves.  (Older indexes only have the offsets.)
+//
+// A slice whose layout (see SnapshotStore) already appeared earlier in the
+// file doesn't repeat it.  Its payload starts with a reference to the
+// earlier layout's hash (and the index of the frame that has it in full)
+// instead, and the rest is written without icons:
+//
+//    :@ref <snapshot hash> <frame>
+//
+// (That line is a comment too, so older versions just see no icons.)
+// Named profiles are always written in full, so that a damaged slice can
+// never take a profile down with it.
+//
+// A slice's capture time and monitor setup (see DisplayConfig) are also
+// recorded at the start of its payload:
+//
+//    :@time <seconds since 1970, UTC>
+//    :@display <fingerprint>
+//
+// An icon whose key (see MakeIconKey) isn't just the hash of its name has
+// it written after the name, as a comment that older versions ignore:
+//
+//    <icon name>:@key <key>
+//
+// All numbers are fixed-width hex so that every header is the same size.
+// Because the framing lines are all comments, the whole file can still be
+// read sequentially with a plain FileReader.
+//
+// When the compact option is on, each frame's payload is a PackedHistory
+// instead.  Older versions can't read those.
+//
+// Older versions wrote the platform's raw wchar_t instead of UTF-8.  The
+// reader still accepts those files (framed or not), and all offsets and
+// lengths are always in bytes.
+//
+// The writer streams everything out in fixed-size chunks, so it uses the
+// same small amount of memory no matter how large the history is.
+class HistoryFileWriter
+{
+public:
+   HistoryFileWriter(const std::wstring &filename, bool compact);
+   ~HistoryFileWriter();
+
+   bool Good() const { return m_file != 0; }
+
+   void Write(const IconHistory &h);
+
+   // Writes the index and trailer.  Nothing written after this is reachable.
+   void Finish();
+
+private:
+   // Explicitly deny copying and assignment
+   HistoryFileWriter(const HistoryFileWriter&);
+   HistoryFileWriter &operator=(const HistoryFileWriter&);
+
+   FILE *m_file;
+   bool m_compact;
+
+   std::unique_ptr<Utf8ChunkWriter> m_buffer;
+   std::unique_ptr<std::wostream> m_stream;
+   std::vector<uint64_t> m_offsets;
+   std::vector<int64_t> m_times;
+   std::vector<bool> m_profiles;
+
+   // Layouts that have been written out in full so far.  These hold on
+   // to them, so that a layout freed in the meantime can't have its
+   // address reused by a different one that would look already written.
+   // Each is mapped to the frame it was written in.
+   std::map<SnapshotStore::Ref, size_t> m_written;
+};
+
+class HistoryFileReader
+{
+public:
+   HistoryFileReader(const std::wstring &filename);
+   ~HistoryFileReader();
+
+   // The number of frames found, either from the trailing index or (if the
+   // index was missing or damaged) from a scan of the whole file
+   size_t Count() const { return m_offsets.size(); }
+
+   // What the index says about each frame.  Both are unknown (zero
+   // and false) if the file doesn't have an index.
+   int64_t Time(size_t i) const { return m_times[i]; }
+   bool IsProfile(size_t i) const { return m_profiles[i]; }
+
+   // Whether the index says which frames are named profiles, so that
+   // IsProfile() can be used to skip reading the others
+   bool HasFrameKinds() const { return m_kinds; }
+
+   // The frame holding the newest history slice captured at or before
+   // 'time', in O(log n) using only the index.  Returns npos if there
+   // isn't one (or the file has no index).
+   static const size_t npos = size_t(-1);
+   size_t SliceAsOf(int64_t time) const;
+
+   // Reads and validates a single frame without touching any of the others.
+   // Returns false if the frame is damaged, in which case the caller should
+   // just move on to the next one.  It also fails if the frame is fine but
+   // the earlier layout it refers to couldn't be read; then 'orphaned' (if
+   // given) is set, so that can be told apart from actual damage.
+   bool Read(size_t i, IconHistory &h, bool *orphaned = nullptr);
+
+   // Older files don't have any frames.  They can only be read
+   // sequentially using ReadLegacy (which stops at the first problem).
+   bool IsLegacy() const { return m_legacy; }
+   bool ReadLegacy(std::vector<IconHistory> &out);
+
+   static uint32_t Crc32(const void *data, size_t length, uint32_t crc = 0);
+
+private:
+   // Explicitly deny copying and assignment
+   HistoryFileReader(const HistoryFileReader&);
+   HistoryFileReader &operator=(const HistoryFileReader&);
+
+   bool read_bytes(uint64_t offset, size_t length, std::string &out);
+   bool read_text(uint64_t offset, size_t length, std::wstring &out);
+   bool read_frame_header(const std::string &bytes, size_t pos, uint64_t &length, uint64_t &crc) const;
+   bool read_index();
+   void scan_frames();
+
+   // 'owner' is the frame the reference says holds the layout, or npos
+   SnapshotStore::Ref find_layout(uint64_t hash, size_t before, size_t owner);
+
+   FILE *m_file;
+   uint64_t m_size;
+
+   // Bytes per character of the framing text (1 for UTF-8)
+   size_t m_width;
+
+   bool m_legacy;
+   bool m_kinds;
+   std::vector<uint64_t> m_offsets;
+   std::vector<int64_t> m_times;
+   std::vector<bool> m_profiles;
+
+   // Frames that hold history slices (as opposed to named profiles)
+   std::vector<size_t> m_slices;
+
+   // Every full layout read so far, for resolving references
+   std::vector<bool> m_visited;
+   std::unordered_map<uint64_t, SnapshotStore::Ref> m_layouts;
+
+   // Reused for every history read, so its memory is only allocated once
+   SnapshotBuilder m_scratch;
+};
@@ -0,0 +1,186 @@
+// DesktopSaver, (c)2006-2016 Nicholas Piegdon, MIT licensed
+
+#include "icon_diff.h"
+#include "icon_history.h"
+#include "coord_compare.h"
+
+#include <algorithm>
+#include <cwchar>
+using namespace std;
+
+static bool loose(const IconRef &icon) { return icon.key == MakeIconKey(icon.name); }
+
+IconDiff::IconDiff(const IconHistory &from, const IconHistory &to)
+{
+   const auto a = from.GetIcons();
+   const auto b = to.GetIcons();
+
+   // Most slices only move icons around, which leaves the names and keys
+   // exactly as they were.  Then every icon already lines up with itself,
+   // and the coordinates can be compared a vector at a time.
+   if (same_icons(a, b))
+   {
+      vector<size_t> positions;
+      size_t last;
+      CoordCompare::CountDifferent(a.xs(), a.ys(), b.xs(), b.ys(), a.size(), &last, &positions);
+
+      m_moved.reserve(positions.size());
+      for (size_t p : positions) m_moved.push_back(Change{ b.names()[p], a.xs()[p], a.ys()[p], b.xs()[p], b.ys()[p], a.keys()[p] });
+   }
+   else
+   {
+      merge(a, b);
+   }
+
+   m_moved_keys.reserve(m_moved.size());
+   for (size_t m = 0; m < m_moved.size(); ++m) m_moved_keys.push_back(make_pair(m_moved[m].key, m));
+   sort(m_moved_keys.begin(), m_moved_keys.end());
+}
+
+bool IconDiff::same_icons(const IconRange &a, const IconRange &b)
+{
+   if (a.size() != b.size()) return false;
+   if (a.names() == b.names()) return true;
+
+   return equal(a.keys(), a.keys() + a.size(), b.keys()) && equal(a.names(), a.names() + a.size(), b.names());
+}
+
+void IconDiff::merge(const IconRange &a, const IconRange &b)
+{
+   // Both icon lists are sorted by name, so a single merge
+   // pass finds every added, removed, and moved icon
+   size_t i = 0, j = 0;
+   while (i < a.size() || j < b.size())
+   {
+      if (i == a.size() || (j < b.size() && b[j].name < a[i].name))
+      {
+         const auto icon = b[j++];
+         m_added.push_back(Change{ icon.name, 0, 0, icon.x, icon.y, icon.key });
+         continue;
+      }
+
+      if (j == b.size() || a[i].name < b[j].name)
+      {
+         const auto icon = a[i++];
+         m_removed.push_back(Change{ icon.name, icon.x, icon.y, 0, 0, icon.key });
+         continue;
+      }
+
+      // Every icon with this name, on both sides
+      size_t i_end = i + 1, j_end = j + 1;
+      while (i_end < a.size() && a[i_end].name == a[i].name) ++i_end;
+      while (j_end < b.size() && b[j_end].name == b[j].name) ++j_end;
+
+      match(a, i, i_end, b, j, j_end);
+      i = i_end;
+      j = j_end;
+   }
+}
+
+void IconDiff::match(const IconRange &a, size_t i, size_t i_end, const IconRange &b, size_t j, size_t j_end)
+{
+   // By far the most common case: one icon with this name on each side
+   if (i_end - i == 1 && j_end - j == 1 && (a[i].key == b[j].key || loose(a[i]) || loose(b[j])))
+   {
+      const auto before = a[i];
+      const auto after = b[j];
+      if (before.x != after.x || before.y != after.y) m_moved.push_back(Change{ after.name, before.x, before.y, after.x, after.y, before.key });
+      return;
+   }
+
+   // Otherwise, pair up equal keys first, then let any loose icon
+   // take the first unclaimed one on the other side
+   vector<size_t> partner(i_end - i, size_t(-1));
+   vector<bool> claimed(j_end - j, false);
+
+   for (size_t p = i; p < i_end; ++p)
+      for (size_t q = j; q < j_end; ++q)
+         if (!claimed[q - j] && a[p].key == b[q].key) { partner[p - i] = q; claimed[q - j] = true; break; }
+
+   for (size_t p = i; p < i_end; ++p)
+   {
+      if (partner[p - i] != size_t(-1)) continue;
+
+      for (size_t q = j; q < j_end; ++q)
+         if (!claimed[q - j] && (loose(a[p]) || loose(b[q]))) { partner[p - i] = q; claimed[q - j] = true; break; }
+   }
+
+   for (size_t p = i; p < i_end; ++p)
+   {
+      const auto before = a[p];
+      if (partner[p - i] == size_t(-1)) { m_removed.push_back(Change{ before.name, before.x, before.y, 0, 0, before.key }); continue; }
+
+      const auto after = b[partner[p - i]];
+      if (before.x != after.x || before.y != after.y) m_moved.push_back(Change{ after.name, before.x, before.y, after.x, after.y, before.key });
+   }
+
+   for (size_t q = j; q < j_end; ++q)
+   {
+      if (claimed[q - j]) continue;
+
+      const auto icon = b[q];
+      m_added.push_back(Change{ icon.name, 0, 0, icon.x, icon.y, icon.key });
+   }
+}
+
+static bool reversed(const IconDiff::Change &a, const IconDiff::Change &b)
+{
+   return a.name == b.name && a.from_x == b.to_x && a.from_y == b.to_y && a.to_x == b.from_x && a.to_y == b.from_y;
+}
+
+bool IconDiff::Undoes(const IconDiff &other) const
+{
+   if (m_added.size() != other.m_removed.size()) return false;
+   if (m_removed.size() != other.m_added.size()) return false;
+   if (m_moved.size() != other.m_moved.size()) return false;
+
+   // Every list is in name order, so they can be matched up one-to-one
+   if (!equal(m_added.begin(), m_added.end(), other.m_removed.begin(), reversed)) return false;
+   if (!equal(m_removed.begin(), m_removed.end(), other.m_added.begin(), reversed)) return false;
+   return equal(m_moved.begin(), m_moved.end(), other.m_moved.begin(), reversed);
+}
+
+const IconDiff::Change *IconDiff::FindMoved(uint64_t key) const
+{
+   const auto found = lower_bound(m_moved_keys.begin(), m_moved_keys.end(), make_pair(key, size_t(0)));
+   if (found == m_moved_keys.end() || found->first != key) return nullptr;
+
+   return &m_moved[found->second];
+}
+
+wstring IconDiff::Label() const
+{
+   const size_t iconsAdd = m_added.size();
+   const size_t iconsDel = m_removed.size();
+   const size_t iconsMov = m_moved.size();
+
+   wstring addName = iconsAdd > 0 ? m_added.back().name : wstring();
+   wstring delName = iconsDel > 0 ? m_removed.back().name : wstring();
+   wstring movName = iconsMov > 0 ? m_moved.back().name : wstring();
+
+   // Trim down super-long filenames for display purposes
+   const static wstring::size_type MaxNameLength = 30;
+   const static wstring ellipsis = L"...";
+   if (addName.length() > MaxNameLength) addName = addName.substr(0, MaxNameLength) + ellipsis;
+   if (delName.length() > MaxNameLength) delName = delName.substr(0, MaxNameLength) + ellipsis;
+   if (movName.length() > MaxNameLength) movName = movName.substr(0, MaxNameLength) + ellipsis;
+
+   // Default to more generic messages, but let
+   // specific one-icon messages pre-empt
+   wstring extra = L"";
+   wstring extra_with_parens = L"";
+   if (iconsAdd > 0) extra = to_wstring(iconsAdd) + L" Added";
+   if (iconsDel > 0) extra = to_wstring(iconsDel) + L" Deleted";
+   if (iconsAdd > 0 && iconsDel > 0) extra = to_wstring(iconsAdd) + L" Added, " + to_wstring(iconsDel) + L" Deleted";
+   if (extra.length() > 0) extra_with_parens = L" (" + extra + L")";
+
+   wstring label;
+   if (iconsMov > 0) label = to_wstring(iconsMov) + L" Moved" + extra_with_parens;
+   if (iconsMov == 1) label = L"'" + movName + L"' Moved" + extra_with_parens;
+
+   if (iconsMov == 0) label = extra;
+   if (iconsMov == 0 && iconsAdd == 1 && iconsDel == 0) label = L"'" + addName + L"' Added";
+   if (iconsMov == 0 && iconsAdd == 0 && iconsDel == 1) label = L"'" + delName + L"' Deleted";
+
+   return label;
+}
@@ -0,0 +1,72 @@
+// DesktopSaver, (c)2006-2016 Nicholas Piegdon, MIT licensed
+#pragma once
+
+#include <string>
+#include <vector>
+#include <utility>
+#include <cstdint>
+
+class IconHistory;
+class IconRange;
+
+// Everything that changed between two snapshots, worked out in a single
+// pass over both (they're each sorted by name).  Each list is also in
+// name order.
+//
+// Icons are matched up by key, so two icons with the same name are never
+// confused with each other.  An icon that is only known by its name (its
+// key is MakeIconKey of its name, like anything saved before there were
+// keys) matches any icon with that name that nothing else claimed.
+class IconDiff
+{
+public:
+   struct Change
+   {
+      std::wstring name;
+
+      // Added icons only have a 'to' and removed icons only have a 'from'
+      long from_x, from_y;
+      long to_x, to_y;
+
+      // The icon's key in the 'from' snapshot (or the 'to' snapshot for
+      // added icons)
+      uint64_t key;
+   };
+
+   IconDiff() { }
+   IconDiff(const IconHistory &from, const IconHistory &to);
+
+   const std::vector<Change> &Added() const { return m_added; }
+   const std::vector<Change> &Removed() const { return m_removed; }
+   const std::vector<Change> &Moved() const { return m_moved; }
+
+   bool Empty() const { return m_added.empty() && m_removed.empty() && m_moved.empty(); }
+
+   // True if applying this diff after 'other' puts everything right back
+   // where it was before 'other' (e.g. an icon dragged away and back)
+   bool Undoes(const IconDiff &other) const;
+
+   // Binary search of Moved() by key.  Returns nullptr if it isn't there.
+   const Change *FindMoved(uint64_t key) const;
+
+   // A short description for the history menu, like "'Foo' Moved"
+   std::wstring Label() const;
+
+private:
+   // True if 'a' and 'b' have the same icons (by name and key) in the same
+   // order, so only their coordinates can differ
+   static bool same_icons(const IconRange &a, const IconRange &b);
+
+   // The general case: one pass over both (name-sorted) lists
+   void merge(const IconRange &a, const IconRange &b);
+
+   // Matches up the icons a[i, i_end) and b[j, j_end), which all have the same name
+   void match(const IconRange &a, size_t i, size_t i_end, const IconRange &b, size_t j, size_t j_end);
+
+   std::vector<Change> m_added;
+   std::vector<Change> m_removed;
+   std::vector<Change> m_moved;
+
+   // Each key in m_moved and its index there, sorted by key
+   std::vector<std::pair<uint64_t, size_t>> m_moved_keys;
+};
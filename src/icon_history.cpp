@@ -1,202 +1,208 @@
-// DesktopSaver, (c)2006-2016 Nicholas Piegdon, MIT licensed
-
-#include "file_reader.h"
-#include "icon_history.h"
-#include "string_util.h"
-
-#include <windows.h>
-#include "saver.h"
-
-#include <sstream>
-using namespace std;
-
-const wstring IconHistory::named_identifier(L"named_profile");
-
-IconHistory::IconHistory() : m_named_profile(false), m_name(L"Initial History") { }
-
-bool IconHistory::Deserialize(FileReader &fr)
-{
-   m_icons.clear();
-   m_named_profile = false;
-
-   // Read the header
-   wstring new_name = fr.ReadLine();
-   if (new_name.length() <= 0) return false;
-
-   // If this is a named profile, the first
-   // string will be a special identifier.  The
-   // next line is always the profile's name.
-   if (new_name == named_identifier)
-   {
-      m_named_profile = true;
-
-      new_name = fr.ReadLine();
-      if (new_name.length() <= 0) return false;
-   }
-   m_name = new_name;
-
-   // Parse the icon count using istringstreams
-   int icon_count = 0;
-   wistringstream icon_count_stream(fr.ReadLine());
-   icon_count_stream >> icon_count;
-
-   // Don't check for (icon_count > 0), because
-   // that's actually perfectly acceptable.
-
-   // Parse each individual icon
-   for (int i = 0; i < icon_count; ++i)
-   {
-      Icon icon;
-
-      icon.name = fr.ReadLine();
-      wistringstream x_stream(fr.ReadLine());
-      wistringstream y_stream(fr.ReadLine());
-
-      x_stream >> icon.x;
-      y_stream >> icon.y;
-
-      if (!x_stream.bad() && !y_stream.bad() && icon.name.length() > 0)
-      {
-         AddIcon(icon);
-      }
-      else
-      {
-         STANDARD_ERROR(L"There was a problem reading from the history file.  This should fix itself automatically, but some profiles may have been lost.");
-         return false;
-      }
-   }
-
-   return true;
-}
-
-void IconHistory::AddIcon(Icon icon)
-{
-   // This will fail on duplicates (see "KNOWN ISSUE" for
-   // struct Icon in icon_history.h), but we ignore it.
-   m_icons.insert(icon);
-}
-
-void IconHistory::CalculateName(const IconHistory &previous_history)
-{
-   int iconsAdd = 0;
-   int iconsDel = 0;
-   int iconsMov = 0;
-
-   wstring addName;
-   wstring delName;
-   wstring movName;
-
-   // Check first in one direction for moved and added icons
-   for (const auto &i : m_icons)
-   {
-      bool found = false;
-      for (const auto &j : previous_history.m_icons)
-      {
-         if (i.name != j.name) continue;
-
-         found = true;
-         if (i.x != j.x || i.y != j.y) { iconsMov++; movName = i.name; }
-         break;
-      }
-
-      if (found) continue;
-      iconsAdd++;
-      addName = i.name;
-   }
-
-   // Now check the other direction for deleted icons
-   for (const auto &i : previous_history.m_icons)
-   {
-      bool found = false;
-      for (const auto &j : m_icons)
-      {
-         if (i.name != j.name) continue;
-         found = true;
-         break;
-      }
-      if (found) continue;
-
-      iconsDel++;
-      delName = i.name;
-   }
-
-   // Trim down super-long filenames for display purposes
-   const static wstring::size_type MaxNameLength = 30;
-   const static wstring ellipsis = L"...";
-   if (addName.length() > MaxNameLength) addName = addName.substr(0, MaxNameLength) + ellipsis;
-   if (delName.length() > MaxNameLength) delName = delName.substr(0, MaxNameLength) + ellipsis;
-   if (movName.length() > MaxNameLength) movName = movName.substr(0, MaxNameLength) + ellipsis;
-
-   // Default to more generic messages, but let
-   // specific one-icon messages pre-empt
-   wstring extra = L"";
-   wstring extra_with_parens = L"";
-   if (iconsAdd > 0) extra = to_wstring(iconsAdd) + L" Added";
-   if (iconsDel > 0) extra = to_wstring(iconsDel) + L" Deleted";
-   if (iconsAdd > 0 && iconsDel > 0) extra = to_wstring(iconsAdd) + L" Added, " + to_wstring(iconsDel) + L" Deleted";
-   if (extra.length() > 0) extra_with_parens = L" (" + extra + L")";
-
-   if (iconsMov > 0) m_name = to_wstring(iconsMov) + L" Moved" + extra_with_parens;
-   if (iconsMov == 1) m_name = L"'" + movName + L"' Moved" + extra_with_parens;
-
-   if (iconsMov == 0) m_name = extra;
-   if (iconsMov == 0 && iconsAdd == 1 && iconsDel == 0) m_name = L"'" + addName + L"' Added";
-   if (iconsMov == 0 && iconsAdd == 0 && iconsDel == 1) m_name = L"'" + delName + L"' Deleted";
-}
-
-bool IconHistory::Identical(const IconHistory &other) const
-{
-   // Match the icon set in both directions.  This will
-   // cover additions, deletions, and moved icons.
-
-   for (const auto &i : m_icons)
-   {
-      bool found = false;
-      for (const auto &j : other.m_icons)
-      {
-         if (i.name != j.name || i.x != j.x || i.y != j.y) continue;
-         found = true;
-         break;
-      }
-      if (!found) return false;
-   }
-
-   for (const auto &i : other.m_icons)
-   {
-      bool found = false;
-      for (const auto &j : m_icons)
-      {
-         if (i.name != j.name || i.x != j.x || i.y != j.y) continue;
-         found = true;
-         break;
-      }
-      if (!found) return false;
-   }
-
-   return true;
-}
-
-wostream &operator<<(wostream &os, const IconHistory &h)
-{
-   os << L": =============================================" << endl;
-   os << L": IconHistory \"" << h.m_name << L"\"" << endl << endl;
-
-   if (h.IsNamedProfile()) { os << h.named_identifier << endl; }
-
-   os << h.m_name << endl;
-   os << (unsigned int)h.m_icons.size() << endl;
-   os << endl;
-
-   // Write each icon
-   int counter = 0;
-   for (const auto &i : h.m_icons)
-   {
-      os << i.name << endl;
-      os << i.x << endl;
-      os << i.y << endl;
-      os << endl;
-   }
-
-   os << endl;
-   return os;
-}
+// DesktopSaver, (c)2006-2016 Nicholas Piegdon, MIT licensed
+
+#include "file_reader.h"
+#include "icon_diff.h"
+#include "icon_history.h"
+#include "snapshot_builder.h"
+#include "string_util.h"
+
+#include <windows.h>
+#include "saver.h"
+
+#include <algorithm>
+#include <cwchar>
+using namespace std;
+
+const wstring IconHistory::named_identifier(L"named_profile");
+
+// Written as a comment after an icon's name, so older versions ignore it
+static const wstring KeyTag(L"@key ");
+
+IconHistory::IconHistory() : m_named_profile(false), m_name(L"Initial History"), m_time(0), m_display(0) { }
+
+static const Snapshot empty_snapshot;
+const Snapshot &IconHistory::icons() const { return m_icons ? *m_icons : empty_snapshot; }
+
+// Reads a number the same way "wistringstream >> long" would: leading
+// whitespace is skipped and anything after the digits is ignored
+static bool parse_long(const wchar_t *text, size_t length, long &value)
+{
+   size_t i = 0;
+   while (i < length && (text[i] == L' ' || text[i] == L'\t')) ++i;
+
+   bool negative = false;
+   if (i < length && (text[i] == L'-' || text[i] == L'+')) negative = (text[i++] == L'-');
+   if (i == length || text[i] < L'0' || text[i] > L'9') return false;
+
+   long long v = 0;
+   for (; i < length && text[i] >= L'0' && text[i] <= L'9'; ++i)
+   {
+      v = v * 10 + (text[i] - L'0');
+      if (v > 0x7FFFFFFF) return false;
+   }
+
+   value = long(negative ? -v : v);
+   return true;
+}
+
+static bool parse_key(const wchar_t *text, size_t length, uint64_t &key)
+{
+   if (length != KeyTag.length() + 16 || KeyTag.compare(0, KeyTag.length(), text, KeyTag.length()) != 0) return false;
+
+   key = 0;
+   for (size_t i = KeyTag.length(); i < length; ++i)
+   {
+      const wchar_t c = text[i];
+      unsigned digit;
+      if (c >= L'0' && c <= L'9') digit = unsigned(c - L'0');
+      else if (c >= L'a' && c <= L'f') digit = unsigned(c - L'a' + 10);
+      else return false;
+
+      key = (key << 4) | digit;
+   }
+
+   return true;
+}
+
+bool IconHistory::Deserialize(FileReader &fr)
+{
+   SnapshotBuilder scratch;
+   return Deserialize(fr, scratch);
+}
+
+bool IconHistory::Deserialize(FileReader &fr, SnapshotBuilder &scratch)
+{
+   m_icons.reset();
+   m_named_profile = false;
+   m_time = 0;
+   m_display = 0;
+   scratch.Reset();
+
+   // Read the header
+   wstring new_name = fr.ReadLine();
+   if (new_name.length() <= 0) return false;
+
+   // If this is a named profile, the first
+   // string will be a special identifier.  The
+   // next line is always the profile's name.
+   if (new_name == named_identifier)
+   {
+      m_named_profile = true;
+
+      new_name = fr.ReadLine();
+      if (new_name.length() <= 0) return false;
+   }
+   m_name = new_name;
+
+   // Don't check for (icon_count > 0), because
+   // that's actually perfectly acceptable.
+   const wchar_t *line;
+   size_t length;
+   long icon_count = 0;
+   if (!fr.ReadLine(line, length) || !parse_long(line, length, icon_count)) icon_count = 0;
+
+   // Parse each individual icon.  The lines are read in place and the
+   // names are only copied once, into the builder's arena.
+   for (long i = 0; i < icon_count; ++i)
+   {
+      const wchar_t *name, *comment;
+      size_t name_length, comment_length;
+      long x = 0, y = 0;
+
+      const bool good_name = fr.ReadLine(name, name_length, comment, comment_length) && name_length > 0;
+      const bool good_x = fr.ReadLine(line, length) && parse_long(line, length, x);
+      const bool good_y = fr.ReadLine(line, length) && parse_long(line, length, y);
+
+      if (good_name && good_x && good_y)
+      {
+         uint64_t key = 0;
+         if (!parse_key(comment, comment_length, key)) key = MakeIconKey(name, name_length);
+
+         scratch.AddIcon(name, name_length, key, x, y);
+      }
+      else
+      {
+         STANDARD_ERROR(L"There was a problem reading from the history file.  This should fix itself automatically, but some profiles may have been lost.");
+         return false;
+      }
+   }
+
+   scratch.CompactInto(*this);
+   return true;
+}
+
+size_t IconHistory::Find(const wchar_t *name, size_t length) const
+{
+   // Same ordering as std::wstring's operator<.  Several icons can share
+   // a name, so this finds the first of them.
+   const auto &names = icons().names;
+
+   size_t lo = 0, hi = names.size();
+   while (lo < hi)
+   {
+      const size_t mid = lo + (hi - lo) / 2;
+      const wstring &n = names[mid];
+
+      int c = wmemcmp(n.data(), name, min(n.length(), length));
+      if (c == 0) c = (n.length() < length) ? -1 : (n.length() > length ? 1 : 0);
+
+      if (c < 0) lo = mid + 1;
+      else hi = mid;
+   }
+
+   if (lo == names.size() || names[lo].compare(0, wstring::npos, name, length) != 0) return npos;
+   return lo;
+}
+
+void IconHistory::CalculateName(const IconHistory &previous_history)
+{
+   CalculateName(IconDiff(previous_history, *this));
+}
+
+void IconHistory::CalculateName(const IconDiff &diff)
+{
+   m_name = diff.Label();
+}
+
+bool IconHistory::Identical(const IconHistory &other) const
+{
+   // Every layout goes through the SnapshotStore, which never keeps two
+   // equal ones, so different snapshots always mean different icons
+   if (m_icons == other.m_icons) return true;
+   return icons().names.empty() && other.icons().names.empty();
+}
+
+static wstring key_text(uint64_t key)
+{
+   static const wchar_t lookup[] = L"0123456789abcdef";
+
+   wstring text(16, L'0');
+   for (int i = 15; i >= 0; --i, key >>= 4) text[i] = lookup[key & 0xF];
+   return text;
+}
+
+wostream &operator<<(wostream &os, const IconHistory &h)
+{
+   os << L": =============================================" << endl;
+   os << L": IconHistory \"" << h.m_name << L"\"" << endl << endl;
+
+   if (h.IsNamedProfile()) { os << h.named_identifier << endl; }
+
+   os << h.m_name << endl;
+   os << (unsigned int)h.GetIcons().size() << endl;
+   os << endl;
+
+   // Write each icon
+   for (const auto &i : h.GetIcons())
+   {
+      os << i.name;
+      if (i.key != MakeIconKey(i.name)) os << L":" << KeyTag << key_text(i.key);
+      os << endl;
+      os << i.x << endl;
+      os << i.y << endl;
+      os << endl;
+   }
+
+   os << endl;
+   return os;
+}
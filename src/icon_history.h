@@ -1,63 +1,131 @@
-// DesktopSaver, (c)2006-2016 Nicholas Piegdon, MIT licensed
-#pragma once
-
-#include <string>
-#include <set>
-
-class FileReader;
-
-// Contains information about one icon that lives on the desktop.
-//
-// Ideally, we might also include an icon handle in this structure
-// to combat the "known issue" below, but handles aren't constant
-// over Windows restarts.
-//
-// KNOWN ISSUE: If the user doesn't have "show file extensions" turned
-// on, duplicate named icons are possible.  Over the course of restarting
-// explorer, like-named icons may be be ordered differently, swapping
-// their final restored positions.
-//
-// More than likely, only the "first" encountered like-named icon will
-// even be recorded (and subsequently restored) properly.  The rest of
-// the like-named icons will be ignored.
-struct Icon
-{
-   std::wstring name;
-   long x, y;
-
-   bool operator <(const Icon &i) const { return (name < i.name); }
-};
-
-// Keeps track of one desktop icon positioning instance
-class IconHistory
-{
-public:
-   // Creates a blank history.  Follow up with several add_icon() calls,
-   // and finish with a calculate_name() call.
-   IconHistory();
-
-   std::wstring GetName() const { return m_name; }
-   void CalculateName(const IconHistory &previous_history);
-   void SetProfileName(const std::wstring &name) { m_name = name; m_named_profile = !m_name.empty(); }
-
-   bool IsNamedProfile() const { return m_named_profile; }
-
-   void AddIcon(Icon icon);
-   bool Identical(const IconHistory &other) const;
-
-   const std::set<Icon> GetIcons() const { return m_icons; }
-
-   // Restore icon history from file.  Returns true on success, false if the
-   // FileReader couldn't supply enough input (for the "last in the file" case)
-   bool Deserialize(FileReader &fr);
-
-private:
-   std::set<Icon> m_icons;
-
-   bool m_named_profile;
-   std::wstring m_name;
-
-   const static std::wstring named_identifier;
-
-   friend std::wostream &operator<<(std::wostream &os, const IconHistory &h);
-};
+// DesktopSaver, (c)2006-2016 Nicholas Piegdon, MIT licensed
+#pragma once
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include "snapshot_store.h"
+
+class FileReader;
+class IconDiff;
+class SnapshotBuilder;
+
+// A non-owning view of one icon stored inside an IconHistory.  Icons are
+// told apart by their key (see MakeIconKey), since two of them can have
+// the same name when "show file extensions" is off.
+struct IconRef
+{
+   const std::wstring &name;
+   long x, y;
+   uint64_t key;
+};
+
+// A non-owning, read-only range over the icons in an IconHistory (in name
+// order, then key order).  Only valid for as long as the IconHistory it
+// came from.
+class IconRange
+{
+public:
+   class iterator
+   {
+   public:
+      iterator(const IconRange *r, size_t i) : m_range(r), m_i(i) { }
+
+      IconRef operator*() const { return (*m_range)[m_i]; }
+      iterator &operator++() { ++m_i; return *this; }
+      bool operator!=(const iterator &o) const { return m_i != o.m_i; }
+
+   private:
+      const IconRange *m_range;
+      size_t m_i;
+   };
+
+   IconRange(const std::wstring *names, const uint64_t *keys, const int *xs, const int *ys, size_t count) : m_names(names), m_keys(keys), m_xs(xs), m_ys(ys), m_count(count) { }
+
+   size_t size() const { return m_count; }
+   bool empty() const { return m_count == 0; }
+
+   IconRef operator[](size_t i) const { return IconRef{ m_names[i], m_xs[i], m_ys[i], m_keys[i] }; }
+
+   // The underlying arrays, each size() long
+   const std::wstring *names() const { return m_names; }
+   const uint64_t *keys() const { return m_keys; }
+   const int *xs() const { return m_xs; }
+   const int *ys() const { return m_ys; }
+
+   iterator begin() const { return iterator(this, 0); }
+   iterator end() const { return iterator(this, m_count); }
+
+private:
+   const std::wstring *m_names;
+   const uint64_t *m_keys;
+   const int *m_xs;
+   const int *m_ys;
+   size_t m_count;
+};
+
+// Keeps track of one desktop icon positioning instance
+class IconHistory
+{
+public:
+   // Creates a blank history.  The icons are filled in by a
+   // SnapshotBuilder, and it's finished with a CalculateName() call.
+   IconHistory();
+
+   const std::wstring &GetName() const { return m_name; }
+   void CalculateName(const IconHistory &previous_history);
+   void CalculateName(const IconDiff &diff_from_previous);
+   void SetProfileName(const std::wstring &name) { m_name = name; m_named_profile = !m_name.empty(); }
+
+   bool IsNamedProfile() const { return m_named_profile; }
+
+   // When this was captured, in seconds since 1970 (UTC).  Zero if
+   // unknown (anything saved by an older version).
+   int64_t GetTime() const { return m_time; }
+   void SetTime(int64_t time) { m_time = time; }
+
+   // The monitor setup this was captured on (see DisplayConfig).  Zero if
+   // unknown (anything saved by an older version).
+   uint64_t GetDisplay() const { return m_display; }
+   void SetDisplay(uint64_t display) { m_display = display; }
+
+   // Equal layouts always share the same Snapshot, so this is just a
+   // pointer comparison
+   bool Identical(const IconHistory &other) const;
+
+   IconRange GetIcons() const { const Snapshot &s = icons(); return IconRange(s.names.data(), s.keys.data(), s.xs.data(), s.ys.data(), s.names.size()); }
+
+   // The (shared, immutable) icon layout behind this history
+   const SnapshotStore::Ref &GetSnapshot() const { return m_icons; }
+   void ShareIcons(const IconHistory &other) { m_icons = other.m_icons; }
+   void ShareIcons(const SnapshotStore::Ref &icons) { m_icons = icons; }
+
+   // Binary search by name.  Returns the first icon with that name, or
+   // npos if there is no such icon.
+   static const size_t npos = size_t(-1);
+   size_t Find(const std::wstring &name) const { return Find(name.c_str(), name.length()); }
+   size_t Find(const wchar_t *name, size_t length) const;
+
+   // Restore icon history from file.  Returns true on success, false if the
+   // FileReader couldn't supply enough input (for the "last in the file" case)
+   bool Deserialize(FileReader &fr);
+
+   // The same, using (and clobbering) a builder that can be
+   // reused from one history to the next
+   bool Deserialize(FileReader &fr, SnapshotBuilder &scratch);
+
+private:
+   // Null is the same as an empty layout
+   const Snapshot &icons() const;
+   SnapshotStore::Ref m_icons;
+
+   bool m_named_profile;
+   std::wstring m_name;
+   int64_t m_time;
+   uint64_t m_display;
+
+   const static std::wstring named_identifier;
+
+   friend class PackedHistory;
+   friend std::wostream &operator<<(std::wostream &os, const IconHistory &h);
+};
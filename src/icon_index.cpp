@@ -0,0 +1,80 @@
+// DesktopSaver, (c)2006-2016 Nicholas Piegdon, MIT licensed
+
+#include "icon_index.h"
+#include "icon_diff.h"
+using namespace std;
+
+void IconIndex::Clear()
+{
+   m_icons.clear();
+   m_recent.clear();
+   m_horizon = 0;
+}
+
+void IconIndex::Append(int64_t time, const IconDiff &diff)
+{
+   for (const auto &c : diff.Added()) record(c.key, c.name, Position{ time, true, c.to_x, c.to_y });
+   for (const auto &c : diff.Moved()) record(c.key, c.name, Position{ time, true, c.to_x, c.to_y });
+   for (const auto &c : diff.Removed()) record(c.key, c.name, Position{ time, false, c.from_x, c.from_y });
+}
+
+void IconIndex::record(uint64_t key, const wstring &name, const Position &p)
+{
+   auto found = m_icons.find(key);
+   if (found == m_icons.end())
+   {
+      m_recent.push_front(key);
+
+      Entry e;
+      e.recent = m_recent.begin();
+      found = m_icons.insert(make_pair(key, e)).first;
+   }
+   else m_recent.splice(m_recent.begin(), m_recent, found->second.recent);
+
+   // The shell can rename an icon without it becoming a different one
+   if (found->second.name != name) found->second.name = name;
+
+   Trail &trail = found->second.trail;
+   trail.push_back(p);
+
+   // Only ever trimming the icon being touched keeps this O(1) amortized
+   size_t expired = 0;
+   while (expired + 1 < trail.size() && trail[expired + 1].time <= m_horizon) ++expired;
+   if (expired > 0) trail.erase(trail.begin(), trail.begin() + expired);
+}
+
+const IconIndex::Trail *IconIndex::Find(uint64_t key) const
+{
+   const auto found = m_icons.find(key);
+   if (found == m_icons.end()) return nullptr;
+   return &found->second.trail;
+}
+
+const wstring &IconIndex::Name(uint64_t key) const
+{
+   static const wstring none;
+
+   const auto found = m_icons.find(key);
+   if (found == m_icons.end()) return none;
+   return found->second.name;
+}
+
+vector<uint64_t> IconIndex::RecentlyMoved(size_t count) const
+{
+   vector<uint64_t> keys;
+   for (auto key = m_recent.begin(); key != m_recent.end() && keys.size() < count; ++key)
+   {
+      const Trail &trail = m_icons.find(*key)->second.trail;
+      if (trail.empty() || !trail.back().present) continue;
+
+      for (auto p = trail.rbegin() + 1; p != trail.rend(); ++p)
+      {
+         if (!p->present || (p->x == trail.back().x && p->y == trail.back().y)) continue;
+
+         keys.push_back(*key);
+         break;
+      }
+   }
+
+   return keys;
+}
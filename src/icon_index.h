@@ -0,0 +1,81 @@
+// DesktopSaver, (c)2006-2016 Nicholas Piegdon, MIT licensed
+#pragma once
+
+#include <string>
+#include <vector>
+#include <list>
+#include <unordered_map>
+#include <cstdint>
+
+class IconDiff;
+
+// An inverted index of the timeline: for each icon, every position it
+// has had (and when it appeared or disappeared), in time order.  Icons
+// are told apart by key, so two that share a name each get their own.  It's
+// kept up to date one slice at a time from the same IconDiff that names
+// the slice, so adding a slice only costs as much as what changed in it.
+class IconIndex
+{
+public:
+   struct Position
+   {
+      // The capture time of the timeline slice where this started
+      int64_t time;
+
+      // False once the icon has been removed from the desktop
+      bool present;
+      long x, y;
+   };
+
+   typedef std::vector<Position> Trail;
+
+   IconIndex() : m_horizon(0) { }
+
+   void Clear();
+
+   // Records everything that changed in a new timeline slice
+   void Append(int64_t time, const IconDiff &diff);
+
+   // Positions from before this time are no longer needed (except the
+   // last one, which was still in effect then).  They're dropped the
+   // next time that icon changes.
+   void SetHorizon(int64_t time) { m_horizon = time; }
+
+   // Everywhere an icon has been, oldest first.  Null if it's never
+   // been seen.
+   const Trail *Find(uint64_t key) const;
+
+   // What the icon was called the last time it changed (for labels).
+   // Empty if it's never been seen.
+   const std::wstring &Name(uint64_t key) const;
+
+   // The key of every icon in the index, most recently changed first
+   const std::list<uint64_t> &RecentlyChanged() const { return m_recent; }
+
+   // Up to 'count' of the most recently changed icons that are on the
+   // desktop now and have been somewhere else before
+   std::vector<uint64_t> RecentlyMoved(size_t count) const;
+
+   size_t IconCount() const { return m_icons.size(); }
+
+private:
+   // Explicitly deny copying and assignment (m_icons points into m_recent)
+   IconIndex(const IconIndex&);
+   IconIndex &operator=(const IconIndex&);
+
+   struct Entry
+   {
+      std::wstring name;
+      Trail trail;
+      std::list<uint64_t>::iterator recent;
+   };
+
+   void record(uint64_t key, const std::wstring &name, const Position &p);
+
+   std::unordered_map<uint64_t, Entry> m_icons;
+
+   // Most recently changed first
+   std::list<uint64_t> m_recent;
+
+   int64_t m_horizon;
+};
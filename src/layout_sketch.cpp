@@ -0,0 +1,120 @@
+// DesktopSaver, (c)2006-2016 Nicholas Piegdon, MIT licensed
+
+#include "layout_sketch.h"
+#include "snapshot_store.h"
+
+#include <algorithm>
+#include <cstdlib>
+using namespace std;
+
+static int64_t offset(int xa, int ya, int xb, int yb)
+{
+   return llabs(int64_t(xa) - xb) + llabs(int64_t(ya) - yb);
+}
+
+LayoutDistance LayoutDistance::Between(const Snapshot &current, const Snapshot &layout)
+{
+   LayoutDistance d;
+
+   size_t a = 0, b = 0;
+   while (a < current.names.size())
+   {
+      const int c = (b < layout.names.size()) ? current.names[a].compare(layout.names[b]) : -1;
+
+      if (c > 0) { b++; continue; }
+      if (c < 0) { d.unknown++; a++; continue; }
+
+      if (current.xs[a] != layout.xs[b] || current.ys[a] != layout.ys[b])
+      {
+         d.moved++;
+         d.displacement += offset(current.xs[a], current.ys[a], layout.xs[b], layout.ys[b]);
+      }
+
+      a++;
+      b++;
+   }
+
+   return d;
+}
+
+// FNV-1a (32-bit).  Sketches are never saved, so this doesn't
+// have to be the same everywhere like SnapshotHasher does.
+static uint32_t name_hash(const wstring &name)
+{
+   uint32_t hash = 2166136261u;
+   for (wchar_t c : name) hash = (hash ^ uint32_t(c)) * 16777619u;
+   return hash;
+}
+
+void LayoutSketch::Build(const wstring *names, const int *xs, const int *ys, size_t count)
+{
+   m_count = count;
+   m_samples.clear();
+   m_samples.reserve((count < SampleCount ? count : SampleCount) + 1);
+
+   // Keep the lowest hashes seen so far in a max-heap
+   for (size_t i = 0; i < count; ++i)
+   {
+      const Sample s = { name_hash(names[i]), xs[i], ys[i] };
+      if (m_samples.size() == SampleCount && !(s < m_samples.front())) continue;
+
+      m_samples.push_back(s);
+      push_heap(m_samples.begin(), m_samples.end());
+
+      if (m_samples.size() <= SampleCount) continue;
+      pop_heap(m_samples.begin(), m_samples.end());
+      m_samples.pop_back();
+   }
+
+   sort(m_samples.begin(), m_samples.end());
+}
+
+LayoutDistance LayoutSketch::Estimate(const LayoutSketch &current, const LayoutSketch &layout)
+{
+   LayoutDistance d;
+   if (current.m_samples.empty()) return d;
+   if (layout.m_samples.empty()) { d.unknown = current.m_count; return d; }
+
+   // Past the smaller of the two sketches' largest hashes, one of them
+   // has stopped sampling, so only hashes up to there can be compared
+   const uint32_t limit = min(current.m_samples.back().name_hash, layout.m_samples.back().name_hash);
+
+   size_t shared = 0, either = 0, moved = 0;
+   int64_t displacement = 0;
+
+   auto a = current.m_samples.begin(), b = layout.m_samples.begin();
+   while (a != current.m_samples.end() || b != layout.m_samples.end())
+   {
+      const bool take_a = (a != current.m_samples.end()) && (b == layout.m_samples.end() || a->name_hash <= b->name_hash);
+      const bool take_b = (b != layout.m_samples.end()) && (a == current.m_samples.end() || b->name_hash <= a->name_hash);
+
+      const uint32_t hash = take_a ? a->name_hash : b->name_hash;
+      if (hash > limit) break;
+
+      either++;
+      if (take_a && take_b)
+      {
+         shared++;
+         if (a->x != b->x || a->y != b->y)
+         {
+            moved++;
+            displacement += offset(a->x, a->y, b->x, b->y);
+         }
+      }
+
+      if (take_a) ++a;
+      if (take_b) ++b;
+   }
+
+   // Scale the sample up to the whole layout.  The fraction of sampled
+   // names that both have estimates the overlap of the two name sets.
+   const double overlap = double(shared) / double(either);
+   const double common = overlap * double(current.m_count + layout.m_count) / (1.0 + overlap);
+
+   d.unknown = size_t(max(0.0, double(current.m_count) - common) + 0.5);
+   if (shared == 0) return d;
+
+   d.moved = size_t(double(moved) / double(shared) * common + 0.5);
+   d.displacement = int64_t(double(displacement) / double(shared) * common + 0.5);
+   return d;
+}
@@ -0,0 +1,66 @@
+// DesktopSaver, (c)2006-2016 Nicholas Piegdon, MIT licensed
+#pragma once
+
+#include <string>
+#include <vector>
+#include <cstdint>
+
+class Snapshot;
+
+// How far a layout is from the desktop as it is now: how many of the icons
+// they share are somewhere else, how far those are off in total (in
+// pixels, horizontally plus vertically), and how many icons on the desktop
+// the layout doesn't know about (and so couldn't put back).
+struct LayoutDistance
+{
+   size_t moved;
+   size_t unknown;
+   int64_t displacement;
+
+   LayoutDistance() : moved(0), unknown(0), displacement(0) { }
+
+   // Fewest icons out of place first, then the shortest distance
+   bool operator<(const LayoutDistance &o) const
+   {
+      if (moved + unknown != o.moved + o.unknown) return moved + unknown < o.moved + o.unknown;
+      return displacement < o.displacement;
+   }
+
+   bool Empty() const { return moved == 0 && displacement == 0; }
+
+   // Exact, in a single pass over both (name sorted) layouts
+   static LayoutDistance Between(const Snapshot &current, const Snapshot &layout);
+};
+
+// A small, fixed-size sample of a layout: the icons whose names hash the
+// lowest (a "bottom-k" sample).  Any two sketches sample the same icons
+// wherever their layouts share names, so comparing just the sketches
+// estimates the distance between whole layouts in constant time.
+class LayoutSketch
+{
+public:
+   static const size_t SampleCount = 64;
+
+   LayoutSketch() : m_count(0) { }
+
+   void Build(const std::wstring *names, const int *xs, const int *ys, size_t count);
+
+   // Roughly LayoutDistance::Between(current, layout) for the layouts
+   // these sketches were built from
+   static LayoutDistance Estimate(const LayoutSketch &current, const LayoutSketch &layout);
+
+private:
+   struct Sample
+   {
+      uint32_t name_hash;
+      int x, y;
+
+      bool operator<(const Sample &o) const { return name_hash < o.name_hash; }
+   };
+
+   // Sorted by name hash
+   std::vector<Sample> m_samples;
+
+   // The number of icons in the whole layout
+   size_t m_count;
+};
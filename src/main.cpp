@@ -1,85 +1,213 @@
-// DesktopSaver, (c)2006-2016 Nicholas Piegdon, MIT licensed
-
-#include <Windows.h>
-
-#include "ErrorTracker.h"
-#include "version.h"
-
-#include "saver_gui.h"
-#include "saver.h"
-
-using namespace std;
-
-wstring GetCommandLineArguments()
-{
-   wstring result;
-
-   // CommandLineToArgvW is only available in Windows XP or later.  So,
-   // rather than maintain separate binaries for Win2K, I do a runtime
-   // library load and check to see if the function I need is available.
-   HINSTANCE shell32 = LoadLibrary(L"shell32");
-   if (!shell32) return result;
-
-   typedef LPWSTR* (WINAPI *COMMANDLINETOARGVW_SIGNATURE)(LPCWSTR, int*);
-
-   COMMANDLINETOARGVW_SIGNATURE function = 0;
-   function = (COMMANDLINETOARGVW_SIGNATURE) GetProcAddress(shell32, "CommandLineToArgvW");
-
-   if (function)
-   {
-      // Grab the file argument from the command line if there is one.
-      wstring raw_command_line = GetCommandLine();
-
-      int argument_count;
-      LPWSTR *arguments = (function)(raw_command_line.c_str(), &argument_count);
-
-      for (int i = 1; i < argument_count; ++i)
-      {
-         result += arguments[i];
-         result += L" ";
-      }
-   }
-   FreeLibrary(shell32);
-
-   // Trim off the trailing space
-   if (result.length() > 1) result = result.substr(0, result.length() - 1);
-
-   return result;
-}
-
-
-int AutoLoadProfile(wstring profileName)
-{
-   DesktopSaver saver;
-   for (auto &p : saver.NamedProfiles())
-   {
-      if (p.GetName() != profileName) continue;
-
-      saver.RestoreHistory(p);
-      return 0;
-   }
-
-   return 1;
-}
-
-int WINAPI WinMain(HINSTANCE h_instance, HINSTANCE, PSTR cmdLine, int)
-{
-   BOOL is64bit = FALSE;
-   IsWow64Process(GetCurrentProcess(), &is64bit);
-   if (sizeof(void*) == 4 && is64bit)
-   {
-      MessageBox(nullptr, L"You must run the 64-bit version of DesktopSaver on 64-bit versions of Windows.", L"64-bit Version Required", MB_ICONEXCLAMATION);
-      return 0;
-   }
-
-   ErrorTracker::Initialize(wstring(L"DesktopSaver-") + wstring(DesktopSaverVersion) + wstring(L"-crash-report.dmp"), true, true);
-
-   if (cmdLine != 0 && cmdLine[0] != 0)
-   {
-      wstring profileName = GetCommandLineArguments();
-      if (profileName.length() > 0) return AutoLoadProfile(profileName);
-   }
-
-   DesktopSaverGui tray(h_instance);
-   return tray.Run();
-}
+// DesktopSaver, (c)2006-2016 Nicholas Piegdon, MIT licensed
+
+#include <Windows.h>
+#include <ctime>
+
+#include "ErrorTracker.h"
+#include "version.h"
+
+#include "saver_gui.h"
+#include "saver.h"
+#include "command_server.h"
+
+using namespace std;
+
+wstring GetCommandLineArguments()
+{
+   wstring result;
+
+   // CommandLineToArgvW is only available in Windows XP or later.  So,
+   // rather than maintain separate binaries for Win2K, I do a runtime
+   // library load and check to see if the function I need is available.
+   HINSTANCE shell32 = LoadLibrary(L"shell32");
+   if (!shell32) return result;
+
+   typedef LPWSTR* (WINAPI *COMMANDLINETOARGVW_SIGNATURE)(LPCWSTR, int*);
+
+   COMMANDLINETOARGVW_SIGNATURE function = 0;
+   function = (COMMANDLINETOARGVW_SIGNATURE) GetProcAddress(shell32, "CommandLineToArgvW");
+
+   if (function)
+   {
+      // Grab the file argument from the command line if there is one.
+      wstring raw_command_line = GetCommandLine();
+
+      int argument_count;
+      LPWSTR *arguments = (function)(raw_command_line.c_str(), &argument_count);
+
+      for (int i = 1; i < argument_count; ++i)
+      {
+         result += arguments[i];
+         result += L" ";
+      }
+   }
+   FreeLibrary(shell32);
+
+   // Trim off the trailing space
+   if (result.length() > 1) result = result.substr(0, result.length() - 1);
+
+   return result;
+}
+
+
+// Logon scripts run this every time, so it skips everything a full
+// DesktopSaver would do at startup (loading and re-saving the history,
+// polling, and the auto-start profile).  Only the one profile is read.
+int AutoLoadProfile(wstring profileName)
+{
+   IconHistory profile;
+   if (!DesktopSaver::LoadNamedProfile(profileName, profile)) return 1;
+
+   SnapshotBuilder scratch;
+   DesktopSaver::ApplyLayout(profile, scratch);
+   return 0;
+}
+
+// Accepts "YYYY-MM-DD", optionally followed by " HH:MM" or " HH:MM:SS", in local time
+bool ParseLocalTime(const wstring &text, int64_t &out)
+{
+   tm when = tm();
+   int fields = swscanf_s(text.c_str(), L"%d-%d-%d %d:%d:%d", &when.tm_year, &when.tm_mon, &when.tm_mday, &when.tm_hour, &when.tm_min, &when.tm_sec);
+   if (fields != 3 && fields != 5 && fields != 6) return false;
+
+   when.tm_year -= 1900;
+   when.tm_mon -= 1;
+   when.tm_isdst = -1;
+
+   const time_t t = mktime(&when);
+   if (t == time_t(-1)) return false;
+
+   out = int64_t(t);
+   return true;
+}
+
+// Shows a reply to the user: on the console we were started from, if
+// there is one, or in a message box otherwise
+void ShowResponse(const wstring &text)
+{
+   if (AttachConsole(ATTACH_PARENT_PROCESS))
+   {
+      const wstring line = L"\n" + text + L"\n";
+      DWORD written = 0;
+      WriteConsole(GetStdHandle(STD_OUTPUT_HANDLE), line.c_str(), DWORD(line.length()), &written, NULL);
+      FreeConsole();
+      return;
+   }
+
+   MessageBox(nullptr, text.c_str(), DesktopSaverName, MB_ICONINFORMATION);
+}
+
+// Replies start with "ok" or "error" (see DesktopSaver::RunCommand)
+bool CommandSucceeded(const wstring &response)
+{
+   return response.compare(0, 2, L"ok") == 0;
+}
+
+int FinishCommand(const wstring &response, bool show)
+{
+   const bool ok = CommandSucceeded(response);
+
+   const size_t details = response.find_first_of(L" \n");
+   if ((show || !ok) && details != wstring::npos) ShowResponse(response.substr(details + 1));
+
+   return ok ? 0 : 1;
+}
+
+// The copy of DesktopSaver already running in the tray gets first crack at
+// any request, so only one process is ever reading and writing the history.
+// If there isn't one, we do the work ourselves.
+int RunCommand(const wstring &request, bool show)
+{
+   wstring response;
+   if (CommandServer::Send(CommandServer::DefaultName(), request, response)) return FinishCommand(response, show);
+
+   DesktopSaver saver;
+   return FinishCommand(saver.RunCommand(request), show);
+}
+
+// Like AutoLoadProfile, only the one slice is read (if the history file's
+// index can find it) when there isn't a copy in the tray to ask
+int RestoreAsOf(int64_t when)
+{
+   const wstring request = WSTRING(L"asof " << when);
+
+   wstring response;
+   if (CommandServer::Send(CommandServer::DefaultName(), request, response)) return FinishCommand(response, false);
+
+   IconHistory slice;
+   if (DesktopSaver::LoadSliceAsOf(when, slice))
+   {
+      SnapshotBuilder scratch;
+      DesktopSaver::ApplyLayout(slice, scratch);
+      return 0;
+   }
+
+   // An older file without an index (or nothing saved that long ago,
+   // which this reports properly)
+   DesktopSaver saver;
+   return FinishCommand(saver.RunCommand(request), false);
+}
+
+int WINAPI WinMain(HINSTANCE h_instance, HINSTANCE, PSTR cmdLine, int)
+{
+   BOOL is64bit = FALSE;
+   IsWow64Process(GetCurrentProcess(), &is64bit);
+   if (sizeof(void*) == 4 && is64bit)
+   {
+      MessageBox(nullptr, L"You must run the 64-bit version of DesktopSaver on 64-bit versions of Windows.", L"64-bit Version Required", MB_ICONEXCLAMATION);
+      return 0;
+   }
+
+   ErrorTracker::Initialize(wstring(L"DesktopSaver-") + wstring(DesktopSaverVersion) + wstring(L"-crash-report.dmp"), true, true);
+
+   if (cmdLine != 0 && cmdLine[0] != 0)
+   {
+      wstring arguments = GetCommandLineArguments();
+
+      // "--as-of <time>" restores the layout the desktop had at that time
+      static const wstring AsOfSwitch = L"--as-of ";
+      if (arguments.compare(0, AsOfSwitch.length(), AsOfSwitch) == 0)
+      {
+         int64_t when = 0;
+         if (!ParseLocalTime(arguments.substr(AsOfSwitch.length()), when)) return 2;
+         return RestoreAsOf(when);
+      }
+
+      // "--closest" restores whichever saved layout is nearest to the desktop now
+      if (arguments == L"--closest") return RunCommand(L"closest", false);
+
+      // "--snapshot" records the desktop as it is right now
+      if (arguments == L"--snapshot") return RunCommand(L"snapshot", false);
+
+      // "--add <name>" saves the desktop as a named profile, and "--delete <name>" removes one
+      static const wstring AddSwitch = L"--add ";
+      static const wstring DeleteSwitch = L"--delete ";
+      if (arguments.compare(0, AddSwitch.length(), AddSwitch) == 0) return RunCommand(L"add " + arguments.substr(AddSwitch.length()), false);
+      if (arguments.compare(0, DeleteSwitch.length(), DeleteSwitch) == 0) return RunCommand(L"delete " + arguments.substr(DeleteSwitch.length()), false);
+
+      // "--icons <profile>|<icon>|..." moves just those icons back to where the profile has them
+      static const wstring IconsSwitch = L"--icons ";
+      if (arguments.compare(0, IconsSwitch.length(), IconsSwitch) == 0) return RunCommand(L"icons " + arguments.substr(IconsSwitch.length()), false);
+
+      // "--stats" shows what the running copy has been up to
+      if (arguments == L"--stats") return RunCommand(L"stats", true);
+
+      // Anything else is the name of a profile to restore.  Logon scripts
+      // do this, so (like AutoLoadProfile) a missing profile only shows
+      // up in the exit code, never as a dialog somebody has to dismiss.
+      if (arguments.length() > 0)
+      {
+         wstring response;
+         if (CommandServer::Send(CommandServer::DefaultName(), L"restore " + arguments, response)) return CommandSucceeded(response) ? 0 : 1;
+
+         return AutoLoadProfile(arguments);
+      }
+   }
+
+   // There only needs to be one of us in the tray
+   wstring response;
+   if (CommandServer::Send(CommandServer::DefaultName(), L"ping", response)) return 0;
+
+   DesktopSaverGui tray(h_instance);
+   return tray.Run();
+}
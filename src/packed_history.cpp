@@ -0,0 +1,183 @@
+// DesktopSaver, (c)2006-2016 Nicholas Piegdon, MIT licensed
+
+#include "packed_history.h"
+#include "block_compressor.h"
+#include "icon_history.h"
+#include "snapshot_builder.h"
+#include "string_util.h"
+
+#include <vector>
+using namespace std;
+
+static const char Signature[] = { 'D', 'S', 'Z', 1 };
+static const size_t SignatureLength = sizeof(Signature);
+
+static const unsigned long long NamedProfileFlag = 1;
+
+static unsigned long long zigzag(long long v) { return (static_cast<unsigned long long>(v) << 1) ^ static_cast<unsigned long long>(v >> 63); }
+static long long unzigzag(unsigned long long v) { return static_cast<long long>(v >> 1) ^ -static_cast<long long>(v & 1); }
+
+static unsigned long long gcd(unsigned long long a, unsigned long long b)
+{
+   while (b != 0) { unsigned long long t = a % b; a = b; b = t; }
+   return a;
+}
+
+static void write_string(string &out, const string &s)
+{
+   BlockCompressor::WriteVarint(out, s.length());
+   out += s;
+}
+
+static bool read_string(const string &in, size_t &pos, string &s)
+{
+   unsigned long long length = 0;
+   if (!BlockCompressor::ReadVarint(in, pos, length) || length > in.size() - pos) return false;
+
+   s.assign(in, pos, size_t(length));
+   pos += size_t(length);
+   return true;
+}
+
+bool PackedHistory::IsPacked(const string &data)
+{
+   return data.size() >= SignatureLength && data.compare(0, SignatureLength, Signature, SignatureLength) == 0;
+}
+
+string PackedHistory::Pack(const IconHistory &h)
+{
+   const auto icons = h.GetIcons();
+
+   // Find the grid everything sits on: the smallest coordinate is the
+   // origin, and the spacing is whatever evenly divides every offset from it
+   long min_x = 0, min_y = 0;
+   bool first = true;
+   for (const auto &i : icons)
+   {
+      if (first || i.x < min_x) min_x = i.x;
+      if (first || i.y < min_y) min_y = i.y;
+      first = false;
+   }
+
+   unsigned long long grid_x = 0, grid_y = 0;
+   for (const auto &i : icons)
+   {
+      grid_x = gcd(grid_x, (unsigned long long)(i.x - min_x));
+      grid_y = gcd(grid_y, (unsigned long long)(i.y - min_y));
+   }
+   if (grid_x == 0) grid_x = 1;
+   if (grid_y == 0) grid_y = 1;
+
+   string body;
+   body.reserve(icons.size() * 8 + 64);
+
+   BlockCompressor::WriteVarint(body, h.IsNamedProfile() ? NamedProfileFlag : 0);
+   write_string(body, ToUtf8(h.GetName()));
+   BlockCompressor::WriteVarint(body, icons.size());
+   BlockCompressor::WriteVarint(body, zigzag(min_x));
+   BlockCompressor::WriteVarint(body, zigzag(min_y));
+   BlockCompressor::WriteVarint(body, grid_x);
+   BlockCompressor::WriteVarint(body, grid_y);
+
+   string previous;
+   long long previous_x = 0, previous_y = 0;
+   for (const auto &i : icons)
+   {
+      const string name = ToUtf8(i.name);
+
+      size_t shared = 0;
+      while (shared < name.length() && shared < previous.length() && name[shared] == previous[shared]) ++shared;
+
+      BlockCompressor::WriteVarint(body, shared);
+      write_string(body, name.substr(shared));
+
+      const long long x = (long long)((i.x - min_x) / (long long)grid_x);
+      const long long y = (long long)((i.y - min_y) / (long long)grid_y);
+      BlockCompressor::WriteVarint(body, zigzag(x - previous_x));
+      BlockCompressor::WriteVarint(body, zigzag(y - previous_y));
+
+      previous = name;
+      previous_x = x;
+      previous_y = y;
+   }
+
+   // Keys that didn't just come from the icon's name go at the very end,
+   // where older versions never look
+   vector<size_t> keyed;
+   for (size_t i = 0; i < icons.size(); ++i) if (icons[i].key != MakeIconKey(icons[i].name)) keyed.push_back(i);
+
+   BlockCompressor::WriteVarint(body, keyed.size());
+   size_t previous_index = 0;
+   for (size_t i : keyed)
+   {
+      BlockCompressor::WriteVarint(body, i - previous_index);
+      BlockCompressor::WriteVarint(body, icons[i].key);
+      previous_index = i;
+   }
+
+   return string(Signature, SignatureLength) + BlockCompressor::Compress(body);
+}
+
+bool PackedHistory::Unpack(const string &data, IconHistory &h)
+{
+   if (!IsPacked(data)) return false;
+
+   string body;
+   if (!BlockCompressor::Decompress(data.substr(SignatureLength), body)) return false;
+
+   size_t pos = 0;
+   unsigned long long flags = 0, count = 0, origin_x = 0, origin_y = 0, grid_x = 0, grid_y = 0;
+   string name;
+
+   if (!BlockCompressor::ReadVarint(body, pos, flags)) return false;
+   if (!read_string(body, pos, name)) return false;
+   if (!BlockCompressor::ReadVarint(body, pos, count)) return false;
+   if (!BlockCompressor::ReadVarint(body, pos, origin_x)) return false;
+   if (!BlockCompressor::ReadVarint(body, pos, origin_y)) return false;
+   if (!BlockCompressor::ReadVarint(body, pos, grid_x)) return false;
+   if (!BlockCompressor::ReadVarint(body, pos, grid_y)) return false;
+
+   h = IconHistory();
+   h.m_name = FromUtf8(name);
+   h.m_named_profile = (flags & NamedProfileFlag) != 0;
+
+   SnapshotBuilder icons;
+   string previous, suffix;
+   long long x = 0, y = 0;
+   for (unsigned long long i = 0; i < count; ++i)
+   {
+      unsigned long long shared = 0, dx = 0, dy = 0;
+
+      if (!BlockCompressor::ReadVarint(body, pos, shared) || shared > previous.length()) return false;
+      if (!read_string(body, pos, suffix)) return false;
+      if (!BlockCompressor::ReadVarint(body, pos, dx)) return false;
+      if (!BlockCompressor::ReadVarint(body, pos, dy)) return false;
+
+      previous.resize(size_t(shared));
+      previous += suffix;
+      x += unzigzag(dx);
+      y += unzigzag(dy);
+
+      icons.AddIcon(FromUtf8(previous), long(unzigzag(origin_x) + x * (long long)grid_x), long(unzigzag(origin_y) + y * (long long)grid_y));
+   }
+
+   // Anything older than icon keys just stops here
+   unsigned long long keyed = 0;
+   if (pos < body.size() && !BlockCompressor::ReadVarint(body, pos, keyed)) return false;
+
+   unsigned long long index = 0;
+   for (unsigned long long i = 0; i < keyed; ++i)
+   {
+      unsigned long long gap = 0, key = 0;
+      if (!BlockCompressor::ReadVarint(body, pos, gap)) return false;
+      if (!BlockCompressor::ReadVarint(body, pos, key)) return false;
+
+      index += gap;
+      if (index >= count) return false;
+      icons.SetKey(size_t(index), key);
+   }
+
+   icons.CompactInto(h);
+
+   return true;
+}
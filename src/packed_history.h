@@ -0,0 +1,26 @@
+// DesktopSaver, (c)2006-2016 Nicholas Piegdon, MIT licensed
+#pragma once
+
+#include <string>
+
+class IconHistory;
+
+// The optional compact encoding for a single IconHistory.
+//
+// Icon names are UTF-8, each stored as the length of the prefix it shares
+// with the previous (sorted) name plus the remaining suffix.  Coordinates
+// are reduced to the desktop grid (a common origin and spacing found from
+// the icons themselves), delta-coded against the previous icon, and
+// written as zig-zag varints.  Any icon keys that didn't just come from
+// the icon's name follow all of the icons, as (index gap, key) varint
+// pairs.  The whole thing is then run through the BlockCompressor.
+class PackedHistory
+{
+public:
+   // Packed slices start with this signature, which can never be
+   // mistaken for the ':' that starts every plain-text slice
+   static bool IsPacked(const std::string &data);
+
+   static std::string Pack(const IconHistory &h);
+   static bool Unpack(const std::string &data, IconHistory &h);
+};
@@ -0,0 +1,60 @@
+// DesktopSaver, (c)2006-2016 Nicholas Piegdon, MIT licensed
+
+#include "profile_store.h"
+#include <cwctype>
+
+using namespace std;
+
+wstring ProfileStore::FoldName(const wstring &name)
+{
+   wstring folded(name);
+   for (auto &c : folded) c = wchar_t(towlower(c));
+   return folded;
+}
+
+const IconHistory *ProfileStore::Find(const wstring &name) const
+{
+   const auto i = m_index.find(FoldName(name));
+   return i == m_index.end() ? nullptr : &m_profiles[i->second];
+}
+
+void ProfileStore::Put(const IconHistory &profile)
+{
+   const wstring folded = FoldName(profile.GetName());
+
+   const auto i = m_index.insert(make_pair(folded, m_profiles.size()));
+   if (i.second)
+   {
+      m_profiles.push_back(profile);
+      m_folded.push_back(folded);
+      return;
+   }
+
+   IconHistory &existing = m_profiles[i.first->second];
+   const wstring name = existing.GetName();
+
+   existing = profile;
+   existing.SetProfileName(name);
+}
+
+bool ProfileStore::Remove(const wstring &name)
+{
+   const auto i = m_index.find(FoldName(name));
+   if (i == m_index.end()) return false;
+
+   const size_t position = i->second;
+   m_index.erase(i);
+   m_profiles.erase(m_profiles.begin() + position);
+   m_folded.erase(m_folded.begin() + position);
+
+   // Everything after it moved up one
+   for (size_t p = position; p < m_profiles.size(); ++p) m_index[m_folded[p]] = p;
+   return true;
+}
+
+void ProfileStore::Clear()
+{
+   m_profiles.clear();
+   m_folded.clear();
+   m_index.clear();
+}
@@ -0,0 +1,41 @@
+// DesktopSaver, (c)2006-2016 Nicholas Piegdon, MIT licensed
+#pragma once
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include "icon_history.h"
+
+// The named profiles, in the order they were created, with a lookup by
+// name that ignores case.  There's no limit on how many there can be.
+class ProfileStore
+{
+public:
+   typedef std::vector<IconHistory> Profiles;
+
+   // The form names are compared in (e.g. "Work" and "WORK" are the same)
+   static std::wstring FoldName(const std::wstring &name);
+
+   const Profiles &All() const { return m_profiles; }
+   size_t Count() const { return m_profiles.size(); }
+   bool Empty() const { return m_profiles.empty(); }
+
+   // Null if there's no profile with that name
+   const IconHistory *Find(const std::wstring &name) const;
+
+   // Replaces any profile with the same name, where it stands in the list
+   // (keeping its original spelling), or adds it to the end
+   void Put(const IconHistory &profile);
+
+   // False if there was nothing by that name
+   bool Remove(const std::wstring &name);
+
+   void Clear();
+
+private:
+   Profiles m_profiles;
+   std::vector<std::wstring> m_folded;
+
+   // Folded name -> position in m_profiles
+   std::unordered_map<std::wstring, size_t> m_index;
+};
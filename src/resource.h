@@ -1,15 +1,15 @@
-// DesktopSaver, (c)2006-2016 Nicholas Piegdon, MIT licensed
-
-#define VS_VERSION_INFO                 1
-#define IDD_NEW_PROFILE                 102
-#define IDC_NAME_BOX                    1003
-#define IDC_QUESTION                    1004
-
-#ifdef APSTUDIO_INVOKED
-#ifndef APSTUDIO_READONLY_SYMBOLS
-#define _APS_NEXT_RESOURCE_VALUE        102
-#define _APS_NEXT_COMMAND_VALUE         40001
-#define _APS_NEXT_CONTROL_VALUE         1005
-#define _APS_NEXT_SYMED_VALUE           101
-#endif
-#endif
+// DesktopSaver, (c)2006-2016 Nicholas Piegdon, MIT licensed
+
+#define VS_VERSION_INFO                 1
+#define IDD_NEW_PROFILE                 102
+#define IDC_NAME_BOX                    1003
+#define IDC_QUESTION                    1004
+
+#ifdef APSTUDIO_INVOKED
+#ifndef APSTUDIO_READONLY_SYMBOLS
+#define _APS_NEXT_RESOURCE_VALUE        102
+#define _APS_NEXT_COMMAND_VALUE         40001
+#define _APS_NEXT_CONTROL_VALUE         1005
+#define _APS_NEXT_SYMED_VALUE           101
+#endif
+#endif
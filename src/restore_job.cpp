@@ -0,0 +1,72 @@
+// DesktopSaver, (c)2006-2016 Nicholas Piegdon, MIT licensed
+
+#include "restore_job.h"
+using namespace std;
+
+RestoreJob::RestoreJob(const wstring &description, function<void()> on_progress) : m_description(description), m_on_progress(on_progress), m_cancel(false)
+{
+   m_progress.state = Queued;
+   m_progress.pass = 0;
+   m_progress.moved = 0;
+   m_progress.total = 0;
+   m_progress.seconds = 0;
+}
+
+RestoreJob::Progress RestoreJob::GetProgress() const
+{
+   lock_guard<mutex> lock(m_mutex);
+
+   Progress p = m_progress;
+   if (p.state == Running) p.seconds = chrono::duration<double>(chrono::steady_clock::now() - m_start).count();
+   return p;
+}
+
+void RestoreJob::Start()
+{
+   {
+      lock_guard<mutex> lock(m_mutex);
+      if (m_progress.state != Queued) return;
+
+      m_progress.state = Running;
+      m_start = chrono::steady_clock::now();
+   }
+   update();
+}
+
+void RestoreJob::StartPass(int pass, size_t total)
+{
+   {
+      lock_guard<mutex> lock(m_mutex);
+      m_progress.pass = pass;
+      m_progress.moved = 0;
+      m_progress.total = total;
+   }
+   update();
+}
+
+void RestoreJob::Moved(size_t count)
+{
+   {
+      lock_guard<mutex> lock(m_mutex);
+      m_progress.moved = count;
+   }
+   update();
+}
+
+void RestoreJob::Finish(bool cancelled)
+{
+   {
+      lock_guard<mutex> lock(m_mutex);
+      if (m_progress.state == Finished || m_progress.state == Cancelled) return;
+
+      // A job that never got to run didn't take any time
+      if (m_progress.state == Running) m_progress.seconds = chrono::duration<double>(chrono::steady_clock::now() - m_start).count();
+      m_progress.state = cancelled ? Cancelled : Finished;
+   }
+   update();
+}
+
+void RestoreJob::update()
+{
+   if (m_on_progress) m_on_progress();
+}
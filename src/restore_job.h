@@ -0,0 +1,64 @@
+// DesktopSaver, (c)2006-2016 Nicholas Piegdon, MIT licensed
+#pragma once
+
+#include <string>
+#include <functional>
+#include <atomic>
+#include <mutex>
+#include <chrono>
+
+// One restore, as it runs on the worker thread.  DesktopSaver reports
+// its progress here as it goes, and any other thread can watch that or
+// ask for the restore to stop.  Cancelling takes effect at the next
+// batch of icons, leaving the ones already moved where they are.
+class RestoreJob
+{
+public:
+   enum State { Queued, Running, Finished, Cancelled };
+
+   struct Progress
+   {
+      State state;
+
+      // Which pass (of up to three) is running, and how many of the icons
+      // that pass has to move are done so far
+      int pass;
+      size_t moved, total;
+
+      // Time spent running so far, or in total once it's done
+      double seconds;
+   };
+
+   // 'on_progress' is called (on the worker thread) after each update
+   RestoreJob(const std::wstring &description, std::function<void()> on_progress);
+
+   const std::wstring &Description() const { return m_description; }
+
+   void Cancel() { m_cancel = true; }
+   bool CancelRequested() const { return m_cancel; }
+
+   Progress GetProgress() const;
+
+   // Used by DesktopSaver as the restore goes along.  Only the
+   // first call to Finish() counts.
+   void Start();
+   void StartPass(int pass, size_t total);
+   void Moved(size_t count);
+   void Finish(bool cancelled);
+
+private:
+   // Explicitly deny copying and assignment
+   RestoreJob(const RestoreJob&);
+   RestoreJob &operator=(const RestoreJob&);
+
+   void update();
+
+   const std::wstring m_description;
+   const std::function<void()> m_on_progress;
+
+   std::atomic<bool> m_cancel;
+
+   mutable std::mutex m_mutex;
+   Progress m_progress;
+   std::chrono::steady_clock::time_point m_start;
+};
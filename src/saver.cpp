@@ -1,412 +1,1448 @@
-// DesktopSaver, (c)2006-2016 Nicholas Piegdon, MIT licensed
-
-#include <windows.h>
-#include <commctrl.h>
-#include <shlobj.h>
-
-#include "saver.h"
-#include "file_reader.h"
-#include "registry.h"
-#include "version.h"
-
-#include <algorithm>
-#include <fstream>
-#include <sstream>
-using namespace std;
-
-DesktopSaver::DesktopSaver()
-{
-   // Grab our polling rate from the registry
-   m_rate = read_poll_rate();
-
-   // Set the location of the history file by starting with a default
-   m_historyPath = L"icon_history_2.txt";
-
-   // Add the shell folder path if we've got one
-   TCHAR sh_path[MAX_PATH];
-   HRESULT hr = SHGetFolderPath(0, CSIDL_APPDATA | CSIDL_FLAG_CREATE, 0, SHGFP_TYPE_CURRENT, sh_path);
-
-   if (SUCCEEDED(hr))
-   {
-      // Attempt to create the directory (in case it doesn't already exist
-      wstring path = wstring(sh_path) + L"\\DesktopSaver\\";
-      SHCreateDirectoryEx(0, path.c_str(), 0);
-
-      m_historyPath = path + m_historyPath;
-   }
-
-   // Load our previous icon history file
-   deserialize();
-
-   // Read the desktop immediately to either add the very first history
-   // slice to our list (on the very first run ever), or to compare to
-   // the last known positions of all the icons (on subsequent runs).
-   PollDesktopIcons();
-
-   const wstring autostart = GetAutostartProfileName();
-   if (autostart.empty()) return;
-
-   for (const auto &h : m_namedProfiles)
-   {
-      if (h.GetName() != autostart) continue;
-
-      RestoreHistory(h);
-      break;
-   }   
-}
-
-void DesktopSaver::deserialize()
-{
-   // knock out our old history and named profile list
-   m_history = HistoryList();
-   m_namedProfiles = HistoryList();
-
-    FileReader fr(m_historyPath);
-
-    // Read in IconHistory objects until one fails to load
-    IconHistory h;
-    while (h.Deserialize(fr))
-    {
-        if (h.IsNamedProfile()) m_namedProfiles.push_back(h);
-        else m_history.push_back(h);
-    }
-
-}
-
-void DesktopSaver::serialize() const
-{
-    // NOTE: The multi-byte output requires this
-    const static wstring end = L"\r\n";
-
-    wostringstream file;
-    file << L":" << end;
-    file << L": " << DesktopSaverName << L" " << DesktopSaverVersion << L" icon history file" << end;
-    file << L":" << end;
-    file << end;
-    for (const auto &h : m_history) file << h << end;
-    for (const auto &h : m_namedProfiles) file << h << end;
-
-    FILE *f = 0;
-    errno_t err = _wfopen_s(&f, m_historyPath.c_str(), L"wb");
-
-    if (err != 0 || f == 0)
-    {
-        STANDARD_ERROR(L"Could not save icon position information to the file:" << endl << m_historyPath << endl << endl << L"Check that you have write access to that location and that the file isn't in use.");
-        exit(1);
-    }
-
-    fputws(file.str().c_str(), f);
-    fclose(f);
-}
-
-void DesktopSaver::NamedProfileAdd(const wstring &name)
-{
-   IconHistory i = ReadDesktop();
-   i.SetProfileName(name);
-
-   m_namedProfiles.push_back(i);
-
-   // After changes, we should write our results out to disk.
-   serialize();
-}
-
-void DesktopSaver::NamedProfileOverwrite(const wstring &name)
-{
-   // Find the profile in question
-   MalleableHistoryIter i;
-   for (i = m_namedProfiles.begin(); i != m_namedProfiles.end(); ++i)
-   {
-      if (i->GetName() == name) break;
-   }
-   if (i == m_namedProfiles.end()) INTERNAL_ERROR(L"Couldn't find profile '" << name << L"' to overwrite.");
-
-   *i = ReadDesktop();
-   i->SetProfileName(name);
-
-   // After changes, we should write our results out to disk.
-   serialize();
-}
-
-void DesktopSaver::NamedProfileDelete(const wstring &name)
-{
-   // Find the profile in question
-   MalleableHistoryIter i;
-   for (i = m_namedProfiles.begin(); i != m_namedProfiles.end(); ++i)
-   {
-      if (i->GetName() == name) break;
-   }
-   if (i == m_namedProfiles.end()) INTERNAL_ERROR(L"Couldn't find profile '" << name << "' to delete.");
-
-   m_namedProfiles.erase(i);
-
-   // After changes, we should write our results out to disk.
-   serialize();
-}
-
-void DesktopSaver::NamedProfileAutostart(const wstring &name)
-{
-   Registry r(Registry::CurrentUser, L"DesktopSaver", L"");
-
-   // Setting it to the same value is how you turn off auto-start
-   if (GetAutostartProfileName() == name) r.Delete(L"profile_autostart");
-   else r.Write(L"profile_autostart", name);
-}
-
-class Desktop
-{
-public:
-   Desktop() : listView(NULL), iconCount(0), explorer(NULL), remoteData(nullptr), remoteText(nullptr)
-   {
-      const HWND desktop = GetShellWindow();
-      if (desktop == NULL) return;
-
-      HWND desktopInner = FindWindowEx(desktop, NULL, L"SHELLDLL_DefView", NULL);
-
-      // From http://stackoverflow.com/a/9352551
-      // If a live wallpaper is used, the desktop is found under a WorkerW (with a SHELLDLL_DefView child) instead of Progman
-      if (desktopInner == NULL) EnumWindows(WorkerWithShellDefView, reinterpret_cast<LPARAM>(&desktopInner));
-      if (desktopInner == NULL) return;
-
-      listView = FindWindowEx(desktopInner, NULL, L"SysListView32", NULL);
-      if (listView == NULL) return;
-
-      iconCount = ListView_GetItemCount(listView);
-
-      DWORD explorer_id;
-      GetWindowThreadProcessId(listView, &explorer_id);
-
-      explorer = OpenProcess(PROCESS_VM_OPERATION | PROCESS_VM_READ | PROCESS_VM_WRITE | PROCESS_QUERY_INFORMATION, FALSE, explorer_id);
-      if (explorer == NULL) return;
-
-      // Allocate some shared memory for message passing
-      remoteData = VirtualAllocEx(explorer, NULL, max(sizeof(LVITEM), sizeof(POINT)), MEM_COMMIT, PAGE_READWRITE);
-      remoteText = static_cast<wchar_t*>(VirtualAllocEx(explorer, NULL, sizeof(wchar_t)*(MAX_PATH + 1), MEM_COMMIT, PAGE_READWRITE));
-   }
-
-   ~Desktop()
-   {
-      if (remoteData) VirtualFreeEx(explorer, remoteData, 0, MEM_RELEASE);
-      if (remoteText) VirtualFreeEx(explorer, remoteText, 0, MEM_RELEASE);
-      if (explorer) CloseHandle(explorer);
-   }
-
-   bool Valid() const { return listView != NULL && explorer != NULL && remoteData != nullptr && remoteText != nullptr; }
-
-   int IconCount() const { return iconCount; }
-
-   POINT IconPosition(int i) const
-   {
-      if (i >= iconCount) return POINT{ 0, 0 };
-      if (ListView_GetItemPosition(listView, i, remoteData) != TRUE) return POINT{ 0, 0 };
-
-      POINT p;
-      ReadProcessMemory(explorer, remoteData, &p, sizeof(POINT), NULL);
-      return p;
-   }
-
-   void IconPosition(int i, long x, long y)
-   {
-      if (i >= iconCount) return;
-      ListView_SetItemPosition(listView, i, x, y);
-   }
-
-   wstring IconText(int i) const
-   {
-      if (i >= iconCount) return wstring();
-
-      // Win32 has you send a structure to be filled out by the GetItemText message
-      LVITEM item;
-      item.iSubItem = 0;
-      item.cchTextMax = MAX_PATH;
-      item.mask = LVIF_TEXT;
-      item.pszText = (LPTSTR)remoteText;
-
-      WriteProcessMemory(explorer, remoteData, &item, sizeof(LVITEM), NULL);
-      if (SendMessage(listView, LVM_GETITEMTEXT, i, (LPARAM)remoteData) < 0) return wstring();
-
-      // We only care about the text
-      wchar_t text[MAX_PATH + 1];
-      ReadProcessMemory(explorer, remoteText, &text, sizeof(text), NULL);
-      return text;
-   }
-
-private:
-
-   static BOOL CALLBACK WorkerWithShellDefView(HWND child, LPARAM lparam)
-   {
-      wchar_t name[64];
-      GetClassName(child, name, 64);
-      if (wcscmp(name, L"WorkerW") != 0) return TRUE;
-
-      HWND defView = FindWindowEx(child, NULL, L"SHELLDLL_DefView", NULL);
-      if (defView == NULL) return TRUE;
-
-      *reinterpret_cast<HWND*>(lparam) = defView;
-      return FALSE;
-   }
-
-   HWND listView;
-   int iconCount;
-   HANDLE explorer;
-
-   void *remoteData;
-   wchar_t *remoteText;
-};
-
-IconHistory DesktopSaver::ReadDesktop()
-{
-   Desktop d;
-   if (!d.Valid()) return IconHistory();
-
-   IconHistory snapshot;
-   for (int i = 0; i < d.IconCount(); ++i)
-   {
-      const POINT pos = d.IconPosition(i);
-      snapshot.AddIcon(Icon{ d.IconText(i), pos.x, pos.y });
-   }
-
-   return snapshot;
-}
-
-void DesktopSaver::PollDesktopIcons()
-{
-   auto &h = m_history;
-   if (GetPollRate() == DisableHistory) { h.clear(); return; }
-
-   IconHistory history = ReadDesktop();
-   if (h.size() > 0)
-   {
-      if (history.Identical(h.back())) return;
-
-      // If we have any previous history slices, we can generate a sort of diff'ed name for
-      // the slice, (otherwise it will just use the default history name "Initial History")
-      history.CalculateName(h.back());
-
-      // If this looks like anything we've seen before, no reason to clutter the list with a bunch of back-and-forth
-      h.erase(remove_if(h.begin(), h.end(), [&history](const IconHistory &me) { return me.Identical(history); }), h.end());
-   }
-
-   h.push_back(history);
-   while (h.size() > MaxIconHistoryCount) h.erase(h.begin());
-
-   serialize();
-}
-
-void DesktopSaver::RestoreHistory(const IconHistory history)
-{
-   IconHistory previous = ReadDesktop();
-
-   // Sometimes shimmying icons around bumps others into places they shouldn't be.  This
-   // happens when the new location is already occupied.  This is a little naive, but we
-   // just try to do it for a while until we reach a stable state.
-   for (int i = 0; i < 3; ++i)
-   {
-      RestoreHistoryOnce(history);
-
-      const IconHistory current = ReadDesktop();
-      if (current.Identical(previous)) return;
-
-      previous = current;
-   }
-
-   // Force a poll just afterwards to log the new history
-   PollDesktopIcons();
-}
-
-void DesktopSaver::RestoreHistoryOnce(const IconHistory &history)
-{
-   Desktop d;
-   if (!d.Valid()) return;
-
-   const auto icons = history.GetIcons();
-   for (int i = 0; i < d.IconCount(); ++i)
-   {
-      const wstring name = d.IconText(i);
-      for (const auto &j : icons) if (j.name == name) d.IconPosition(i, j.x, j.y);
-   }
-}
-
-void DesktopSaver::ClearHistory()
-{
-    m_history.clear();
-
-   // As an added security measure, we should write
-   // the history file out immediately to erase any
-   // remaining "evidence"
-   serialize();
-
-   // Force a poll just afterwards to log the new history
-   PollDesktopIcons();
-}
-
-bool DesktopSaver::GetRunOnStartup() const
-{
-   Registry r(Registry::CU_Run, L"");
-
-   static const wstring Sentinel(L"__no_result_found");
-   return r.Read(L"DesktopSaver", Sentinel) != Sentinel;
-}
-
-void DesktopSaver::SetRunOnStartup(bool run)
-{
-   Registry r(Registry::CU_Run, L"");
-   if (!run) { r.Delete(L"DesktopSaver"); return; }
-
-   // Strip whitespace off the ends of the command-line string
-   // HKCU/.../Run won't run a command that has a trailing space
-   // after it.
-   wstring command(GetCommandLine());
-   while (command.length() > 0 && isspace(command[0]))                  command = command.substr(1, command.length()-1);
-   while (command.length() > 0 && isspace(command[command.length()-1])) command = command.substr(0, command.length()-1);
-
-   r.Write(L"DesktopSaver", command);
-}
-
-PollRate DesktopSaver::read_poll_rate() const
-{
-   const int pollRate = Registry(Registry::CurrentUser, L"DesktopSaver").Read(L"poll_rate", (int)Interval2);
-   if (pollRate < 0 || pollRate >= PollRate_Max) return Interval2;
-
-   return static_cast<PollRate>(pollRate);
-}
-
-void DesktopSaver::SetPollRate(PollRate r)
-{
-   m_rate = r;
-   write_poll_rate();
-}  
-
-void DesktopSaver::write_poll_rate()
-{
-   Registry r(Registry::CurrentUser, L"DesktopSaver", L"");
-   r.Write(L"poll_rate", (int)m_rate);
-}
-
-unsigned int DesktopSaver::GetPollRateMilliseconds() const
-{
-   unsigned int timer_delay;
-
-   // Set the number of minutes based on the option chosen
-   PollRate p = GetPollRate();
-   switch (p)
-   {
-   case DisableHistory: timer_delay = 0;   break;
-   case PollEndpoints:  timer_delay = 0;   break;
-   case Interval1:      timer_delay = 5;   break;
-   case Interval2:      timer_delay = 20;  break;
-   case Interval3:      timer_delay = 60;  break;
-   case Interval4:      timer_delay = 360; break;
-
-   default:             timer_delay = 0;   break;
-   }
-
-   timer_delay *= 60;   // (seconds per minute)
-   timer_delay *= 1000; // (milliseconds per second)
-
-   return timer_delay;
-}
-
-wstring DesktopSaver::GetAutostartProfileName() const
-{
-   return Registry(Registry::CurrentUser, L"DesktopSaver").Read(L"profile_autostart", wstring());
-}
+// DesktopSaver, (c)2006-2016 Nicholas Piegdon, MIT licensed
+
+#include <windows.h>
+#include <commctrl.h>
+#include <shlobj.h>
+#include <exdisp.h>
+#include <shlwapi.h>
+#pragma comment(lib, "shlwapi.lib")
+
+#include "saver.h"
+#include "alloc_stats.h"
+#include "display_config.h"
+#include "history_file.h"
+#include "settings.h"
+
+#include <algorithm>
+#include <ctime>
+#include <mutex>
+#include <set>
+using namespace std;
+
+DesktopSaver::DesktopSaver() : m_historyVersion(0), m_profilesVersion(0), m_retention(DefaultHistoryBudgetKb * 1024), m_hasPending(false), m_pendingStale(false), m_pendingProbe(0), m_displayPending(false), m_displayPrevious(0), m_display(0), m_saveFailed(false)
+{
+   // Grab our polling rate from the settings
+   m_rate = read_poll_rate();
+   m_compact = Settings::Current().GetBool(Settings::CompactHistoryKey, false);
+   m_snapToGrid = Settings::Current().GetBool(Settings::SnapToGridKey, true);
+   m_displayRestore = Settings::Current().GetBool(Settings::DisplayRestoreKey, true);
+   m_partialRestore = Settings::Current().GetBool(Settings::PartialRestoreKey, true);
+
+   m_tolerance = Settings::Current().GetNumber(Settings::MoveToleranceKey, DefaultMoveTolerance);
+   if (m_tolerance < 0) m_tolerance = 0;
+
+   m_settleMs = Settings::Current().GetNumber(Settings::SettleTimeKey, DefaultSettleMilliseconds);
+   if (m_settleMs < 0) m_settleMs = 0;
+
+   const int budget = Settings::Current().GetNumber(Settings::HistoryBudgetKey, int(DefaultHistoryBudgetKb));
+   if (budget > 0) m_retention.SetBudget(size_t(budget) * 1024);
+
+   m_historyPath = HistoryPath();
+
+   // Load our previous icon history file
+   deserialize();
+
+   // Starting up on different monitors than we last saw counts as a
+   // display change, which the first poll takes care of
+   m_display = m_timeline.empty() ? 0 : m_timeline.back().GetDisplay();
+   if (m_display == 0) m_display = DisplayConfig::Fingerprint();
+   if (m_display == DisplayConfig::Fingerprint()) m_monitors = DisplayConfig::Current();
+
+   // Read the desktop immediately to either add the very first history
+   // slice to our list (on the very first run ever), or to compare to
+   // the last known positions of all the icons (on subsequent runs).
+   PollDesktopIcons();
+
+   const wstring autostart = GetAutostartProfileName();
+   if (autostart.empty()) { publish(); return; }
+
+   const IconHistory *profile = m_namedProfiles.Find(autostart);
+   if (profile) RestoreHistory(*profile);
+
+   publish();
+}
+
+void DesktopSaver::publish()
+{
+   auto view = make_shared<SaverView>();
+   view->history = m_history;
+   view->named_profiles = m_namedProfiles;
+   view->timeline = m_timeline;
+   view->rate = m_rate;
+   view->compact = m_compact;
+   view->snap_to_grid = m_snapToGrid;
+   view->display_restore = m_displayRestore;
+   view->settling = m_hasPending || m_displayPending;
+   view->settle = m_settleStats;
+   view->history_version = m_historyVersion;
+   view->profiles_version = m_profilesVersion;
+
+   for (uint64_t key : m_iconIndex.RecentlyMoved(MaxMovedIcons))
+   {
+      const SaverView::MovedIcon moved = { m_iconIndex.Name(key), key, *m_iconIndex.Find(key) };
+      view->moved_icons.push_back(moved);
+   }
+
+   atomic_store(&m_view, shared_ptr<const SaverView>(view));
+}
+
+// Set by UseHistoryPath
+static wstring &history_path_override()
+{
+   static wstring path;
+   return path;
+}
+
+void DesktopSaver::UseHistoryPath(const wstring &path)
+{
+   history_path_override() = path;
+}
+
+wstring DesktopSaver::HistoryPath()
+{
+   if (!history_path_override().empty()) return history_path_override();
+
+   // Set the location of the history file by starting with a default
+   wstring history_path = L"icon_history_2.txt";
+
+   // Add the shell folder path if we've got one
+   TCHAR sh_path[MAX_PATH];
+   HRESULT hr = SHGetFolderPath(0, CSIDL_APPDATA | CSIDL_FLAG_CREATE, 0, SHGFP_TYPE_CURRENT, sh_path);
+
+   if (SUCCEEDED(hr))
+   {
+      // Attempt to create the directory (in case it doesn't already exist
+      wstring path = wstring(sh_path) + L"\\DesktopSaver\\";
+      SHCreateDirectoryEx(0, path.c_str(), 0);
+
+      history_path = path + history_path;
+   }
+
+   return history_path;
+}
+
+bool DesktopSaver::LoadNamedProfile(const wstring &name, IconHistory &out)
+{
+   const wstring folded = ProfileStore::FoldName(name);
+   HistoryFileReader file(HistoryPath());
+
+   if (file.IsLegacy())
+   {
+      HistoryList slices;
+      file.ReadLegacy(slices);
+
+      for (const auto &h : slices)
+      {
+         if (!h.IsNamedProfile() || ProfileStore::FoldName(h.GetName()) != folded) continue;
+
+         out = h;
+         return true;
+      }
+      return false;
+   }
+
+   for (size_t i = 0; i < file.Count(); ++i)
+   {
+      if (file.HasFrameKinds() && !file.IsProfile(i)) continue;
+
+      IconHistory h;
+      if (!file.Read(i, h)) continue;
+      if (!h.IsNamedProfile() || ProfileStore::FoldName(h.GetName()) != folded) continue;
+
+      out = h;
+      return true;
+   }
+
+   return false;
+}
+
+bool DesktopSaver::LoadSliceAsOf(int64_t time, IconHistory &out)
+{
+   HistoryFileReader file(HistoryPath());
+
+   const size_t i = file.SliceAsOf(time);
+   return i != HistoryFileReader::npos && file.Read(i, out);
+}
+
+void DesktopSaver::deserialize()
+{
+   ALLOC_SCOPE(Deserialize);
+
+   // knock out our old history and named profile list
+   m_history = HistoryList();
+   m_namedProfiles.Clear();
+   m_timeline = Timeline();
+
+   HistoryFileReader file(m_historyPath);
+
+   HistoryList slices;
+   if (file.IsLegacy()) file.ReadLegacy(slices);
+
+   // Each framed slice is validated on its own, so a damaged
+   // one only costs us that slice (and any that shared its layout)
+   // instead of everything after it
+   size_t damaged = 0, orphaned = 0;
+   for (size_t i = 0; i < file.Count(); ++i)
+   {
+      IconHistory h;
+      bool missing_layout = false;
+      if (file.Read(i, h, &missing_layout)) slices.push_back(h);
+      else if (missing_layout) orphaned++;
+      else damaged++;
+   }
+
+   for (const auto &h : slices)
+   {
+      if (h.IsNamedProfile()) m_namedProfiles.Put(h);
+      else m_timeline.push_back(h);
+   }
+
+   m_retention.Reset(m_timeline, int64_t(time(nullptr)));
+   rebuild_history();
+
+   m_historyVersion++;
+   m_profilesVersion++;
+   rebuild_icon_index();
+   rebuild_display_layouts();
+
+   if (damaged > 0 || orphaned > 0)
+   {
+      wstring problem;
+      if (damaged > 0) problem += WSTRING(damaged << L" damaged entries in the history file were skipped.  ");
+      if (orphaned > 0) problem += WSTRING(orphaned << L" history entries were dropped because the entry holding their icon layout was damaged.  ");
+      ReportError(problem + L"Your remaining history and profiles were loaded normally.");
+   }
+}
+
+void DesktopSaver::serialize() const
+{
+   ALLOC_SCOPE(Serialize);
+
+   HistoryFileWriter file(m_historyPath, m_compact);
+
+   if (!file.Good())
+   {
+      // Everything is still here in memory, and the next change tries again
+      if (!m_saveFailed) ReportError(WSTRING(L"Could not save icon position information to the file:" << endl << m_historyPath << endl << endl
+         << L"Check that you have write access to that location and that the file isn't in use.  DesktopSaver will keep trying whenever something changes."));
+      m_saveFailed = true;
+      return;
+   }
+   m_saveFailed = false;
+
+   // The history list is just a view of the timeline, so it doesn't need saving
+   for (const auto &h : m_timeline) file.Write(h);
+   for (const auto &h : m_namedProfiles.All()) file.Write(h);
+   file.Finish();
+}
+
+void DesktopSaver::ReportError(const wstring &message) const
+{
+   if (m_errors) m_errors(message);
+   else STANDARD_ERROR(message);
+}
+
+void DesktopSaver::NamedProfileAdd(const wstring &name)
+{
+   IconHistory i = ReadDesktop();
+   i.SetProfileName(name);
+   i.SetTime(int64_t(time(nullptr)));
+   i.SetDisplay(DisplayConfig::Fingerprint());
+
+   m_namedProfiles.Put(i);
+   remember_display_layout(i);
+   m_profilesVersion++;
+
+   // After changes, we should write our results out to disk.
+   serialize();
+   publish();
+}
+
+void DesktopSaver::NamedProfileOverwrite(const wstring &name)
+{
+   if (!m_namedProfiles.Find(name)) { ReportError(L"Couldn't find profile '" + name + L"' to overwrite."); return; }
+
+   IconHistory i = ReadDesktop();
+   i.SetProfileName(name);
+   i.SetTime(int64_t(time(nullptr)));
+   i.SetDisplay(DisplayConfig::Fingerprint());
+
+   m_namedProfiles.Put(i);
+   remember_display_layout(i);
+   m_profilesVersion++;
+
+   // After changes, we should write our results out to disk.
+   serialize();
+   publish();
+}
+
+void DesktopSaver::NamedProfileDelete(const wstring &name)
+{
+   if (!m_namedProfiles.Remove(name)) { ReportError(L"Couldn't find profile '" + name + L"' to delete."); return; }
+   rebuild_display_layouts();
+   m_profilesVersion++;
+
+   // After changes, we should write our results out to disk.
+   serialize();
+   publish();
+}
+
+void DesktopSaver::NamedProfileAutostart(const wstring &name)
+{
+   // Setting it to the same value is how you turn off auto-start
+   if (GetAutostartProfileName() == name) Settings::Current().Remove(Settings::AutostartProfileKey);
+   else Settings::Current().SetText(Settings::AutostartProfileKey, name);
+}
+
+// Asking the shell for an icon's parsing name takes a few COM calls, so
+// the keys made from them are remembered from one read of the desktop to
+// the next, by list view index and name.  Anything that changes the icon
+// count (or a new list view, after Explorer restarts) starts over.  Icons
+// that share their name with another one are always asked about again,
+// since two of those could trade places without anything else changing.
+class IconKeyCache
+{
+public:
+   IconKeyCache() : m_listView(NULL), m_count(-1), m_changed(false), m_lookups(0), m_asked(0) { }
+
+   static IconKeyCache &Current() { static IconKeyCache cache; return cache; }
+
+   void Start(HWND listView, int count)
+   {
+      lock_guard<mutex> lock(m_mutex);
+      if (listView == m_listView && count == m_count) return;
+
+      m_listView = listView;
+      m_count = count;
+      m_entries.assign(size_t(max(count, 0)), Entry());
+      m_changed = true;
+   }
+
+   bool Find(int i, const wchar_t *text, size_t length, uint64_t &key)
+   {
+      lock_guard<mutex> lock(m_mutex);
+      m_lookups++;
+      if (i < 0 || size_t(i) >= m_entries.size()) return false;
+
+      const Entry &e = m_entries[i];
+      if (!e.valid || e.shared || e.name.length() != length || wmemcmp(e.name.data(), text, length) != 0) { m_asked++; return false; }
+
+      key = e.key;
+      return true;
+   }
+
+   void Store(int i, const wchar_t *text, size_t length, uint64_t key)
+   {
+      lock_guard<mutex> lock(m_mutex);
+      if (i < 0 || size_t(i) >= m_entries.size()) return;
+
+      Entry &e = m_entries[i];
+      if (e.valid && e.key == key && e.name.length() == length && wmemcmp(e.name.data(), text, length) == 0) return;
+
+      e.name.assign(text, length);
+      e.key = key;
+      e.valid = true;
+      m_changed = true;
+   }
+
+   // Once every icon has been seen, works out which names are shared
+   void Finish()
+   {
+      lock_guard<mutex> lock(m_mutex);
+      if (!m_changed) return;
+      m_changed = false;
+
+      m_order.clear();
+      for (size_t i = 0; i < m_entries.size(); ++i) if (m_entries[i].valid) m_order.push_back(i);
+      sort(m_order.begin(), m_order.end(), [this](size_t a, size_t b) { return m_entries[a].name < m_entries[b].name; });
+
+      for (auto &e : m_entries) e.shared = false;
+      for (size_t i = 1; i < m_order.size(); ++i)
+      {
+         Entry &a = m_entries[m_order[i - 1]];
+         Entry &b = m_entries[m_order[i]];
+         if (a.name == b.name) a.shared = b.shared = true;
+      }
+   }
+
+   // How many keys were looked up, and how many of those had to go to the shell
+   void Counts(unsigned long long &lookups, unsigned long long &asked)
+   {
+      lock_guard<mutex> lock(m_mutex);
+      lookups = m_lookups;
+      asked = m_asked;
+   }
+
+private:
+   // Explicitly deny copying and assignment
+   IconKeyCache(const IconKeyCache&);
+   IconKeyCache &operator=(const IconKeyCache&);
+
+   struct Entry
+   {
+      Entry() : key(0), valid(false), shared(false) { }
+
+      wstring name;
+      uint64_t key;
+      bool valid;
+      bool shared;
+   };
+
+   mutex m_mutex;
+   HWND m_listView;
+   int m_count;
+
+   vector<Entry> m_entries;
+   vector<size_t> m_order;
+   bool m_changed;
+
+   unsigned long long m_lookups;
+   unsigned long long m_asked;
+};
+
+class Desktop
+{
+public:
+   Desktop() : listView(NULL), iconCount(0), explorer(NULL), remoteData(nullptr), remoteText(nullptr), folderView(nullptr), folder(nullptr), com(false), shellTried(false)
+   {
+      const HWND desktop = GetShellWindow();
+      if (desktop == NULL) return;
+
+      HWND desktopInner = FindWindowEx(desktop, NULL, L"SHELLDLL_DefView", NULL);
+
+      // From http://stackoverflow.com/a/9352551
+      // If a live wallpaper is used, the desktop is found under a WorkerW (with a SHELLDLL_DefView child) instead of Progman
+      if (desktopInner == NULL) EnumWindows(WorkerWithShellDefView, reinterpret_cast<LPARAM>(&desktopInner));
+      if (desktopInner == NULL) return;
+
+      listView = FindWindowEx(desktopInner, NULL, L"SysListView32", NULL);
+      if (listView == NULL) return;
+
+      iconCount = ListView_GetItemCount(listView);
+      IconKeyCache::Current().Start(listView, iconCount);
+
+      DWORD explorer_id;
+      GetWindowThreadProcessId(listView, &explorer_id);
+
+      explorer = OpenProcess(PROCESS_VM_OPERATION | PROCESS_VM_READ | PROCESS_VM_WRITE | PROCESS_QUERY_INFORMATION, FALSE, explorer_id);
+      if (explorer == NULL) return;
+
+      // Allocate some shared memory for message passing
+      remoteData = VirtualAllocEx(explorer, NULL, max(sizeof(LVITEM), sizeof(POINT)), MEM_COMMIT, PAGE_READWRITE);
+      remoteText = static_cast<wchar_t*>(VirtualAllocEx(explorer, NULL, sizeof(wchar_t)*(MAX_PATH + 1), MEM_COMMIT, PAGE_READWRITE));
+   }
+
+   ~Desktop()
+   {
+      if (listView != NULL) IconKeyCache::Current().Finish();
+
+      if (folder) folder->Release();
+      if (folderView) folderView->Release();
+      if (com) CoUninitialize();
+
+      if (remoteData) VirtualFreeEx(explorer, remoteData, 0, MEM_RELEASE);
+      if (remoteText) VirtualFreeEx(explorer, remoteText, 0, MEM_RELEASE);
+      if (explorer) CloseHandle(explorer);
+   }
+
+   bool Valid() const { return listView != NULL && explorer != NULL && remoteData != nullptr && remoteText != nullptr; }
+
+   int IconCount() const { return iconCount; }
+
+   POINT IconPosition(int i) const
+   {
+      if (i >= iconCount) return POINT{ 0, 0 };
+      if (ListView_GetItemPosition(listView, i, remoteData) != TRUE) return POINT{ 0, 0 };
+
+      POINT p;
+      ReadProcessMemory(explorer, remoteData, &p, sizeof(POINT), NULL);
+      return p;
+   }
+
+   void IconPosition(int i, long x, long y)
+   {
+      if (i >= iconCount) return;
+      ListView_SetItemPosition(listView, i, x, y);
+   }
+
+   // The size of a desktop grid cell, if Explorer is keeping the icons
+   // aligned to one
+   bool GridSpacing(int &x, int &y) const
+   {
+      if (listView == NULL) return false;
+      if ((ListView_GetExtendedListViewStyle(listView) & LVS_EX_SNAPTOGRID) == 0) return false;
+
+      const DWORD spacing = ListView_GetItemSpacing(listView, FALSE);
+      x = LOWORD(spacing);
+      y = HIWORD(spacing);
+      return x > 0 && y > 0;
+   }
+
+   // Fills 'text' (which must hold MAX_PATH + 1 characters) with
+   // the icon's name and returns its length
+   size_t IconText(int i, wchar_t *text) const
+   {
+      text[0] = 0;
+      if (i >= iconCount) return 0;
+
+      // Win32 has you send a structure to be filled out by the GetItemText message
+      LVITEM item;
+      item.iSubItem = 0;
+      item.cchTextMax = MAX_PATH;
+      item.mask = LVIF_TEXT;
+      item.pszText = (LPTSTR)remoteText;
+
+      WriteProcessMemory(explorer, remoteData, &item, sizeof(LVITEM), NULL);
+      if (SendMessage(listView, LVM_GETITEMTEXT, i, (LPARAM)remoteData) < 0) return 0;
+
+      // We only care about the text
+      ReadProcessMemory(explorer, remoteText, text, sizeof(wchar_t) * (MAX_PATH + 1), NULL);
+      text[MAX_PATH] = 0;
+      return wcslen(text);
+   }
+
+   // Every icon's position, hashed, without reading any names
+   uint64_t Probe() const
+   {
+      Fnv64 hash;
+      hash.AddUnit(uint32_t(iconCount) & 0xFFFF);
+      hash.AddUnit(uint32_t(iconCount) >> 16);
+
+      for (int i = 0; i < iconCount; ++i)
+      {
+         const POINT p = IconPosition(i);
+         hash.AddUnit(uint32_t(p.x) & 0xFFFF);
+         hash.AddUnit(uint32_t(p.x) >> 16);
+         hash.AddUnit(uint32_t(p.y) & 0xFFFF);
+         hash.AddUnit(uint32_t(p.y) >> 16);
+      }
+
+      return hash.Value();
+   }
+
+   // The key for the icon whose name (from IconText) is 'text': from its
+   // parsing name if the shell will tell us, otherwise from its name.
+   // Usually it's remembered from last time (see IconKeyCache).
+   uint64_t IconKey(int i, const wchar_t *text, size_t length)
+   {
+      uint64_t key = 0;
+      if (IconKeyCache::Current().Find(i, text, length, key)) return key;
+
+      key = shell_key(i, text, length);
+      IconKeyCache::Current().Store(i, text, length, key);
+      return key;
+   }
+
+private:
+   // Null if the shell won't say.  It's freed with CoTaskMemFree, which
+   // (unlike a wstring) doesn't count against a poll's allocations.
+   static wchar_t *display_name(IShellFolder *folder, PITEMID_CHILD child, SHGDNF flags)
+   {
+      STRRET name;
+      wchar_t *text = nullptr;
+      if (FAILED(folder->GetDisplayNameOf(child, flags, &name)) || FAILED(StrRetToStrW(&name, child, &text))) return nullptr;
+      return text;
+   }
+
+   uint64_t shell_key(int i, const wchar_t *text, size_t length)
+   {
+      const uint64_t fallback = MakeIconKey(text, length);
+
+      if (!shellTried) open_shell_view();
+      if (!folder || i >= iconCount) return fallback;
+
+      PITEMID_CHILD child = nullptr;
+      if (FAILED(folderView->Item(i, &child))) return fallback;
+
+      // The shell's items are supposed to be in the list view's order, but
+      // if this one isn't the icon we're asking about, the parsing name
+      // would belong to some other icon
+      uint64_t key = fallback;
+      wchar_t *shown = display_name(folder, child, SHGDN_NORMAL);
+      if (shown && wcslen(shown) == length && wmemcmp(shown, text, length) == 0)
+      {
+         wchar_t *parsing = display_name(folder, child, SHGDN_FORPARSING);
+         if (parsing && *parsing) key = MakeIconKey(parsing, wcslen(parsing));
+         CoTaskMemFree(parsing);
+      }
+
+      CoTaskMemFree(shown);
+      CoTaskMemFree(child);
+      return key;
+   }
+
+   // The shell's own view of the same icons, which can tell us each one's
+   // parsing name.  Without it (or if it doesn't agree with the list view)
+   // icons are only known by their names.
+   void open_shell_view()
+   {
+      shellTried = true;
+      com = SUCCEEDED(CoInitializeEx(NULL, COINIT_APARTMENTTHREADED));
+
+      folderView = DesktopFolderView();
+      int viewCount = 0;
+      if (folderView && (FAILED(folderView->ItemCount(SVGIO_ALLVIEW, &viewCount)) || viewCount != iconCount || FAILED(folderView->GetFolder(IID_PPV_ARGS(&folder))))) folder = nullptr;
+   }
+
+   // From https://blogs.msdn.microsoft.com/oldnewthing/20130318-00/?p=4933
+   static IFolderView *DesktopFolderView()
+   {
+      IShellWindows *windows = nullptr;
+      if (FAILED(CoCreateInstance(CLSID_ShellWindows, NULL, CLSCTX_ALL, IID_PPV_ARGS(&windows)))) return nullptr;
+
+      VARIANT location, root;
+      VariantInit(&location);
+      VariantInit(&root);
+      location.vt = VT_I4;
+      location.lVal = CSIDL_DESKTOP;
+
+      long hwnd = 0;
+      IDispatch *dispatch = nullptr;
+      const HRESULT found = windows->FindWindowSW(&location, &root, SWC_DESKTOP, &hwnd, SWFO_NEEDDISPATCH, &dispatch);
+      windows->Release();
+      if (found != S_OK || !dispatch) return nullptr;
+
+      IServiceProvider *services = nullptr;
+      IShellBrowser *browser = nullptr;
+      IShellView *view = nullptr;
+      IFolderView *result = nullptr;
+
+      if (SUCCEEDED(dispatch->QueryInterface(IID_PPV_ARGS(&services))))
+      {
+         if (SUCCEEDED(services->QueryService(SID_STopLevelBrowser, IID_PPV_ARGS(&browser))))
+         {
+            if (SUCCEEDED(browser->QueryActiveShellView(&view)))
+            {
+               if (FAILED(view->QueryInterface(IID_PPV_ARGS(&result)))) result = nullptr;
+               view->Release();
+            }
+            browser->Release();
+         }
+         services->Release();
+      }
+
+      dispatch->Release();
+      return result;
+   }
+
+   static BOOL CALLBACK WorkerWithShellDefView(HWND child, LPARAM lparam)
+   {
+      wchar_t name[64];
+      GetClassName(child, name, 64);
+      if (wcscmp(name, L"WorkerW") != 0) return TRUE;
+
+      HWND defView = FindWindowEx(child, NULL, L"SHELLDLL_DefView", NULL);
+      if (defView == NULL) return TRUE;
+
+      *reinterpret_cast<HWND*>(lparam) = defView;
+      return FALSE;
+   }
+
+   HWND listView;
+   int iconCount;
+   HANDLE explorer;
+
+   void *remoteData;
+   wchar_t *remoteText;
+
+   IFolderView *folderView;
+   IShellFolder *folder;
+   bool com;
+   bool shellTried;
+};
+
+IconHistory DesktopSaver::ReadDesktop()
+{
+   SnapshotBuilder snapshot;
+   ReadDesktop(snapshot);
+
+   IconHistory history;
+   snapshot.CompactInto(history);
+   return history;
+}
+
+void DesktopSaver::ReadDesktop(SnapshotBuilder &snapshot, int snap_tolerance)
+{
+   ALLOC_SCOPE(ReadDesktop);
+
+   snapshot.Reset();
+
+   Desktop d;
+   if (!d.Valid()) return;
+
+   wchar_t text[MAX_PATH + 1];
+   for (int i = 0; i < d.IconCount(); ++i)
+   {
+      const POINT pos = d.IconPosition(i);
+      const size_t length = d.IconText(i, text);
+      snapshot.AddIcon(text, length, d.IconKey(i, text, length), pos.x, pos.y);
+   }
+   snapshot.Finish();
+
+   int spacing_x = 0, spacing_y = 0;
+   if (snap_tolerance > 0 && d.GridSpacing(spacing_x, spacing_y)) snapshot.SnapToGrid(spacing_x, spacing_y, snap_tolerance);
+}
+
+uint64_t DesktopSaver::ProbeDesktop()
+{
+   Desktop d;
+   return d.Valid() ? d.Probe() : 0;
+}
+
+void DesktopSaver::PollDesktopIcons(bool settle)
+{
+   ALLOC_SCOPE(PollDesktopIcons);
+
+   // Explorer rearranges everything when the monitors change, which
+   // isn't worth recording if there's a better layout to put back
+   if (DisplayChanged()) return;
+
+   auto &h = m_history;
+   if (GetPollRate() == DisableHistory)
+   {
+      m_hasPending = false;
+      if (h.empty() && m_timeline.empty()) return;
+
+      h.clear();
+      m_timeline.clear();
+      m_retention.Reset(m_timeline, 0);
+      m_iconIndex.Clear();
+      rebuild_display_layouts();
+      m_historyVersion++;
+      publish();
+      return;
+   }
+
+   // Most polls find nothing has changed, so we compare against the
+   // last slice before building a real IconHistory out of it.  Icons
+   // that have only jittered by a pixel or two (auto-arrange, a DPI
+   // change) are put back where they were first, so that doesn't count.
+   ReadDesktop(m_scratch, m_snapToGrid ? m_tolerance : 0);
+   if (h.size() > 0) m_scratch.Settle(h.back(), m_tolerance);
+   if (h.size() > 0 && m_scratch.Matches(h.back()))
+   {
+      // Whatever was being held ended up going nowhere
+      if (!m_hasPending) return;
+
+      m_hasPending = false;
+      m_settleStats.superseded++;
+      publish();
+      return;
+   }
+
+   // Still waiting on this same layout
+   if (settle && m_hasPending && m_scratch.Matches(m_pending)) return;
+
+   IconHistory history;
+   m_scratch.CompactInto(history);
+
+   if (m_hasPending) m_settleStats.superseded++;
+   m_hasPending = false;
+
+   if (!settle || m_settleMs == 0)
+   {
+      commit(history);
+      return;
+   }
+
+   // Dragging icons around (or Explorer reflowing them) changes the
+   // desktop several times in a row, so wait to see where it ends up
+   m_hasPending = true;
+   m_pendingStale = false;
+   m_pending = history;
+   m_pendingProbe = ProbeDesktop();
+   m_pendingSince = chrono::steady_clock::now();
+   m_settleStats.held++;
+   publish();
+}
+
+bool DesktopSaver::SettlePending()
+{
+   if (!m_hasPending && !m_displayPending) return false;
+
+   DisplayChanged();
+   if (!m_hasPending && !m_displayPending) return false;
+
+   m_settleStats.probes++;
+   const uint64_t probe = ProbeDesktop();
+   const auto now = chrono::steady_clock::now();
+
+   if (probe != m_pendingProbe)
+   {
+      // Still moving, so the wait starts over
+      m_pendingProbe = probe;
+      m_pendingSince = now;
+      m_pendingStale = true;
+      return true;
+   }
+
+   if (now - m_pendingSince < chrono::milliseconds(m_settleMs)) return true;
+
+   // Explorer is done rearranging things for the new monitors
+   if (m_displayPending)
+   {
+      restore_display(nullptr);
+      return false;
+   }
+
+   // It settled somewhere other than the layout we're holding, so
+   // that one is replaced by wherever the icons are now
+   if (m_pendingStale)
+   {
+      PollDesktopIcons(false);
+      publish();
+      return false;
+   }
+
+   m_hasPending = false;
+   commit(m_pending);
+   return false;
+}
+
+void DesktopSaver::commit(IconHistory history)
+{
+   auto &h = m_history;
+
+   // The clock can be set backward, but the timeline has to stay in order
+   int64_t now = int64_t(time(nullptr));
+   if (!m_timeline.empty() && now < m_timeline.back().GetTime()) now = m_timeline.back().GetTime();
+   history.SetTime(now);
+   history.SetDisplay(m_display);
+
+   // Everything that changed since the last slice (for the very first
+   // slice, that's every icon appearing)
+   const IconDiff diff(h.empty() ? IconHistory() : h.back(), history);
+
+   if (h.size() > 0)
+   {
+      // If we have any previous history slices, we can generate a sort of diff'ed name for
+      // the slice, (otherwise it will just use the default history name "Initial History")
+      history.CalculateName(diff);
+
+      // If this looks like anything we've seen before, no reason to clutter the list with a bunch of back-and-forth.
+      // The most common case is something being put right back where it was, which the diff between the last two
+      // slices spots without comparing anything.  (The history never holds two identical slices, so there can
+      // only ever be one match.)
+      if (h.size() >= 2 && diff.Undoes(m_lastDiff)) h.erase(h.end() - 2);
+      else h.erase(remove_if(h.begin(), h.end(), [&history](const IconHistory &me) { return me.Identical(history); }), h.end());
+
+      m_lastDiff = diff;
+   }
+
+   h.push_back(history);
+   while (h.size() > MaxIconHistoryCount) h.erase(h.begin());
+
+   // Unlike the history list, the timeline keeps every change in order
+   // (thinning out the older ones to stay within its budget)
+   m_timeline.push_back(history);
+   m_retention.Appended(m_timeline, now);
+
+   m_iconIndex.Append(history.GetTime(), diff);
+   m_iconIndex.SetHorizon(m_timeline.front().GetTime());
+   remember_display_layout(history);
+   m_historyVersion++;
+   m_settleStats.commits++;
+
+   serialize();
+   publish();
+}
+
+void DesktopSaver::rebuild_history()
+{
+   // The history list is the most recent distinct layouts on the timeline
+   // (each at its latest appearance), which is exactly what polling builds
+   m_history.clear();
+
+   set<const Snapshot*> seen;
+   for (auto i = m_timeline.rbegin(); i != m_timeline.rend() && m_history.size() < MaxIconHistoryCount; ++i)
+   {
+      if (seen.insert(i->GetSnapshot().get()).second) m_history.push_back(*i);
+   }
+   reverse(m_history.begin(), m_history.end());
+
+   const size_t count = m_history.size();
+   m_lastDiff = (count >= 2) ? IconDiff(m_history[count - 2], m_history[count - 1]) : IconDiff();
+}
+
+void DesktopSaver::rebuild_icon_index()
+{
+   m_iconIndex.Clear();
+
+   IconHistory previous;
+   for (const auto &h : m_timeline)
+   {
+      m_iconIndex.Append(h.GetTime(), IconDiff(previous, h));
+      previous = h;
+   }
+}
+
+void DesktopSaver::remember_display_layout(const IconHistory &h)
+{
+   if (h.GetDisplay() == 0) return;
+
+   const auto inserted = m_displayLayouts.insert(make_pair(h.GetDisplay(), h));
+   if (!inserted.second && h.GetTime() >= inserted.first->second.GetTime()) inserted.first->second = h;
+}
+
+void DesktopSaver::rebuild_display_layouts()
+{
+   m_displayLayouts.clear();
+   for (const auto &h : m_timeline) remember_display_layout(h);
+   for (const auto &p : m_namedProfiles.All()) remember_display_layout(p);
+}
+
+const IconHistory *DesktopSaver::LayoutForDisplay(uint64_t display) const
+{
+   const auto found = m_displayLayouts.find(display);
+   return found == m_displayLayouts.end() ? nullptr : &found->second;
+}
+
+bool DesktopSaver::DisplayChanged(RestoreJob *job)
+{
+   const uint64_t display = DisplayConfig::Fingerprint();
+   if (display == m_display) return m_displayPending;
+
+   // When the monitors change a few times in a row, the last slice was
+   // still read on the ones from before the first change
+   if (!m_displayPending)
+   {
+      m_displayPrevious = m_display;
+      swap(m_displayWas, m_monitors);
+   }
+
+   m_display = display;
+   m_monitors = DisplayConfig::Current();
+
+   if (m_hasPending)
+   {
+      m_hasPending = false;
+      m_settleStats.superseded++;
+      publish();
+   }
+
+   m_displayPending = m_displayRestore && LayoutForDisplay(display) != nullptr;
+   if (!m_displayPending)
+   {
+      publish();
+      return false;
+   }
+
+   if (m_settleMs == 0) return restore_display(job);
+
+   // Explorer takes a moment to move everything onto the new monitors,
+   // and anything restored before it's done would just be moved again
+   m_pendingProbe = ProbeDesktop();
+   m_pendingSince = chrono::steady_clock::now();
+   publish();
+   return true;
+}
+
+bool DesktopSaver::restore_display(RestoreJob *job)
+{
+   m_displayPending = false;
+
+   const IconHistory *layout = LayoutForDisplay(m_display);
+   if (!layout)
+   {
+      publish();
+      return false;
+   }
+
+   // Where everything was just before the change is only known if the
+   // last slice was read on the old monitors
+   const bool partial = m_partialRestore && !m_displayWas.rects.empty() && !m_history.empty() && m_history.back().GetDisplay() == m_displayPrevious;
+   if (partial)
+   {
+      IconHistory current;
+      ReadDesktop(m_scratch);
+      m_scratch.CompactInto(current);
+
+      size_t saved = 0;
+      const IconHistory affected = affected_icons(m_history.back(), m_displayWas, current, *layout, m_monitors, saved);
+      m_settleStats.display_moves_saved += saved;
+
+      RestoreHistory(affected, job);
+   }
+
+   else
+   {
+      // RestoreHistory takes its own copy, since restoring can change the index
+      RestoreHistory(*layout, job);
+   }
+
+   m_settleStats.display_restores++;
+   publish();
+   return true;
+}
+
+// Finds the icon in 'range' (sorted by name and then key) that matches
+// 'icon', leaving its index in 'at'.  The search starts at 'i', which is
+// left past it for the next one.
+static bool find_sorted(const IconRange &range, size_t &i, const IconRef &icon, size_t &at)
+{
+   while (i < range.size() && (range[i].name < icon.name || (range[i].name == icon.name && range[i].key < icon.key))) ++i;
+   if (i >= range.size() || range[i].key != icon.key || range[i].name != icon.name) return false;
+
+   at = i++;
+   return true;
+}
+
+IconHistory DesktopSaver::affected_icons(const IconHistory &before, const DisplayConfig::Monitors &was, const IconHistory &current, const IconHistory &target, const DisplayConfig::Monitors &now, size_t &saved)
+{
+   saved = 0;
+
+   // The monitors that are exactly where they were before
+   vector<bool> was_kept(was.rects.size(), false);
+   vector<bool> now_kept(now.rects.size(), false);
+   for (size_t i = 0; i < was.rects.size(); ++i)
+   {
+      for (size_t j = 0; j < now.rects.size(); ++j)
+      {
+         if (!(was.rects[i] == now.rects[j])) continue;
+         was_kept[i] = now_kept[j] = true;
+      }
+   }
+
+   // All three are sorted by name and then key, so this is one merge pass
+   SnapshotBuilder subset;
+   const IconRange from = before.GetIcons();
+   const IconRange here = current.GetIcons();
+   size_t i = 0, j = 0;
+   for (const IconRef icon : target.GetIcons())
+   {
+      size_t old = 0, moved_to = 0;
+      const bool known = find_sorted(from, i, icon, old);
+      const bool present = find_sorted(here, j, icon, moved_to);
+
+      const int was_on = known ? was.Find(from[old].x, from[old].y) : -1;
+      const int now_on = now.Find(icon.x, icon.y);
+
+      // An icon on a monitor that didn't change, which Explorer didn't
+      // touch either.  Restoring everything would have moved it if it
+      // isn't where the layout has it.
+      const bool kept = was_on >= 0 && was_kept[was_on] && now_on >= 0 && now_kept[now_on];
+      if (kept && present && here[moved_to].x == from[old].x && here[moved_to].y == from[old].y)
+      {
+         if (here[moved_to].x != icon.x || here[moved_to].y != icon.y) saved++;
+         continue;
+      }
+
+      subset.AddIcon(icon.name, icon.key, icon.x, icon.y);
+   }
+   subset.Finish();
+
+   IconHistory affected;
+   subset.CompactInto(affected);
+   return affected;
+}
+
+void DesktopSaver::SetDisplayRestore(bool restore)
+{
+   m_displayRestore = restore;
+
+   Settings::Current().SetBool(Settings::DisplayRestoreKey, m_displayRestore);
+   publish();
+}
+
+const IconHistory *DesktopSaver::LayoutAsOf(int64_t time) const
+{
+   // Capture times never go backward along the timeline
+   const auto after = upper_bound(m_timeline.begin(), m_timeline.end(), time, [](int64_t t, const IconHistory &h) { return t < h.GetTime(); });
+   if (after == m_timeline.begin()) return nullptr;
+
+   return &*(after - 1);
+}
+
+bool DesktopSaver::RestoreAsOf(int64_t time, RestoreJob *job)
+{
+   const IconHistory *h = LayoutAsOf(time);
+   if (!h) return false;
+
+   RestoreHistory(*h, job);
+   return true;
+}
+
+vector<DesktopSaver::LayoutMatch> DesktopSaver::RankLayouts(size_t count) const
+{
+   const IconHistory current = ReadDesktop();
+   const Snapshot *now = current.GetSnapshot().get();
+   if (!now) return vector<LayoutMatch>();
+
+   // Every distinct layout once: named profiles first, then the
+   // newest slice of each layout on the timeline
+   vector<const IconHistory*> candidates;
+   set<const Snapshot*> seen;
+   seen.insert(now);
+
+   for (const auto &h : m_namedProfiles.All()) if (h.GetSnapshot() && seen.insert(h.GetSnapshot().get()).second) candidates.push_back(&h);
+   for (auto i = m_timeline.rbegin(); i != m_timeline.rend(); ++i) if (i->GetSnapshot() && seen.insert(i->GetSnapshot().get()).second) candidates.push_back(&*i);
+
+   vector<pair<LayoutDistance, const IconHistory*>> estimates;
+   estimates.reserve(candidates.size());
+   for (const IconHistory *h : candidates) estimates.push_back(make_pair(LayoutSketch::Estimate(now->sketch, h->GetSnapshot()->sketch), h));
+
+   // The sketches are only estimates, so a few more than were asked
+   // for get the full comparison
+   const size_t shortlist = min(estimates.size(), max<size_t>(count * 4, 16));
+   partial_sort(estimates.begin(), estimates.begin() + shortlist, estimates.end(), [](const pair<LayoutDistance, const IconHistory*> &a, const pair<LayoutDistance, const IconHistory*> &b) { return a.first < b.first; });
+
+   vector<LayoutMatch> matches;
+   for (size_t i = 0; i < shortlist; ++i)
+   {
+      const IconHistory &h = *estimates[i].second;
+
+      const LayoutDistance d = LayoutDistance::Between(*now, *h.GetSnapshot());
+      if (d.Empty()) continue;
+
+      matches.push_back(LayoutMatch{ h, d });
+   }
+
+   stable_sort(matches.begin(), matches.end(), [](const LayoutMatch &a, const LayoutMatch &b) { return a.distance < b.distance; });
+   if (matches.size() > count) matches.erase(matches.begin() + count, matches.end());
+   return matches;
+}
+
+bool DesktopSaver::RestoreClosest(RestoreJob *job)
+{
+   const vector<LayoutMatch> closest = RankLayouts(1);
+   if (closest.empty()) return false;
+
+   RestoreHistory(closest.front().layout, job);
+   return true;
+}
+
+void DesktopSaver::RestoreHistory(const IconHistory history, RestoreJob *job)
+{
+   ALLOC_SCOPE(RestoreHistory);
+
+   if (job) job->Start();
+   const bool completed = restore(history, job);
+   if (job) job->Finish(!completed);
+}
+
+bool DesktopSaver::restore(const IconHistory &history, RestoreJob *job)
+{
+   const RestoreOutcome outcome = ApplyLayout(history, m_scratch, job);
+
+   // Force a poll just afterwards to log the new history (including
+   // whatever was moved before a cancellation)
+   if (outcome != RestoreSettled) PollDesktopIcons();
+
+   return outcome != RestoreCancelled;
+}
+
+DesktopSaver::RestoreOutcome DesktopSaver::ApplyLayout(const IconHistory &history, SnapshotBuilder &scratch, RestoreJob *job)
+{
+   IconHistory previous;
+   ReadDesktop(scratch);
+   scratch.CompactInto(previous);
+
+   // Sometimes shimmying icons around bumps others into places they shouldn't be.  This
+   // happens when the new location is already occupied.  This is a little naive, but we
+   // just try to do it for a while until we reach a stable state.
+   for (int i = 0; i < 3; ++i)
+   {
+      if (job && job->CancelRequested()) return RestoreCancelled;
+
+      // Only the icons that are out of place need to be touched
+      const IconDiff plan(previous, history);
+      if (plan.Moved().empty()) return RestoreSettled;
+
+      if (job) job->StartPass(i + 1, plan.Moved().size());
+      if (!RestoreHistoryOnce(plan, job)) return RestoreCancelled;
+
+      ReadDesktop(scratch);
+      if (scratch.Matches(previous)) return RestoreSettled;
+
+      scratch.CompactInto(previous);
+   }
+
+   return RestoreUnsettled;
+}
+
+void DesktopSaver::RestoreIcons(const IconHistory &history, const vector<wstring> &names, RestoreJob *job)
+{
+   // A layout holding only the chosen icons.  Restoring it can't touch any
+   // of the others, because only icons in both layouts are ever moved.
+   SnapshotBuilder subset;
+   const IconRange icons = history.GetIcons();
+   for (const auto &name : names)
+   {
+      // Every icon by that name
+      for (size_t i = history.Find(name); i < icons.size() && icons[i].name == name; ++i)
+      {
+         const IconRef icon = icons[i];
+         subset.AddIcon(name, icon.key, icon.x, icon.y);
+      }
+   }
+   subset.Finish();
+
+   IconHistory target;
+   subset.CompactInto(target);
+   RestoreHistory(target, job);
+}
+
+void DesktopSaver::RestoreIcon(const wstring &name, uint64_t key, long x, long y, RestoreJob *job)
+{
+   // By key, so only this icon moves even if others share its name
+   SnapshotBuilder subset;
+   subset.AddIcon(name, key, x, y);
+   subset.Finish();
+
+   IconHistory target;
+   subset.CompactInto(target);
+   RestoreHistory(target, job);
+}
+
+bool DesktopSaver::RestoreHistoryOnce(const IconDiff &plan, RestoreJob *job)
+{
+   Desktop d;
+   if (!d.Valid()) return true;
+
+   size_t moved = 0;
+   wchar_t text[MAX_PATH + 1];
+   for (int i = 0; i < d.IconCount(); ++i)
+   {
+      // Progress and cancellation are only checked between batches
+      if (job && i > 0 && i % RestoreBatchSize == 0)
+      {
+         job->Moved(moved);
+         if (job->CancelRequested()) return false;
+      }
+
+      const size_t length = d.IconText(i, text);
+      const IconDiff::Change *move = plan.FindMoved(d.IconKey(i, text, length));
+      if (!move) continue;
+
+      d.IconPosition(i, move->to_x, move->to_y);
+      moved++;
+   }
+
+   if (job) job->Moved(moved);
+   return true;
+}
+
+void DesktopSaver::ClearHistory()
+{
+    m_history.clear();
+    m_timeline.clear();
+    m_retention.Reset(m_timeline, 0);
+    m_iconIndex.Clear();
+    rebuild_display_layouts();
+    m_historyVersion++;
+
+   // As an added security measure, we should write
+   // the history file out immediately to erase any
+   // remaining "evidence"
+   serialize();
+   publish();
+
+   // Force a poll just afterwards to log the new history
+   PollDesktopIcons();
+}
+
+bool DesktopSaver::GetRunOnStartup()
+{
+   return Settings::Current().Has(Settings::RunOnStartupKey);
+}
+
+void DesktopSaver::SetRunOnStartup(bool run)
+{
+   if (!run) { Settings::Current().Remove(Settings::RunOnStartupKey); return; }
+
+   // Strip whitespace off the ends of the command-line string
+   // HKCU/.../Run won't run a command that has a trailing space
+   // after it.
+   wstring command(GetCommandLine());
+   while (command.length() > 0 && isspace(command[0]))                  command = command.substr(1, command.length()-1);
+   while (command.length() > 0 && isspace(command[command.length()-1])) command = command.substr(0, command.length()-1);
+
+   Settings::Current().SetText(Settings::RunOnStartupKey, command);
+}
+
+PollRate DesktopSaver::read_poll_rate() const
+{
+   const int pollRate = Settings::Current().GetNumber(Settings::PollRateKey, (int)Interval2);
+   if (pollRate < 0 || pollRate >= PollRate_Max) return Interval2;
+
+   return static_cast<PollRate>(pollRate);
+}
+
+void DesktopSaver::SetPollRate(PollRate r)
+{
+   m_rate = r;
+   write_poll_rate();
+   publish();
+}  
+
+void DesktopSaver::SetSnapToGrid(bool snap)
+{
+   m_snapToGrid = snap;
+
+   Settings::Current().SetBool(Settings::SnapToGridKey, m_snapToGrid);
+   publish();
+}
+
+void DesktopSaver::SetCompactHistory(bool compact)
+{
+   m_compact = compact;
+
+   Settings::Current().SetBool(Settings::CompactHistoryKey, m_compact);
+
+   // Rewrite the file in the new format right away
+   serialize();
+   publish();
+}
+
+void DesktopSaver::write_poll_rate()
+{
+   Settings::Current().SetNumber(Settings::PollRateKey, (int)m_rate);
+}
+
+unsigned int DesktopSaver::PollRateMilliseconds(PollRate p)
+{
+   unsigned int timer_delay;
+
+   // Set the number of minutes based on the option chosen
+   switch (p)
+   {
+   case DisableHistory: timer_delay = 0;   break;
+   case PollEndpoints:  timer_delay = 0;   break;
+   case Interval1:      timer_delay = 5;   break;
+   case Interval2:      timer_delay = 20;  break;
+   case Interval3:      timer_delay = 60;  break;
+   case Interval4:      timer_delay = 360; break;
+
+   default:             timer_delay = 0;   break;
+   }
+
+   timer_delay *= 60;   // (seconds per minute)
+   timer_delay *= 1000; // (milliseconds per second)
+
+   return timer_delay;
+}
+
+wstring DesktopSaver::GetAutostartProfileName()
+{
+   return Settings::Current().GetText(Settings::AutostartProfileKey, wstring());
+}
+
+static wstring icon_key_report()
+{
+   unsigned long long lookups = 0, asked = 0;
+   IconKeyCache::Current().Counts(lookups, asked);
+   return WSTRING(L"Icon keys: " << lookups << L" looked up, " << asked << L" asked of the shell");
+}
+
+static void split_command(const wstring &request, wstring &verb, wstring &argument)
+{
+   const size_t space = request.find(L' ');
+   verb = request.substr(0, space);
+   argument = (space == wstring::npos) ? wstring() : request.substr(space + 1);
+}
+
+bool DesktopSaver::IsRestoreCommand(const wstring &request)
+{
+   wstring verb, argument;
+   split_command(request, verb, argument);
+   return verb == L"restore" || verb == L"asof" || verb == L"closest" || verb == L"icons";
+}
+
+wstring DesktopSaver::RunCommand(const wstring &request, RestoreJob *job)
+{
+   wstring verb, argument;
+   split_command(request, verb, argument);
+
+   if (verb == L"ping") return L"ok";
+
+   if (verb == L"snapshot")
+   {
+      PollDesktopIcons();
+      return L"ok";
+   }
+
+   if (verb == L"stats")
+   {
+      return WSTRING(L"ok\n" << m_history.size() << L" recent layouts, " << m_timeline.size() << L" timeline slices ("
+         << m_retention.Bytes() / 1024 << L" of " << m_retention.Budget() / 1024 << L" KB), "
+         << m_namedProfiles.Count() << L" named profiles, " << m_iconIndex.IconCount() << L" icons tracked\n"
+         << m_settleStats.commits << L" slices recorded, " << m_settleStats.held << L" held to settle (" << m_settleStats.superseded << L" superseded), "
+         << m_settleStats.probes << L" probes\n"
+         << L"Displays: " << DisplayConfig::Describe() << L" (" << m_displayLayouts.size() << L" setups known, " << m_settleStats.display_restores << L" restores after a change, "
+            << m_settleStats.display_moves_saved << L" moves saved by restoring only the affected monitors)\n\n"
+         << icon_key_report() << L"\n\n"
+         << AllocStats::Report());
+   }
+
+   bool restored = false;
+   if (verb == L"restore")
+   {
+      const IconHistory *profile = m_namedProfiles.Find(argument);
+      if (!profile) return L"error There is no profile named '" + argument + L"'.";
+
+      RestoreHistory(*profile, job);
+      restored = true;
+   }
+
+   if (verb == L"asof")
+   {
+      int64_t when = 0;
+      if (swscanf_s(argument.c_str(), L"%lld", &when) != 1) return L"error Couldn't read the time '" + argument + L"'.";
+      if (!RestoreAsOf(when, job)) return L"error Nothing was saved that long ago.";
+      restored = true;
+   }
+
+   if (verb == L"closest")
+   {
+      if (!RestoreClosest(job)) return L"error No saved layout differs from the desktop.";
+      restored = true;
+   }
+
+   if (verb == L"icons")
+   {
+      // The profile, then each icon to move back to where it has them
+      vector<wstring> names;
+      for (size_t start = 0; start != wstring::npos; )
+      {
+         const size_t bar = argument.find(L'|', start);
+         names.push_back(argument.substr(start, bar == wstring::npos ? wstring::npos : bar - start));
+         start = (bar == wstring::npos) ? bar : bar + 1;
+      }
+      if (names.size() < 2) return L"error Name a profile and at least one icon, separated by '|'.";
+
+      const IconHistory *profile = m_namedProfiles.Find(names.front());
+      if (!profile) return L"error There is no profile named '" + names.front() + L"'.";
+      names.erase(names.begin());
+
+      for (const auto &name : names)
+      {
+         if (profile->Find(name) == IconHistory::npos) return L"error The '" + profile->GetName() + L"' profile has no icon named '" + name + L"'.";
+      }
+
+      RestoreIcons(*profile, names, job);
+      restored = true;
+   }
+
+   if (restored) return (job && job->CancelRequested()) ? L"error The restore was cancelled." : L"ok";
+
+   if (verb == L"add")
+   {
+      if (argument.empty()) return L"error The profile needs a name.";
+
+      // Saving over an existing profile keeps its original spelling
+      if (m_namedProfiles.Find(argument)) NamedProfileOverwrite(argument);
+      else NamedProfileAdd(argument);
+
+      return L"ok";
+   }
+
+   if (verb == L"delete")
+   {
+      if (!m_namedProfiles.Find(argument)) return L"error There is no profile named '" + argument + L"'.";
+
+      NamedProfileDelete(argument);
+      return L"ok";
+   }
+
+   return L"error Unknown request '" + verb + L"'.";
+}
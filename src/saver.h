@@ -1,70 +1,362 @@
-// DesktopSaver, (c)2006-2016 Nicholas Piegdon, MIT licensed
-#pragma once
-
-#include <string>
-#include <vector>
-#include "icon_history.h"
-#include "string_util.h"
-
-#define INTERNAL_ERROR(err) MessageBox(0, WSTRING(L"DesktopSaver Error in file '" << __FILE__ << L"', line " << __LINE__ << L":\n" << err).c_str(), L"DesktopSaver Error!", MB_ICONERROR)
-#define STANDARD_ERROR(err) MessageBox(0, WSTRING(err).c_str(), L"DesktopSaver Error!", MB_ICONERROR | MB_APPLMODAL)
-#define ASK_QUESTION(str)  (MessageBox(0, WSTRING(str).c_str(), L"DesktopSaver", MB_YESNO | MB_ICONQUESTION | MB_APPLMODAL) == IDYES)
-
-typedef std::vector<IconHistory> HistoryList;
-typedef HistoryList::iterator MalleableHistoryIter;
-
-typedef HistoryList::const_iterator HistoryIter;
-typedef HistoryList::const_reverse_iterator HistoryRevIter;
-
-enum PollRate { DisableHistory, PollEndpoints, Interval1, Interval2, Interval3, Interval4, PollRate_Max };
-
-class DesktopSaver
-{
-public:
-   DesktopSaver();
-
-   static const size_t MaxProfileCount = 10;
-   static const size_t MaxIconHistoryCount = 25;
-
-   void PollDesktopIcons();
-   void RestoreHistory(const IconHistory history);
-
-   void NamedProfileAdd(const std::wstring &name);
-   void NamedProfileOverwrite(const std::wstring &name);
-   void NamedProfileDelete(const std::wstring &name);
-   void NamedProfileAutostart(const std::wstring &name);
-
-   bool GetRunOnStartup() const;
-   void SetRunOnStartup(bool run);
-
-   PollRate GetPollRate() const { return m_rate; }
-   void SetPollRate(PollRate r);
-
-   unsigned int GetPollRateMilliseconds() const;
-
-   std::wstring GetAutostartProfileName() const;
-
-   const HistoryList &History() const { return m_history; }
-   const HistoryList &NamedProfiles() const { return m_namedProfiles; }
-   void ClearHistory();
-
-private:
-   // Save our history slices to file, to be read back next time
-   void serialize() const;
-   void deserialize();
-
-   static void RestoreHistoryOnce(const IconHistory &history);
-   static IconHistory ReadDesktop();
-
-   PollRate read_poll_rate() const;
-   void write_poll_rate();
-
-   // We cache the poll rate inside the object instead of
-   // reading from the registry each time because this
-   // is required during polls -- and polls should be as
-   // lightweight as possible
-   PollRate m_rate;
-
-   std::wstring m_historyPath;
-   HistoryList m_history, m_namedProfiles;
-};
+// DesktopSaver, (c)2006-2016 Nicholas Piegdon, MIT licensed
+#pragma once
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <functional>
+#include <utility>
+#include <unordered_map>
+#include <chrono>
+#include <cstdint>
+#include "display_config.h"
+#include "icon_diff.h"
+#include "icon_history.h"
+#include "icon_index.h"
+#include "layout_sketch.h"
+#include "profile_store.h"
+#include "restore_job.h"
+#include "snapshot_builder.h"
+#include "timeline_retention.h"
+#include "string_util.h"
+
+#define INTERNAL_ERROR(err) MessageBox(0, WSTRING(L"DesktopSaver Error in file '" << __FILE__ << L"', line " << __LINE__ << L":\n" << err).c_str(), L"DesktopSaver Error!", MB_ICONERROR)
+#define STANDARD_ERROR(err) MessageBox(0, WSTRING(err).c_str(), L"DesktopSaver Error!", MB_ICONERROR | MB_APPLMODAL)
+#define ASK_QUESTION(str)  (MessageBox(0, WSTRING(str).c_str(), L"DesktopSaver", MB_YESNO | MB_ICONQUESTION | MB_APPLMODAL) == IDYES)
+
+typedef std::vector<IconHistory> HistoryList;
+typedef HistoryList::iterator MalleableHistoryIter;
+
+typedef HistoryList::const_iterator HistoryIter;
+typedef HistoryList::const_reverse_iterator HistoryRevIter;
+
+enum PollRate { DisableHistory, PollEndpoints, Interval1, Interval2, Interval3, Interval4, PollRate_Max };
+
+// What became of the changes polls have found.  Every superseded layout
+// is a history slice (and a rewrite of the history file) that waiting
+// for the desktop to settle saved.
+struct SettleStats
+{
+   SettleStats() : commits(0), held(0), superseded(0), probes(0), display_restores(0), display_moves_saved(0) { }
+
+   // Slices actually added to the history
+   unsigned long long commits;
+
+   // Changed layouts held back until the desktop settled, and how many
+   // of those were replaced by a later one before that happened
+   unsigned long long held;
+   unsigned long long superseded;
+
+   unsigned long long probes;
+
+   // Layouts put back because the monitors changed (see DisplayChanged)
+   unsigned long long display_restores;
+
+   // Icons those restores didn't have to move because their monitor
+   // stayed the same, compared with restoring the whole layout
+   unsigned long long display_moves_saved;
+};
+
+// An immutable copy of everything the tray menu shows, published by the
+// DesktopSaver after every change.  Nothing changes one once it has been
+// published, so any thread can read it without locking.
+struct SaverView
+{
+   HistoryList history;
+   ProfileStore named_profiles;
+   Timeline timeline;
+
+   // The icons that moved most recently, with everywhere they've been
+   // (see IconIndex::RecentlyMoved)
+   struct MovedIcon
+   {
+      std::wstring name;
+      uint64_t key;
+      IconIndex::Trail trail;
+   };
+   std::vector<MovedIcon> moved_icons;
+
+   PollRate rate;
+   bool compact;
+   bool snap_to_grid;
+   bool display_restore;
+
+   // True while a changed layout is waiting for the desktop to settle
+   bool settling;
+   SettleStats settle;
+
+   // These go up whenever the history (list, timeline and icon index) or
+   // the named profiles change, so the menu knows what it has to rebuild
+   unsigned long history_version;
+   unsigned long profiles_version;
+};
+
+class DesktopSaver
+{
+public:
+   DesktopSaver();
+
+   static const size_t MaxIconHistoryCount = 25;
+   static const size_t MaxMovedIcons = 10;
+
+   // How much the timeline may cost (in memory, and about the same on
+   // disk) before older slices are dropped, unless set in the registry
+   static const size_t DefaultHistoryBudgetKb = 4096;
+
+   // Icons that have moved this few pixels (or fewer) in each direction
+   // since the last history slice haven't really moved, unless set in the
+   // registry.  Zero turns this off.
+   static const int DefaultMoveTolerance = 3;
+
+   // A changed layout is only recorded once the desktop has stayed the
+   // same for this long, unless set in the registry (zero records it
+   // right away).  Until then it's probed this often.
+   static const int DefaultSettleMilliseconds = 3000;
+   static const int SettleProbeMilliseconds = 500;
+
+   // With 'settle', a change is held back until the desktop stops
+   // changing (see SettlePending).  Otherwise it's recorded right away,
+   // along with anything that was being held.
+   void PollDesktopIcons(bool settle = false);
+
+   // Checks whether the desktop has changed since the last probe, and
+   // records the held layout (or restores the one for new monitors, see
+   // DisplayChanged) once it has been still for the settle time.  The
+   // probe only reads icon positions.  Returns true while there's still
+   // something waiting.
+   bool SettlePending();
+
+   // Call whenever the monitors might have changed (polls check too).  If
+   // they're set up differently than before, anything waiting to settle is
+   // dropped (it's just Explorer reflowing the icons) and, if we've seen
+   // this setup before, its most recent layout is restored once Explorer
+   // is done and the desktop has settled (see SettlePending).  Nothing is
+   // recorded in the meantime.  Unless the partial_restore setting is
+   // off, only the icons that were on, or belong on, a monitor that came,
+   // went, or changed (or that Explorer moved) are touched.  Returns true
+   // if something was restored or is waiting to be.
+   bool DisplayChanged(RestoreJob *job = nullptr);
+
+   // The most recent history slice or named profile captured on a monitor
+   // setup (see DisplayConfig), found in O(1).  Null if there isn't one.
+   const IconHistory *LayoutForDisplay(uint64_t display) const;
+
+   // Whether DisplayChanged restores anything
+   bool GetDisplayRestore() const { return m_displayRestore; }
+   void SetDisplayRestore(bool restore);
+
+   // Each kind of restore can optionally report its progress to (and be
+   // cancelled through) a RestoreJob
+   void RestoreHistory(const IconHistory history, RestoreJob *job = nullptr);
+
+   // Moves the desktop's icons to match 'history' without recording
+   // anything in (or even loading) the history
+   enum RestoreOutcome { RestoreSettled, RestoreUnsettled, RestoreCancelled };
+   static RestoreOutcome ApplyLayout(const IconHistory &history, SnapshotBuilder &scratch, RestoreJob *job = nullptr);
+
+   // Reads just one named profile out of the history file, skipping the
+   // history slices entirely when the file's index allows it
+   static bool LoadNamedProfile(const std::wstring &name, IconHistory &out);
+
+   // Reads just the history slice that was in effect at 'time', found
+   // using only the file's index.  False if there isn't one, or the file
+   // has no index to find it with.
+   static bool LoadSliceAsOf(int64_t time, IconHistory &out);
+
+   // Where the history file lives
+   static std::wstring HistoryPath();
+
+   // Keeps the history somewhere else from now on (the benchmarks use
+   // this to leave the real one alone).  Call before the constructor.
+   static void UseHistoryPath(const std::wstring &path);
+
+   // Moves just the named icons back to where they were in 'history',
+   // leaving everything else on the desktop alone
+   void RestoreIcons(const IconHistory &history, const std::vector<std::wstring> &names, RestoreJob *job = nullptr);
+   void RestoreIcon(const std::wstring &name, uint64_t key, long x, long y, RestoreJob *job = nullptr);
+
+   void NamedProfileAdd(const std::wstring &name);
+   void NamedProfileOverwrite(const std::wstring &name);
+   void NamedProfileDelete(const std::wstring &name);
+   static void NamedProfileAutostart(const std::wstring &name);
+
+   static bool GetRunOnStartup();
+   static void SetRunOnStartup(bool run);
+
+   // Use the compact (packed and compressed) history file encoding
+   bool GetCompactHistory() const { return m_compact; }
+   void SetCompactHistory(bool compact);
+
+   // Line up icons that are just off the desktop grid (when Explorer is
+   // aligning them to it) before comparing layouts
+   bool GetSnapToGrid() const { return m_snapToGrid; }
+   void SetSnapToGrid(bool snap);
+
+   PollRate GetPollRate() const { return m_rate; }
+   void SetPollRate(PollRate r);
+
+   unsigned int GetPollRateMilliseconds() const { return PollRateMilliseconds(m_rate); }
+   static unsigned int PollRateMilliseconds(PollRate p);
+
+   static std::wstring GetAutostartProfileName();
+
+   // The most recently published view of our history and settings.  Unlike
+   // everything else here, this is safe to call from any thread.
+   std::shared_ptr<const SaverView> GetView() const { return std::atomic_load(&m_view); }
+
+   // Problems the user should hear about go to the handler, which is
+   // called on whichever thread ran into them.  Without one, they're shown
+   // in a message box right away.
+   typedef std::function<void(const std::wstring &message)> ErrorHandler;
+   void SetErrorHandler(ErrorHandler handler) { m_errors = handler; }
+   void ReportError(const std::wstring &message) const;
+
+   const HistoryList &History() const { return m_history; }
+   const Timeline &GetTimeline() const { return m_timeline; }
+
+   // The layout in effect at 'time' (seconds since 1970, UTC), found in
+   // O(log n).  Null if the timeline doesn't go back that far.
+   const IconHistory *LayoutAsOf(int64_t time) const;
+   bool RestoreAsOf(int64_t time, RestoreJob *job = nullptr);
+
+   // The history slices and named profiles closest to the desktop as it
+   // is now (leaving out any that match it already), closest first.  Only
+   // the most promising few are compared in full; the rest are ranked by
+   // their sketches alone (see LayoutSketch).
+   struct LayoutMatch
+   {
+      IconHistory layout;
+      LayoutDistance distance;
+   };
+   std::vector<LayoutMatch> RankLayouts(size_t count) const;
+   bool RestoreClosest(RestoreJob *job = nullptr);
+
+   // Where each icon has been over the course of the timeline
+   const IconIndex &GetIconIndex() const { return m_iconIndex; }
+
+   const ProfileStore &NamedProfiles() const { return m_namedProfiles; }
+   void ClearHistory();
+
+   // Carries out one of the requests another DesktopSaver process can hand
+   // us on its command line (see CommandServer).  The answer starts with
+   // "ok" or "error", followed by anything worth telling the user.
+   //
+   //    ping, snapshot, stats, closest, asof <seconds since 1970>,
+   //    restore <profile>, add <profile>, delete <profile>,
+   //    icons <profile>|<icon>[|<icon>...]
+   //
+   // No file name can have a '|' in it, so neither can an icon's.
+   //
+   std::wstring RunCommand(const std::wstring &request, RestoreJob *job = nullptr);
+
+   // True for the requests that move icons around (and so can use a job)
+   static bool IsRestoreCommand(const std::wstring &request);
+
+private:
+   // Replaces the view (see GetView) after any change
+   void publish();
+
+   // Adds a new slice to the history and timeline
+   void commit(IconHistory history);
+
+   // Positions of every icon in the list view's order, hashed
+   static uint64_t ProbeDesktop();
+
+   // Save our history slices to file, to be read back next time
+   void serialize() const;
+   void deserialize();
+
+   // Recreates the history list from the timeline
+   void rebuild_history();
+   void rebuild_icon_index();
+
+   // The icons in 'target' that were on (in 'before', on the monitors
+   // 'was') or belong on (on the monitors 'now') a monitor that isn't in
+   // both setups, or that have moved since 'before' (to where they are in
+   // 'current').  Everything else can stay where it is; 'saved' is how
+   // many of those restoring all of 'target' would have moved.
+   static IconHistory affected_icons(const IconHistory &before, const DisplayConfig::Monitors &was, const IconHistory &current, const IconHistory &target, const DisplayConfig::Monitors &now, size_t &saved);
+
+   // Restores the latest layout for the current monitors, for DisplayChanged
+   bool restore_display(RestoreJob *job);
+
+   // Keeps m_displayLayouts up to date
+   void remember_display_layout(const IconHistory &h);
+   void rebuild_display_layouts();
+
+   // Returns false if the job was cancelled part way through
+   bool restore(const IconHistory &history, RestoreJob *job);
+   static bool RestoreHistoryOnce(const IconDiff &plan, RestoreJob *job);
+   static const int RestoreBatchSize = 32;
+   static IconHistory ReadDesktop();
+
+   // With a tolerance, icons that close to the desktop grid are snapped
+   // onto it (see SnapshotBuilder::SnapToGrid)
+   static void ReadDesktop(SnapshotBuilder &snapshot, int snap_tolerance = 0);
+
+   PollRate read_poll_rate() const;
+   void write_poll_rate();
+
+   // We cache the poll rate inside the object instead of
+   // asking the settings each time because this
+   // is required during polls -- and polls should be as
+   // lightweight as possible
+   PollRate m_rate;
+   bool m_compact;
+   bool m_snapToGrid;
+   int m_tolerance;
+   int m_settleMs;
+   bool m_displayRestore;
+   bool m_partialRestore;
+
+   std::wstring m_historyPath;
+   HistoryList m_history;
+   ProfileStore m_namedProfiles;
+   Timeline m_timeline;
+
+   // See SaverView
+   unsigned long m_historyVersion;
+   unsigned long m_profilesVersion;
+
+   TimelineRetention m_retention;
+   IconIndex m_iconIndex;
+
+   // What changed between the last two history slices
+   IconDiff m_lastDiff;
+
+   // A changed layout waiting for the desktop to settle.  Once the probe
+   // has seen something move, it's stale and the desktop is read again
+   // before recording it.
+   bool m_hasPending;
+   bool m_pendingStale;
+   IconHistory m_pending;
+   uint64_t m_pendingProbe;
+   std::chrono::steady_clock::time_point m_pendingSince;
+   SettleStats m_settleStats;
+
+   // A restore waiting for the desktop to settle after the monitors
+   // changed, with the monitors (and setup) the last slice was read on.
+   // It shares the probe above with m_pending, which is dropped first.
+   bool m_displayPending;
+   DisplayConfig::Monitors m_displayWas;
+   uint64_t m_displayPrevious;
+
+   // The monitor setup the desktop was last read on (and its monitors, if
+   // we've seen them), and the latest layout for every setup in the
+   // timeline or the named profiles
+   uint64_t m_display;
+   DisplayConfig::Monitors m_monitors;
+   std::unordered_map<uint64_t, IconHistory> m_displayLayouts;
+
+   // Reused by every poll so that reading the desktop doesn't
+   // have to go to the heap (see SnapshotBuilder)
+   SnapshotBuilder m_scratch;
+
+   std::shared_ptr<const SaverView> m_view;
+
+   ErrorHandler m_errors;
+
+   // So a history file we can't write only gets reported once, rather
+   // than on every change until it can be written again
+   mutable bool m_saveFailed;
+};
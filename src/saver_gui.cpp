@@ -1,473 +1,617 @@
-// DesktopSaver, (c)2006-2016 Nicholas Piegdon, MIT licensed
-
-#include <algorithm>
-
-#include <windows.h>
-#include "resource.h"
-
-#include "saver_gui.h"
-#include "saver.h"
-#include "version.h"
-#include "tray_icon.h"
-#include "create_dialog.h"
-using namespace std;
-
-static const int WM_TRAYMESSAGE =          WM_USER + 1;
-
-// Main Menu
-static const int WM_Tray_History_Clear =   WM_USER + 2;
-static const int WM_Tray_Exit =            WM_USER + 3;
-static const int WM_Tray_Profile_Create =  WM_USER + 4;
-
-// Options
-static const int WM_Tray_On_Startup =      WM_USER + 5;
-static const int WM_Tray_Disable_History = WM_USER + 6;
-static const int WM_Tray_Poll_Endpoints =  WM_USER + 7;
-static const int WM_Tray_Poll_Interval1 =  WM_USER + 8;
-static const int WM_Tray_Poll_Interval2 =  WM_USER + 9;
-static const int WM_Tray_Poll_Interval3 =  WM_USER + 10;
-static const int WM_Tray_Poll_Interval4 =  WM_USER + 11;
-
-// Lookups
-// NOTE: Order is very significant here
-static const int WM_Lookup_Begin =           WM_USER + 12;
-static const int WM_Tray_History =           WM_Lookup_Begin;
-static const int WM_Tray_Named_Profile =     WM_Tray_History + DesktopSaver::MaxIconHistoryCount;
-static const int WM_Tray_Profile_Update =    WM_Tray_Named_Profile + DesktopSaver::MaxProfileCount;
-static const int WM_Tray_Profile_Delete =    WM_Tray_Profile_Update + DesktopSaver::MaxProfileCount;
-static const int WM_Tray_Profile_Autostart = WM_Tray_Profile_Delete + DesktopSaver::MaxProfileCount;
-static const int WM_Lookup_End =             WM_Tray_Profile_Autostart + 1;
-
-static const LRESULT RET_DEF_PROC = -35;
-
-DesktopSaverGui *DesktopSaverGui::c_gui;
-
-DesktopSaverGui::DesktopSaverGui(HINSTANCE hinst)
-{
-   const wstring qualifiedName = wstring(DesktopSaverName) + L" " + wstring(DesktopSaverVersion);
-
-   m_hinstance = hinst;
-
-   // Win32 Stuff
-   WNDCLASS wndclass;
-   wndclass.style = 0;
-   wndclass.lpfnWndProc = DesktopSaverGui::proc;
-   wndclass.cbClsExtra = 0;
-   wndclass.cbWndExtra = 0;
-   wndclass.hInstance = hinst;
-   wndclass.hIcon = LoadIcon(hinst, L"IDI_APP_ICON");
-   wndclass.hCursor = LoadCursor(NULL, IDC_ARROW);
-   wndclass.hbrBackground = (HBRUSH) GetStockObject(WHITE_BRUSH);
-   wndclass.lpszMenuName = NULL;
-   wndclass.lpszClassName = DesktopSaverName;
-
-   if (!RegisterClass(&wndclass)) { INTERNAL_ERROR(L"Couldn't register the window!"); exit(1); }
-
-   c_gui = this;
-   m_hwnd = CreateWindow(DesktopSaverName, qualifiedName.c_str(), WS_OVERLAPPEDWINDOW, CW_USEDEFAULT, CW_USEDEFAULT, 350, 200, NULL, NULL, hinst, this);
-   if (!m_hwnd) { INTERNAL_ERROR(L"Couldn't create main program window!"); exit(1); }
-
-   // Leave the (default, completely empty, useless) window hidden
-   ShowWindow(m_hwnd, SW_HIDE);
-   UpdateWindow(m_hwnd);
-
-   // Create the system tray icon
-   m_tray_icon = make_unique<TrayIcon>(m_hwnd, WM_TRAYMESSAGE, LoadIcon(hinst, L"IDI_TRAY_ICON"));
-   m_tray_icon->SetTooltip(qualifiedName.c_str());
-
-   m_saver = make_unique<DesktopSaver>();
-
-   // Create our desktop icon polling timer
-   m_timer_id = 1;
-   update_timer();
-
-}
-
-// Required to hide destructor in this compilation unit (for the sake of forward declared unique_ptrs)
-DesktopSaverGui::~DesktopSaverGui() { }
-
-int DesktopSaverGui::Run()
-{
-   MSG message;
-   while (GetMessage(&message, NULL, 0, 0))
-   {
-      TranslateMessage(&message);
-      DispatchMessage(&message);
-   }
-   return int(message.wParam);
-}
-
-
-LRESULT CALLBACK DesktopSaverGui::proc(HWND hwnd, UINT message, WPARAM wparam, LPARAM lparam)
-{
-   switch (message)
-   {
-   case WM_ENDSESSION:  // fall-through
-   case WM_DESTROY:     { return c_gui->message_destroy(); }
-   case WM_CREATE:      { return c_gui->message_create(hwnd); }
-   case WM_TRAYMESSAGE: { return c_gui->message_tray(wparam, lparam); }
-   case WM_COMMAND:     { return c_gui->message_menu(wparam); }
-   case WM_TIMER:       { return c_gui->message_timer(wparam); return 0; }
-   default:
-   {
-      LRESULT ret = c_gui->message_default(message, wparam, lparam);
-      if (ret != RET_DEF_PROC) return ret;
-   }
-   }
-   return DefWindowProc(hwnd, message, wparam, lparam);
-}
-
-LRESULT DesktopSaverGui::message_timer(WPARAM timer_id)
-{
-   // This should never happen, but isn't necessarily a critical error
-   if (timer_id != m_timer_id) INTERNAL_ERROR(L"An unknown (external) timer event was received!");
-
-   m_saver->PollDesktopIcons();
-
-   return 0;
-}
-
-LRESULT DesktopSaverGui::message_default(UINT message, WPARAM wparam, LPARAM lparam)
-{
-   if (message == m_taskbar_restart_message)
-   {
-      // After an explorer crash, you have to re-add your icons to the tray
-      m_tray_icon->RestoreIcon();
-
-      // Because explorer probably just restarted, it might be a good
-      // idea to poll immediately and see what havok was caused.
-      m_saver->PollDesktopIcons();
-
-      return 0;
-   }
-
-   // Tell our WndProc to use DefWindowProc for all other unhandled messages
-   return RET_DEF_PROC;
-}
-
-LRESULT DesktopSaverGui::message_create(HWND hwnd)
-{
-   // WARNING: Do not use m_hwnd in this message, it's not valid at this
-   //          point!  Instead, use the passed-in hwnd from WndProc
-
-   // Register that we want to know when explorer.exe recovers from a crash
-   m_taskbar_restart_message = RegisterWindowMessage(L"TaskbarCreated");
-
-   return 0;
-}
-
-LRESULT DesktopSaverGui::message_destroy()
-{
-   // Stop the automatic polling
-   KillTimer(m_hwnd, m_timer_id);
-
-   // Poll one last time just before we shut down
-   m_saver->PollDesktopIcons();
-
-   // Signal that we're quitting
-   PostQuitMessage(0);
-
-   return 0;
-}
-
-LRESULT DesktopSaverGui::message_tray(WPARAM w, LPARAM l)
-{
-   switch (l)
-   {
-   case WM_LBUTTONUP:
-   case WM_RBUTTONUP:
-   case WM_CONTEXTMENU:
-      // Only let certain messages pass through (all of which
-      // simply pop-up the menu)
-      break;
-
-   default: return DefWindowProc(m_hwnd, WM_TRAYMESSAGE, w, l);
-   }
-
-   // Poll just before we create the menu so that it
-   // looks like we get an instant response
-   m_saver->PollDesktopIcons();
-
-   // Dynamically build our history menu
-   HMENU menu = build_dynamic_menu();
-
-   // We need the cursor position to know where to pop up the menu
-   POINT point;
-   GetCursorPos(&point);
-
-   // Some of this jazz is required because of a Microsoft KB article having 
-   // to do with popup menus not disappearing if you click elsewhere.
-   SetForegroundWindow(m_hwnd);
-   TrackPopupMenu(menu, TPM_RIGHTALIGN | TPM_BOTTOMALIGN, point.x, point.y, 0, m_hwnd, 0);
-   PostMessage(m_hwnd, WM_NULL, 0, 0);
-
-   // TrackPopupMenu only returns after it's been taken care
-   // of, so we can clean up our resources immediately afterwards
-   //
-   // DestroyMenu is recursive, so it handles the submenus
-   DestroyMenu(menu);
-
-   return 0;
-}
-
-HMENU DesktopSaverGui::build_dynamic_menu()
-{
-   HMENU options = CreatePopupMenu();
-
-   // Find out whether the run-at-startup options should be checked
-   long registry_checked = (m_saver->GetRunOnStartup() ? MF_CHECKED : 0);
-   AppendMenu(options, MF_STRING | registry_checked, WM_Tray_On_Startup, L"&Run at Startup");
-
-   AppendMenu(options, MF_SEPARATOR, 0, 0);
-
-   PollRate p = m_saver->GetPollRate();
-
-   // Decide which of these gets the checkmark
-   AppendMenu(options, MF_STRING | (p==DisableHistory?MF_CHECKED:0), WM_Tray_Disable_History, L"&Disable History");
-   AppendMenu(options, MF_STRING | (p==PollEndpoints?MF_CHECKED:0),  WM_Tray_Poll_Endpoints, L"Poll at Startup and Shutdown only");
-   AppendMenu(options, MF_STRING | (p==Interval1?MF_CHECKED:0),      WM_Tray_Poll_Interval1, L"Poll every 5 minutes");
-   AppendMenu(options, MF_STRING | (p==Interval2?MF_CHECKED:0),      WM_Tray_Poll_Interval2, L"Poll every 20 minutes");
-   AppendMenu(options, MF_STRING | (p==Interval3?MF_CHECKED:0),      WM_Tray_Poll_Interval3, L"Poll every 60 minutes");
-   AppendMenu(options, MF_STRING | (p==Interval4?MF_CHECKED:0),      WM_Tray_Poll_Interval4, L"Poll every 360 minutes");
-
-   const HistoryList &named_profiles = m_saver->NamedProfiles();
-
-   // Build up each "Update Profile" menu item
-   HMENU profile_update = CreatePopupMenu();
-   int update_choice = 0;
-   for (HistoryRevIter i = named_profiles.rbegin(); i != named_profiles.rend(); ++i) AppendMenu(profile_update, MF_STRING, WM_Tray_Profile_Update + update_choice++, i->GetName().c_str());
-
-   // Build up each "Delete Profile" menu item
-   HMENU profile_delete = CreatePopupMenu();
-   int delete_choice = 0;
-   for (HistoryRevIter i = named_profiles.rbegin(); i != named_profiles.rend(); ++i) AppendMenu(profile_delete, MF_STRING, WM_Tray_Profile_Delete + delete_choice++, i->GetName().c_str());
-
-   // Build up each "Autostart Profile" menu item
-   std::wstring autostart_profilename = m_saver->GetAutostartProfileName();
-   HMENU profile_autostart = CreatePopupMenu();
-   int autostart_choice = 0;
-   for (HistoryRevIter i = named_profiles.rbegin(); i != named_profiles.rend(); ++i)
-   {
-      wstring name = i->GetName();
-      AppendMenu(profile_autostart, MF_STRING | (name == autostart_profilename ? MF_CHECKED : 0), WM_Tray_Profile_Autostart + autostart_choice++, name.c_str());
-   }
-
-   HMENU menu = CreatePopupMenu();
-
-   const HistoryList &history = m_saver->History();
-
-   // This shouldn't happen (but is non-critical)
-   if (history.size() > DesktopSaver::MaxIconHistoryCount) INTERNAL_ERROR(L"History List too long!");
-
-   // If History is disabled, don't show the history list at all
-   if (m_saver->GetPollRate() != DisableHistory)
-   {
-      // Build up each history menu item
-      int history_choice = 0;
-      for (HistoryRevIter i = history.rbegin(); i != history.rend(); ++i) AppendMenu(menu, MF_STRING, WM_Tray_History + history_choice++, i->GetName().c_str());
-
-      // Decide whether to gray-out the "Clear History" option, if we don't
-      // have any history slices to clear
-      long additional_clear_flags = MF_GRAYED;
-      if (history.size() > 0) additional_clear_flags = 0;
-      AppendMenu(menu, MF_STRING | additional_clear_flags, WM_Tray_History_Clear, L"&Clear History");
-
-      AppendMenu(menu, MF_SEPARATOR, 0, 0);
-   }
-
-   // Add each named profile to this list
-   int named_choice = 0;
-   for (HistoryRevIter i = named_profiles.rbegin(); i != named_profiles.rend(); ++i) AppendMenu(menu, MF_STRING, WM_Tray_Named_Profile + named_choice++, i->GetName().c_str());
-
-
-   // If we've reached our maximum number of user-created
-   // named profiles, disable the "Create" command
-   bool too_many_profiles = false;
-   if (m_saver->NamedProfiles().size() >= DesktopSaver::MaxProfileCount) too_many_profiles = true;
-
-   bool have_profiles = (named_profiles.size() > 0);
-   AppendMenu(menu, MF_STRING | (too_many_profiles?MF_GRAYED:0), WM_Tray_Profile_Create, L"&Create new named profile...");
-   AppendMenu(menu, MF_STRING | MF_POPUP | (have_profiles?0:MF_GRAYED), (UINT_PTR)profile_update, L"&Overwrite named profile");
-   AppendMenu(menu, MF_STRING | MF_POPUP | (have_profiles?0:MF_GRAYED), (UINT_PTR)profile_delete, L"&Delete named profile");
-   AppendMenu(menu, MF_STRING | MF_POPUP | (have_profiles?0:MF_GRAYED), (UINT_PTR)profile_autostart, L"&Set profile to auto-load at startup");
-
-   AppendMenu(menu, MF_SEPARATOR, 0, 0);
-
-   AppendMenu(menu, MF_STRING | MF_POPUP, (UINT_PTR)options, L"&Options");
-
-   // Let them quit the program if they want  :)
-   AppendMenu(menu, MF_STRING, WM_Tray_Exit, L"E&xit");
-
-   return menu;
-}
-
-LRESULT DesktopSaverGui::message_menu(WPARAM choice)
-{
-   switch (choice)
-   {
-   case WM_Tray_History_Clear:
-      {
-         if (ASK_QUESTION(L"Are you sure you want to erase your icon position history?\n(Your named profiles will remain intact)."))
-            m_saver->ClearHistory();
-
-         break;
-      }
-
-   case WM_Tray_Exit:
-      { 
-         SendMessage(m_hwnd, WM_DESTROY, 0, 0);
-         break;
-      }
-
-   case WM_Tray_Profile_Create:
-      {
-         // This option is only available if there aren't
-         // too many named profiles already.
-
-         wstring name = AskForNewProfileName(m_hinstance, m_hwnd);
-
-         // If the user presses cancel in the dialog (or just
-         // leaves the box blank), it comes back empty.
-         if (name == L"") break;
-
-         // Check that this (case insensitive) name doesn't already exist.
-         bool duplicate = false;
-         wstring duplicate_profile_name;
-
-         for (const auto &h : m_saver->NamedProfiles())
-         {
-            wstring name_lower = name;
-            std::transform(name.begin(), name.end(), name_lower.begin(), tolower);
-
-            const wstring other = h.GetName();
-
-            wstring other_lower = other;
-            std::transform(other.begin(), other.end(), other_lower.begin(), tolower);
-
-            if (name_lower == other_lower)
-            {
-               duplicate = true;
-               duplicate_profile_name = other;
-               break;
-            }
-         }
-
-         if (duplicate && ASK_QUESTION(L"A profile with the name '" << duplicate_profile_name << L"' already exists.  Overwrite?")) m_saver->NamedProfileOverwrite(duplicate_profile_name);
-         else m_saver->NamedProfileAdd(name);
-
-         break;
-      }
-
-   case WM_Tray_On_Startup:
-      {
-         m_saver->SetRunOnStartup(!m_saver->GetRunOnStartup());
-         break;
-      }
-
-   case WM_Tray_Disable_History:
-      {
-         PollRate current = m_saver->GetPollRate();
-
-         if (current != DisableHistory && ASK_QUESTION(L"Disabling your history will erase all history snapshots.  Continue?\n(Your named profiles will remain intact)."))
-         {
-            // We must set the poll rate before clearing the history
-            // otherwise a poll will occur *just* after the clear
-            // and it won't be stopped by the disable bit.
-            m_saver->SetPollRate(DisableHistory);
-            update_timer();
-
-            m_saver->ClearHistory();
-         }
-         break;
-      }
-
-   case WM_Tray_Poll_Endpoints: m_saver->SetPollRate(PollEndpoints); update_timer(); break;
-   case WM_Tray_Poll_Interval1: m_saver->SetPollRate(Interval1);     update_timer(); break;
-   case WM_Tray_Poll_Interval2: m_saver->SetPollRate(Interval2);     update_timer(); break;
-   case WM_Tray_Poll_Interval3: m_saver->SetPollRate(Interval3);     update_timer(); break;
-   case WM_Tray_Poll_Interval4: m_saver->SetPollRate(Interval4);     update_timer(); break;
-
-   default:
-      {
-         if (choice < WM_Lookup_Begin) break;
-         if (choice >= WM_Lookup_End) break;
-
-         bool handled = false;
-
-         const HistoryList &history = m_saver->History();
-         const HistoryList &named_profiles = m_saver->NamedProfiles();
-
-         // History selection
-         if (choice >= WM_Tray_History + 0 && choice < WM_Tray_History + DesktopSaver::MaxIconHistoryCount)
-         {
-            int menu_choice = ((UINT)choice - WM_Tray_History);
-            int history_choice = int(history.size() - menu_choice - 1);
-
-            m_saver->RestoreHistory(history[history_choice]);
-            handled = true;
-         }
-
-         if (choice >= WM_Tray_Named_Profile + 0 && choice < WM_Tray_Named_Profile + DesktopSaver::MaxProfileCount)
-         {
-            int menu_choice = ((UINT)choice - WM_Tray_Named_Profile);
-            int profile_choice = int(named_profiles.size() - menu_choice - 1);
-
-            m_saver->RestoreHistory(named_profiles[profile_choice]);
-            handled = true;
-         }
-
-         if (choice >= WM_Tray_Profile_Update + 0 && choice < WM_Tray_Profile_Update + DesktopSaver::MaxProfileCount)
-         {
-            int menu_choice = ((UINT)choice - WM_Tray_Profile_Update);
-            int profile_choice = int(named_profiles.size() - menu_choice - 1);
-
-            wstring name = named_profiles[profile_choice].GetName();
-
-            if (ASK_QUESTION(L"Overwrite '" << name << L"' profile with current desktop snapshot?")) m_saver->NamedProfileOverwrite(name);
-            handled = true;
-         }
-
-         if (choice >= WM_Tray_Profile_Delete + 0 && choice < WM_Tray_Profile_Delete + DesktopSaver::MaxProfileCount)
-         {
-            int menu_choice = ((UINT)choice - WM_Tray_Profile_Delete);
-            int profile_choice = int(named_profiles.size() - menu_choice - 1);
-
-            wstring name = named_profiles[profile_choice].GetName();
-
-            if (ASK_QUESTION(L"Are you sure you want to delete the '" << name << L"' profile?")) m_saver->NamedProfileDelete(name);
-            handled = true;
-         }
-
-         if (choice >= WM_Tray_Profile_Autostart + 0 && choice < WM_Tray_Profile_Autostart + DesktopSaver::MaxProfileCount)
-         {
-            int menu_choice = ((UINT)choice - WM_Tray_Profile_Autostart);
-            int profile_choice = int(named_profiles.size() - menu_choice - 1);
-
-            wstring name = named_profiles[profile_choice].GetName();
-
-            m_saver->NamedProfileAutostart(name);
-
-            handled = true;
-         }
-
-         if (!handled) STANDARD_ERROR(L"Unexpected 'choice' in popup menu");
-      }
-
-   } // switch
-
-   return 0;
-}
-
-void DesktopSaverGui::update_timer()
-{
-   KillTimer(m_hwnd, m_timer_id);
-
-   UINT timer_delay = m_saver->GetPollRateMilliseconds();
-   if (timer_delay == 0) return;
-
-   if (!SetTimer(m_hwnd, m_timer_id, timer_delay, (TIMERPROC)0))
-   {
-      INTERNAL_ERROR(L"Couldn't set polling timer!");
-      exit(1);
-   }
-}
+// DesktopSaver, (c)2006-2016 Nicholas Piegdon, MIT licensed
+
+#include <algorithm>
+#include <ctime>
+#include <iomanip>
+#include <chrono>
+#include <future>
+
+#include <windows.h>
+#include "resource.h"
+
+#include "saver_gui.h"
+#include "saver.h"
+#include "saver_worker.h"
+#include "settings.h"
+#include "command_server.h"
+#include "alloc_stats.h"
+#include "version.h"
+#include "tray_icon.h"
+#include "create_dialog.h"
+#include "tray_menu.h"
+using namespace std;
+
+static const int WM_TRAYMESSAGE =          WM_USER + 1;
+
+// Posted by the worker whenever it finishes something
+static const int WM_SAVERPUBLISHED =       WM_APP + 1;
+
+// Posted by a restore whenever its progress changes
+static const int WM_RESTOREPROGRESS =      WM_APP + 2;
+
+// Posted by the command server with a restore it started for the UI to track
+static const int WM_REMOTERESTORE =        WM_APP + 3;
+
+// Posted by the worker when it has errors waiting to be shown
+static const int WM_SAVERERROR =           WM_APP + 4;
+
+// How many finished restores to keep the timing of
+static const size_t MaxFinishedRestores = 10;
+
+static const LRESULT RET_DEF_PROC = -35;
+
+DesktopSaverGui *DesktopSaverGui::c_gui;
+
+static wstring format_seconds(double seconds)
+{
+   return WSTRING(fixed << setprecision(2) << seconds << L"s");
+}
+
+DesktopSaverGui::DesktopSaverGui(HINSTANCE hinst)
+{
+   const wstring qualifiedName = wstring(DesktopSaverName) + L" " + wstring(DesktopSaverVersion);
+   m_qualified_name = qualifiedName;
+
+   m_hinstance = hinst;
+
+   m_menu_shown = 0;
+   m_menu_last_ms = 0;
+   m_menu_max_ms = 0;
+   m_menu_total_ms = 0;
+
+   m_probe_timer_id = 2;
+   m_probing = false;
+
+   // Win32 Stuff
+   WNDCLASS wndclass;
+   wndclass.style = 0;
+   wndclass.lpfnWndProc = DesktopSaverGui::proc;
+   wndclass.cbClsExtra = 0;
+   wndclass.cbWndExtra = 0;
+   wndclass.hInstance = hinst;
+   wndclass.hIcon = LoadIcon(hinst, L"IDI_APP_ICON");
+   wndclass.hCursor = LoadCursor(NULL, IDC_ARROW);
+   wndclass.hbrBackground = (HBRUSH) GetStockObject(WHITE_BRUSH);
+   wndclass.lpszMenuName = NULL;
+   wndclass.lpszClassName = DesktopSaverName;
+
+   if (!RegisterClass(&wndclass)) { INTERNAL_ERROR(L"Couldn't register the window!"); exit(1); }
+
+   c_gui = this;
+   m_hwnd = CreateWindow(DesktopSaverName, qualifiedName.c_str(), WS_OVERLAPPEDWINDOW, CW_USEDEFAULT, CW_USEDEFAULT, 350, 200, NULL, NULL, hinst, this);
+   if (!m_hwnd) { INTERNAL_ERROR(L"Couldn't create main program window!"); exit(1); }
+
+   // Leave the (default, completely empty, useless) window hidden
+   ShowWindow(m_hwnd, SW_HIDE);
+   UpdateWindow(m_hwnd);
+
+   // Create the system tray icon
+   m_tray_icon = make_unique<TrayIcon>(m_hwnd, WM_TRAYMESSAGE, LoadIcon(hinst, L"IDI_TRAY_ICON"));
+   m_tray_icon->SetTooltip(qualifiedName.c_str());
+   m_tray_menu = make_unique<TrayMenu>();
+
+   // Loading the history (and any auto-start profile) happens before
+   // there's a menu to show, so that much can still be done right here
+   m_worker = make_unique<SaverWorker>(make_unique<DesktopSaver>(), m_hwnd, WM_SAVERPUBLISHED, WM_SAVERERROR);
+
+   // Once there's a worker to hand them to, start taking requests
+   m_server = make_unique<CommandServer>(CommandServer::DefaultName(), [this](const wstring &request) { return remote_command(request); });
+
+   // Create our desktop icon polling timer
+   m_timer_id = 1;
+   update_timer(m_worker->GetView()->rate);
+
+}
+
+// Required to hide destructor in this compilation unit (for the sake of forward declared unique_ptrs)
+DesktopSaverGui::~DesktopSaverGui() { }
+
+int DesktopSaverGui::Run()
+{
+   MSG message;
+   while (GetMessage(&message, NULL, 0, 0))
+   {
+      TranslateMessage(&message);
+      DispatchMessage(&message);
+   }
+   return int(message.wParam);
+}
+
+
+LRESULT CALLBACK DesktopSaverGui::proc(HWND hwnd, UINT message, WPARAM wparam, LPARAM lparam)
+{
+   switch (message)
+   {
+   case WM_ENDSESSION:  // fall-through
+   case WM_DESTROY:     { return c_gui->message_destroy(); }
+   case WM_CREATE:      { return c_gui->message_create(hwnd); }
+   case WM_TRAYMESSAGE: { return c_gui->message_tray(wparam, lparam); }
+   case WM_COMMAND:     { return c_gui->message_menu(wparam); }
+   case WM_TIMER:       { return c_gui->message_timer(wparam); return 0; }
+   case WM_SAVERPUBLISHED: { return c_gui->message_published(); }
+   case WM_SAVERERROR: { return c_gui->message_saver_error(); }
+   case WM_RESTOREPROGRESS: { return c_gui->message_restore_progress(); }
+   case WM_REMOTERESTORE: { return c_gui->message_remote_restore(lparam); }
+   case WM_DISPLAYCHANGE: { return c_gui->message_display_change(); }
+   default:
+   {
+      LRESULT ret = c_gui->message_default(message, wparam, lparam);
+      if (ret != RET_DEF_PROC) return ret;
+   }
+   }
+   return DefWindowProc(hwnd, message, wparam, lparam);
+}
+
+LRESULT DesktopSaverGui::message_timer(WPARAM timer_id)
+{
+   if (timer_id == m_probe_timer_id)
+   {
+      m_worker->PostSettleProbe();
+      return 0;
+   }
+
+   // This should never happen, but isn't necessarily a critical error
+   if (timer_id != m_timer_id) INTERNAL_ERROR(L"An unknown (external) timer event was received!");
+
+   poll(true);
+
+   return 0;
+}
+
+LRESULT DesktopSaverGui::message_published()
+{
+   // Changing the poll rate only takes effect once the worker gets to it
+   if (!m_worker) return 0;
+
+   const auto view = m_worker->GetView();
+   if (view->rate != m_timer_rate) update_timer(view->rate);
+
+   // Keep probing for as long as something is waiting to settle
+   if (view->settling != m_probing)
+   {
+      m_probing = view->settling;
+      if (m_probing) SetTimer(m_hwnd, m_probe_timer_id, DesktopSaver::SettleProbeMilliseconds, (TIMERPROC)0);
+      else KillTimer(m_hwnd, m_probe_timer_id);
+   }
+
+   return 0;
+}
+
+LRESULT DesktopSaverGui::message_saver_error()
+{
+   if (!m_worker) return 0;
+
+   // The worker carries on in the meantime
+   for (const auto &error : m_worker->TakeErrors()) STANDARD_ERROR(error);
+   return 0;
+}
+
+LRESULT DesktopSaverGui::message_display_change()
+{
+   // Put back whatever we last saw on these monitors once Explorer is
+   // done rearranging it (the polls won't record it in the meantime)
+   if (m_worker) m_worker->Post([](DesktopSaver &s) { s.DisplayChanged(); });
+   return 0;
+}
+
+LRESULT DesktopSaverGui::message_restore_progress()
+{
+   // Move anything that's done over to the finished list
+   for (auto i = m_restores.begin(); i != m_restores.end(); )
+   {
+      const RestoreJob::State state = (*i)->GetProgress().state;
+      if (state != RestoreJob::Finished && state != RestoreJob::Cancelled) { ++i; continue; }
+
+      m_finished_restores.push_back(*i);
+      while (m_finished_restores.size() > MaxFinishedRestores) m_finished_restores.pop_front();
+
+      i = m_restores.erase(i);
+   }
+
+   update_tooltip();
+   return 0;
+}
+
+LRESULT DesktopSaverGui::message_remote_restore(LPARAM job)
+{
+   unique_ptr<shared_ptr<RestoreJob>> adopted(reinterpret_cast<shared_ptr<RestoreJob>*>(job));
+   m_restores.push_back(*adopted);
+
+   // It may well be done already
+   return message_restore_progress();
+}
+
+wstring DesktopSaverGui::remote_command(const wstring &request)
+{
+   // Restores get a job like any other, so they show up in the tooltip
+   // and can be cancelled from the menu.  Only the UI thread can keep
+   // track of it though, so it's handed over there.
+   shared_ptr<RestoreJob> job;
+   if (DesktopSaver::IsRestoreCommand(request))
+   {
+      const HWND hwnd = m_hwnd;
+      job = make_shared<RestoreJob>(L"'" + request + L"' from the command line", [hwnd] { PostMessage(hwnd, WM_RESTOREPROGRESS, 0, 0); });
+      PostMessage(m_hwnd, WM_REMOTERESTORE, 0, LPARAM(new shared_ptr<RestoreJob>(job)));
+   }
+
+   // The worker outlives this server, so this always gets an answer
+   auto answer = make_shared<promise<wstring>>();
+   future<wstring> result = answer->get_future();
+
+   m_worker->Post([request, job, answer](DesktopSaver &s)
+   {
+      answer->set_value(s.RunCommand(request, job.get()));
+      if (job) job->Finish(job->CancelRequested());
+   });
+
+   return result.get();
+}
+
+void DesktopSaverGui::restore(const wstring &description, function<void(DesktopSaver&, RestoreJob*)> work)
+{
+   const HWND hwnd = m_hwnd;
+   auto job = make_shared<RestoreJob>(description, [hwnd] { PostMessage(hwnd, WM_RESTOREPROGRESS, 0, 0); });
+   m_restores.push_back(job);
+
+   // In case it never got as far as actually restoring anything
+   m_worker->Post([job, work](DesktopSaver &s) { work(s, job.get()); job->Finish(job->CancelRequested()); });
+
+   update_tooltip();
+}
+
+void DesktopSaverGui::update_tooltip()
+{
+   if (!m_restores.empty())
+   {
+      const RestoreJob &job = *m_restores.front();
+      const RestoreJob::Progress p = job.GetProgress();
+
+      if (p.state == RestoreJob::Queued) m_tray_icon->SetTooltip(L"Waiting to restore " + job.Description());
+      else if (p.total == 0) m_tray_icon->SetTooltip(L"Restoring " + job.Description());
+      else m_tray_icon->SetTooltip(WSTRING(L"Restoring (pass " << p.pass << L"): " << p.moved << L" of " << p.total << L" icons"));
+      return;
+   }
+
+   if (!m_finished_restores.empty())
+   {
+      const RestoreJob &job = *m_finished_restores.back();
+      const RestoreJob::Progress p = job.GetProgress();
+
+      m_tray_icon->SetTooltip(WSTRING(m_qualified_name << L"\n" << (p.state == RestoreJob::Cancelled ? L"Cancelled" : L"Restored") << L" in " << format_seconds(p.seconds)));
+      return;
+   }
+
+   m_tray_icon->SetTooltip(m_qualified_name);
+}
+
+void DesktopSaverGui::poll(bool settle)
+{
+   m_worker->PostPoll(settle);
+}
+
+LRESULT DesktopSaverGui::message_default(UINT message, WPARAM wparam, LPARAM lparam)
+{
+   if (message == m_taskbar_restart_message)
+   {
+      // After an explorer crash, you have to re-add your icons to the tray
+      m_tray_icon->RestoreIcon();
+
+      // Because explorer probably just restarted, it might be a good
+      // idea to poll immediately and see what havok was caused (once
+      // it's done shuffling everything around).
+      poll(true);
+
+      return 0;
+   }
+
+   // Tell our WndProc to use DefWindowProc for all other unhandled messages
+   return RET_DEF_PROC;
+}
+
+LRESULT DesktopSaverGui::message_create(HWND hwnd)
+{
+   // WARNING: Do not use m_hwnd in this message, it's not valid at this
+   //          point!  Instead, use the passed-in hwnd from WndProc
+
+   // Register that we want to know when explorer.exe recovers from a crash
+   m_taskbar_restart_message = RegisterWindowMessage(L"TaskbarCreated");
+
+   return 0;
+}
+
+LRESULT DesktopSaverGui::message_destroy()
+{
+   // WM_ENDSESSION may have gotten here first
+   if (!m_worker) return 0;
+
+   // Stop the automatic polling
+   KillTimer(m_hwnd, m_timer_id);
+   KillTimer(m_hwnd, m_probe_timer_id);
+
+   // Finish answering whoever is asking something right now
+   m_server.reset();
+
+   // Poll one last time just before we shut down, waiting for
+   // that (and anything else still in progress) to finish
+   poll();
+   m_worker.reset();
+
+   // Signal that we're quitting
+   PostQuitMessage(0);
+
+   return 0;
+}
+
+LRESULT DesktopSaverGui::message_tray(WPARAM w, LPARAM l)
+{
+   switch (l)
+   {
+   case WM_LBUTTONUP:
+   case WM_RBUTTONUP:
+   case WM_CONTEXTMENU:
+      // Only let certain messages pass through (all of which
+      // simply pop-up the menu)
+      break;
+
+   default: return DefWindowProc(m_hwnd, WM_TRAYMESSAGE, w, l);
+   }
+
+   // Poll just before we create the menu so that anything that changed
+   // shows up soon.  The menu itself never waits on the worker: it shows
+   // the latest view it has already published.
+   poll();
+
+   // Only the parts of the menu whose data changed are rebuilt
+   const chrono::steady_clock::time_point start = chrono::steady_clock::now();
+   HMENU menu = m_tray_menu->Build(m_worker->GetView(), !m_restores.empty());
+
+   m_menu_last_ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+   if (m_menu_last_ms > m_menu_max_ms) m_menu_max_ms = m_menu_last_ms;
+   m_menu_total_ms += m_menu_last_ms;
+   m_menu_shown++;
+
+   // We need the cursor position to know where to pop up the menu
+   POINT point;
+   GetCursorPos(&point);
+
+   // Some of this jazz is required because of a Microsoft KB article having 
+   // to do with popup menus not disappearing if you click elsewhere.
+   SetForegroundWindow(m_hwnd);
+   TrackPopupMenu(menu, TPM_RIGHTALIGN | TPM_BOTTOMALIGN, point.x, point.y, 0, m_hwnd, 0);
+   PostMessage(m_hwnd, WM_NULL, 0, 0);
+
+   // The menu is kept around for next time
+   return 0;
+}
+
+LRESULT DesktopSaverGui::message_menu(WPARAM choice)
+{
+   switch (choice)
+   {
+   case WM_Tray_History_Clear:
+      {
+         if (ASK_QUESTION(L"Are you sure you want to erase your icon position history?\n(Your named profiles will remain intact)."))
+            m_worker->Post([](DesktopSaver &s) { s.ClearHistory(); });
+
+         break;
+      }
+
+   case WM_Tray_Exit:
+      { 
+         SendMessage(m_hwnd, WM_DESTROY, 0, 0);
+         break;
+      }
+
+   case WM_Tray_Profile_Create:
+      {
+         wstring name = AskForNewProfileName(m_hinstance, m_hwnd);
+
+         // If the user presses cancel in the dialog (or just
+         // leaves the box blank), it comes back empty.
+         if (name == L"") break;
+
+         // Check that this (case insensitive) name doesn't already exist.
+         const shared_ptr<const SaverView> view = m_worker->GetView();
+         const IconHistory *duplicate = view->named_profiles.Find(name);
+
+         if (!duplicate) m_worker->Post([name](DesktopSaver &s) { s.NamedProfileAdd(name); });
+         else
+         {
+            const wstring duplicate_profile_name = duplicate->GetName();
+            if (ASK_QUESTION(L"A profile with the name '" << duplicate_profile_name << L"' already exists.  Overwrite?")) m_worker->Post([duplicate_profile_name](DesktopSaver &s) { s.NamedProfileOverwrite(duplicate_profile_name); });
+         }
+
+         break;
+      }
+
+   case WM_Tray_On_Startup:
+      {
+         DesktopSaver::SetRunOnStartup(!DesktopSaver::GetRunOnStartup());
+         break;
+      }
+
+   case WM_Tray_Compact_History:
+      {
+         const bool compact = !m_worker->GetView()->compact;
+         m_worker->Post([compact](DesktopSaver &s) { s.SetCompactHistory(compact); });
+         break;
+      }
+
+   case WM_Tray_Snap_To_Grid:
+      {
+         const bool snap = !m_worker->GetView()->snap_to_grid;
+         m_worker->Post([snap](DesktopSaver &s) { s.SetSnapToGrid(snap); });
+         break;
+      }
+
+   case WM_Tray_Display_Restore:
+      {
+         const bool restore = !m_worker->GetView()->display_restore;
+         m_worker->Post([restore](DesktopSaver &s) { s.SetDisplayRestore(restore); });
+         break;
+      }
+
+   case WM_Tray_Show_Stats:
+      {
+         wstring restores;
+         for (auto i = m_finished_restores.rbegin(); i != m_finished_restores.rend(); ++i)
+         {
+            const RestoreJob::Progress p = (*i)->GetProgress();
+            restores += WSTRING((*i)->Description() << L": " << (p.state == RestoreJob::Cancelled ? L"cancelled after " : L"") << format_seconds(p.seconds) << L", " << p.pass << L" passes\n");
+         }
+         if (restores.empty()) restores = L"None yet.\n";
+
+         const SettleStats settle = m_worker->GetView()->settle;
+         const wstring polling = WSTRING(settle.commits << L" layouts recorded, " << settle.held << L" held until the desktop settled ("
+            << settle.superseded << L" superseded before being recorded), " << settle.probes << L" probes\n"
+            << settle.display_restores << L" layouts restored after the monitors changed ("
+            << settle.display_moves_saved << L" moves saved by leaving the other monitors alone)\n");
+
+         const wstring menu = WSTRING(L"Shown " << m_menu_shown << L" times, rebuilt " << m_tray_menu->RebuildCount() << L" times\n"
+            << L"Ready in " << fixed << setprecision(3) << m_menu_last_ms << L" ms last time, " << (m_menu_shown ? m_menu_total_ms / m_menu_shown : 0.0) << L" ms on average, " << m_menu_max_ms << L" ms at worst\n");
+
+         MessageBox(m_hwnd, WSTRING(L"Recent restores:\n\n" << restores << L"\nPolling:\n\n" << polling << L"\nTray menu:\n\n" << menu << L"\nHeap allocations by region:\n\n" << AllocStats::Report()).c_str(), L"DesktopSaver Statistics", MB_ICONINFORMATION);
+         break;
+      }
+
+   case WM_Tray_Disable_History:
+      {
+         PollRate current = m_worker->GetView()->rate;
+
+         if (current != DisableHistory && ASK_QUESTION(L"Disabling your history will erase all history snapshots.  Continue?\n(Your named profiles will remain intact)."))
+         {
+            // We must set the poll rate before clearing the history
+            // otherwise a poll will occur *just* after the clear
+            // and it won't be stopped by the disable bit.  (The timer
+            // is stopped once the worker publishes the new rate.)
+            m_worker->Post([](DesktopSaver &s) { s.SetPollRate(DisableHistory); s.ClearHistory(); });
+         }
+         break;
+      }
+
+   case WM_Tray_As_Of_Hour: restore_as_of(60 * 60); break;
+   case WM_Tray_As_Of_Day:  restore_as_of(24 * 60 * 60); break;
+   case WM_Tray_As_Of_Week: restore_as_of(7 * 24 * 60 * 60); break;
+
+   case WM_Tray_Restore_Closest:
+      {
+         restore(L"the closest layout", [](DesktopSaver &s, RestoreJob *job) { if (!s.RestoreClosest(job)) s.ReportError(L"None of your history or named profiles differ from the desktop as it is now."); });
+         break;
+      }
+
+   case WM_Tray_Cancel_Restore:
+      {
+         for (const auto &job : m_restores) job->Cancel();
+         break;
+      }
+
+   case WM_Tray_Poll_Endpoints: m_worker->Post([](DesktopSaver &s) { s.SetPollRate(PollEndpoints); }); break;
+   case WM_Tray_Poll_Interval1: m_worker->Post([](DesktopSaver &s) { s.SetPollRate(Interval1); });     break;
+   case WM_Tray_Poll_Interval2: m_worker->Post([](DesktopSaver &s) { s.SetPollRate(Interval2); });     break;
+   case WM_Tray_Poll_Interval3: m_worker->Post([](DesktopSaver &s) { s.SetPollRate(Interval3); });     break;
+   case WM_Tray_Poll_Interval4: m_worker->Post([](DesktopSaver &s) { s.SetPollRate(Interval4); });     break;
+
+   default:
+      {
+         if (choice < WM_Lookup_Begin) break;
+         if (choice >= WM_Lookup_End) break;
+
+         bool handled = false;
+
+         // Choices are numbered by the view the menu was built from
+         const shared_ptr<const SaverView> &view = m_tray_menu->View();
+         if (!view) break;
+         const HistoryList &history = view->history;
+
+         // History selection
+         if (choice >= WM_Tray_History + 0 && choice < WM_Tray_History + DesktopSaver::MaxIconHistoryCount)
+         {
+            int menu_choice = ((UINT)choice - WM_Tray_History);
+            int history_choice = int(history.size() - menu_choice - 1);
+
+            const IconHistory h = history[history_choice];
+            restore(h.GetName(), [h](DesktopSaver &s, RestoreJob *job) { s.RestoreHistory(h, job); });
+            handled = true;
+         }
+
+         const vector<wstring> &profile_names = m_tray_menu->ProfileNames();
+         if (choice >= WM_Tray_Profile_Command + 0 && choice < TrayMenu::ProfileCommand(profile_names.size(), TrayMenu::ProfileRestore))
+         {
+            const size_t command = choice - WM_Tray_Profile_Command;
+            const wstring name = profile_names[command / TrayMenu::ProfileActionCount];
+
+            switch (TrayMenu::ProfileAction(command % TrayMenu::ProfileActionCount))
+            {
+            case TrayMenu::ProfileRestore:
+               {
+                  const IconHistory *profile = view->named_profiles.Find(name);
+                  if (!profile) break;
+
+                  const IconHistory h = *profile;
+                  restore(name, [h](DesktopSaver &s, RestoreJob *job) { s.RestoreHistory(h, job); });
+                  break;
+               }
+
+            case TrayMenu::ProfileOverwrite:
+               if (ASK_QUESTION(L"Overwrite '" << name << L"' profile with current desktop snapshot?")) m_worker->Post([name](DesktopSaver &s) { s.NamedProfileOverwrite(name); });
+               break;
+
+            case TrayMenu::ProfileDelete:
+               if (ASK_QUESTION(L"Are you sure you want to delete the '" << name << L"' profile?")) m_worker->Post([name](DesktopSaver &s) { s.NamedProfileDelete(name); });
+               break;
+
+            case TrayMenu::ProfileAutostart:
+               DesktopSaver::NamedProfileAutostart(name);
+               break;
+
+            default: break;
+            }
+
+            handled = true;
+         }
+
+         const vector<TrayMenu::IconChoice> &icon_choices = m_tray_menu->IconChoices();
+         if (choice >= WM_Tray_Icon_Position + 0 && choice < WM_Tray_Icon_Position + icon_choices.size())
+         {
+            const TrayMenu::IconChoice icon = icon_choices[choice - WM_Tray_Icon_Position];
+            restore(icon.name, [icon](DesktopSaver &s, RestoreJob *job) { s.RestoreIcon(icon.name, icon.key, icon.x, icon.y, job); });
+            handled = true;
+         }
+
+         const vector<IconHistory> &timeline_choices = m_tray_menu->TimelineChoices();
+         if (choice >= WM_Tray_Timeline + 0 && choice < WM_Tray_Timeline + timeline_choices.size())
+         {
+            const IconHistory slice = timeline_choices[choice - WM_Tray_Timeline];
+
+            restore(slice.GetName(), [slice](DesktopSaver &s, RestoreJob *job) { s.RestoreHistory(slice, job); });
+            handled = true;
+         }
+
+         if (!handled) STANDARD_ERROR(L"Unexpected 'choice' in popup menu");
+      }
+
+   } // switch
+
+   return 0;
+}
+
+void DesktopSaverGui::restore_as_of(int64_t seconds_ago)
+{
+   const int64_t when = int64_t(time(nullptr)) - seconds_ago;
+   restore(L"the layout from " + TrayMenu::FormatTime(when), [when](DesktopSaver &s, RestoreJob *job) { if (!s.RestoreAsOf(when, job)) s.ReportError(L"Your icon history doesn't go back that far yet."); });
+}
+
+void DesktopSaverGui::update_timer(PollRate rate)
+{
+   KillTimer(m_hwnd, m_timer_id);
+   m_timer_rate = rate;
+
+   UINT timer_delay = DesktopSaver::PollRateMilliseconds(rate);
+   if (timer_delay == 0) return;
+
+   if (!SetTimer(m_hwnd, m_timer_id, timer_delay, (TIMERPROC)0))
+   {
+      INTERNAL_ERROR(L"Couldn't set polling timer!");
+      exit(1);
+   }
+}
@@ -1,42 +1,85 @@
-// DesktopSaver, (c)2006-2016 Nicholas Piegdon, MIT licensed
-#pragma once
-
-#include <windows.h>
-#include <string>
-#include <memory>
-
-class DesktopSaver;
-class TrayIcon;
-
-class DesktopSaverGui
-{
-public:
-   DesktopSaverGui(HINSTANCE h_instance);
-   ~DesktopSaverGui();
-
-   int Run();
-
-private:
-   std::unique_ptr<DesktopSaver> m_saver;
-   static DesktopSaverGui *c_gui;
-   static LRESULT CALLBACK proc(HWND hwnd, UINT message, WPARAM wparam, LPARAM lparam);
-
-   LRESULT message_destroy();
-   LRESULT message_create(HWND hwnd);
-   LRESULT message_timer(WPARAM timer_id);
-   LRESULT message_tray(WPARAM w, LPARAM l);
-   LRESULT message_menu(WPARAM choice);
-   LRESULT message_default(UINT message, WPARAM wparam, LPARAM lparam);
-
-   HMENU build_dynamic_menu();
-
-   void update_timer();
-
-   HWND m_hwnd;
-   HINSTANCE m_hinstance;
-
-   UINT m_taskbar_restart_message;
-   UINT_PTR m_timer_id;
-
-   std::unique_ptr<TrayIcon> m_tray_icon;
-};
+// DesktopSaver, (c)2006-2016 Nicholas Piegdon, MIT licensed
+#pragma once
+
+#include <windows.h>
+#include <string>
+#include <vector>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <cstdint>
+#include "saver.h"
+
+class SaverWorker;
+class TrayIcon;
+class TrayMenu;
+class CommandServer;
+
+class DesktopSaverGui
+{
+public:
+   DesktopSaverGui(HINSTANCE h_instance);
+   ~DesktopSaverGui();
+
+   int Run();
+
+private:
+   // All of the actual work happens on the worker's thread
+   std::unique_ptr<SaverWorker> m_worker;
+
+   // Answers requests from DesktopSaver processes started later
+   // (e.g. from a script), on a thread of its own
+   std::unique_ptr<CommandServer> m_server;
+   std::wstring remote_command(const std::wstring &request);
+   static DesktopSaverGui *c_gui;
+   static LRESULT CALLBACK proc(HWND hwnd, UINT message, WPARAM wparam, LPARAM lparam);
+
+   LRESULT message_destroy();
+   LRESULT message_create(HWND hwnd);
+   LRESULT message_timer(WPARAM timer_id);
+   LRESULT message_tray(WPARAM w, LPARAM l);
+   LRESULT message_menu(WPARAM choice);
+   LRESULT message_published();
+   LRESULT message_restore_progress();
+   LRESULT message_display_change();
+   LRESULT message_saver_error();
+   LRESULT message_remote_restore(LPARAM job);
+   LRESULT message_default(UINT message, WPARAM wparam, LPARAM lparam);
+
+   void update_timer(PollRate rate);
+   void restore_as_of(int64_t seconds_ago);
+
+   // Queues a restore on the worker, with its progress shown in the tooltip
+   void restore(const std::wstring &description, std::function<void(DesktopSaver&, RestoreJob*)> work);
+   void update_tooltip();
+   // With 'settle', a change waits until the desktop has been still for
+   // a moment (see DesktopSaver::SettlePending)
+   void poll(bool settle = false);
+
+   HWND m_hwnd;
+   HINSTANCE m_hinstance;
+
+   UINT m_taskbar_restart_message;
+   UINT_PTR m_timer_id;
+   PollRate m_timer_rate;
+
+   // Runs only while the worker is holding a layout for the desktop to settle
+   UINT_PTR m_probe_timer_id;
+   bool m_probing;
+
+   std::unique_ptr<TrayIcon> m_tray_icon;
+   std::wstring m_qualified_name;
+
+   // Restores that are queued or running, and the last few that finished
+   std::vector<std::shared_ptr<RestoreJob>> m_restores;
+   std::deque<std::shared_ptr<RestoreJob>> m_finished_restores;
+
+   // Kept from one click to the next, rebuilt only where it's out of date
+   std::unique_ptr<TrayMenu> m_tray_menu;
+
+   // How long it takes from a click to the menu being ready
+   unsigned long m_menu_shown;
+   double m_menu_last_ms;
+   double m_menu_max_ms;
+   double m_menu_total_ms;
+};
@@ -0,0 +1,123 @@
+// DesktopSaver, (c)2006-2016 Nicholas Piegdon, MIT licensed
+
+#include "saver_worker.h"
+#include "saver.h"
+using namespace std;
+
+SaverWorker::SaverWorker(unique_ptr<DesktopSaver> saver, HWND hwnd, UINT message, UINT error_message) : m_saver(move(saver)), m_hwnd(hwnd), m_message(message), m_errorMessage(error_message),
+   m_stopping(false), m_pollQueued(false), m_pollSettle(false), m_probeQueued(false)
+{
+   m_saver->SetErrorHandler([this](const wstring &message) { report(message); });
+
+   // Everything else has to be ready before the thread starts
+   m_thread = thread(&SaverWorker::run, this);
+}
+
+SaverWorker::~SaverWorker()
+{
+   {
+      lock_guard<mutex> lock(m_mutex);
+      m_stopping = true;
+   }
+   m_wake.notify_one();
+
+   m_thread.join();
+}
+
+void SaverWorker::Post(Job job)
+{
+   {
+      lock_guard<mutex> lock(m_mutex);
+      m_jobs.push_back(move(job));
+   }
+   m_wake.notify_one();
+}
+
+void SaverWorker::PostPoll(bool settle)
+{
+   {
+      lock_guard<mutex> lock(m_mutex);
+      if (m_pollQueued) { m_pollSettle = m_pollSettle && settle; return; }
+
+      m_pollQueued = true;
+      m_pollSettle = settle;
+   }
+
+   // The flag is cleared as the poll starts, so anything that changes
+   // after that gets a poll of its own
+   Post([this](DesktopSaver &s)
+   {
+      bool settle = false;
+      {
+         lock_guard<mutex> lock(m_mutex);
+         settle = m_pollSettle;
+         m_pollQueued = false;
+      }
+
+      s.PollDesktopIcons(settle);
+   });
+}
+
+void SaverWorker::PostSettleProbe()
+{
+   {
+      lock_guard<mutex> lock(m_mutex);
+      if (m_probeQueued) return;
+      m_probeQueued = true;
+   }
+
+   Post([this](DesktopSaver &s)
+   {
+      {
+         lock_guard<mutex> lock(m_mutex);
+         m_probeQueued = false;
+      }
+
+      s.SettlePending();
+   });
+}
+
+vector<wstring> SaverWorker::TakeErrors()
+{
+   vector<wstring> errors;
+
+   lock_guard<mutex> lock(m_mutex);
+   errors.swap(m_errors);
+   return errors;
+}
+
+void SaverWorker::report(const wstring &message)
+{
+   {
+      lock_guard<mutex> lock(m_mutex);
+      m_errors.push_back(message);
+   }
+
+   PostMessage(m_hwnd, m_errorMessage, 0, 0);
+}
+
+shared_ptr<const SaverView> SaverWorker::GetView() const
+{
+   return m_saver->GetView();
+}
+
+void SaverWorker::run()
+{
+   for (;;)
+   {
+      Job job;
+      {
+         unique_lock<mutex> lock(m_mutex);
+         m_wake.wait(lock, [this] { return m_stopping || !m_jobs.empty(); });
+
+         // Anything queued before we were told to stop still runs
+         if (m_jobs.empty()) return;
+
+         job = move(m_jobs.front());
+         m_jobs.pop_front();
+      }
+
+      job(*m_saver);
+      PostMessage(m_hwnd, m_message, 0, 0);
+   }
+}
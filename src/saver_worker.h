@@ -0,0 +1,75 @@
+// DesktopSaver, (c)2006-2016 Nicholas Piegdon, MIT licensed
+#pragma once
+
+#include <windows.h>
+#include <memory>
+#include <functional>
+#include <deque>
+#include <string>
+#include <vector>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+
+class DesktopSaver;
+struct SaverView;
+
+// Owns a DesktopSaver and runs everything that touches it (polls,
+// restores, profile changes) on one background thread, in the order it
+// was asked for.  The UI thread only ever reads the views the saver
+// publishes, so it never has to wait on a slow poll or restore.
+//
+// After each job, 'message' is posted to 'hwnd' so the UI can pick up
+// whatever changed.  Nothing on the worker ever shows any UI itself:
+// errors the saver reports are queued up and 'error_message' is posted so
+// the UI thread can show them (see TakeErrors).
+class SaverWorker
+{
+public:
+   typedef std::function<void(DesktopSaver&)> Job;
+
+   SaverWorker(std::unique_ptr<DesktopSaver> saver, HWND hwnd, UINT message, UINT error_message);
+
+   // Finishes everything still queued before returning
+   ~SaverWorker();
+
+   void Post(Job job);
+
+   // Polls and settle probes are asked for on every timer tick and every
+   // click on the tray icon.  If one is already waiting in the queue,
+   // asking again doesn't add another.  (A waiting poll that's asked for
+   // again without 'settle' records right away.)
+   void PostPoll(bool settle);
+   void PostSettleProbe();
+
+   // Everything reported since the last call, oldest first
+   std::vector<std::wstring> TakeErrors();
+
+   // Safe to call from any thread
+   std::shared_ptr<const SaverView> GetView() const;
+
+private:
+   // Explicitly deny copying and assignment
+   SaverWorker(const SaverWorker&);
+   SaverWorker &operator=(const SaverWorker&);
+
+   void run();
+   void report(const std::wstring &message);
+
+   std::unique_ptr<DesktopSaver> m_saver;
+   HWND m_hwnd;
+   UINT m_message;
+   UINT m_errorMessage;
+
+   std::mutex m_mutex;
+   std::condition_variable m_wake;
+   std::deque<Job> m_jobs;
+   bool m_stopping;
+
+   bool m_pollQueued;
+   bool m_pollSettle;
+   bool m_probeQueued;
+   std::vector<std::wstring> m_errors;
+
+   std::thread m_thread;
+};
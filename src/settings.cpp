@@ -0,0 +1,435 @@
+// DesktopSaver, (c)2006-2016 Nicholas Piegdon, MIT licensed
+
+#include "settings.h"
+#include "string_util.h"
+
+#include <cstdio>
+#include <cstdlib>
+
+#ifdef _WIN32
+#include <windows.h>
+#include "registry.h"
+#endif
+
+using namespace std;
+
+const wchar_t *Settings::KeyName(Key k)
+{
+   switch (k)
+   {
+   case PollRateKey:         return L"poll_rate";
+   case CompactHistoryKey:   return L"compact_history";
+   case HistoryBudgetKey:    return L"history_budget_kb";
+   case AutostartProfileKey: return L"profile_autostart";
+   case RunOnStartupKey:     return L"run_on_startup";
+   case MoveToleranceKey:    return L"move_tolerance";
+   case SnapToGridKey:       return L"snap_to_grid";
+   case SettleTimeKey:       return L"settle_ms";
+   case DisplayRestoreKey:   return L"display_restore";
+   case PartialRestoreKey:   return L"partial_restore";
+   default:                  return L"";
+   }
+}
+
+bool Settings::IsText(Key k)
+{
+   return k == AutostartProfileKey || k == RunOnStartupKey;
+}
+
+#if defined(_WIN32) && !defined(DESKTOPSAVER_PORTABLE)
+
+// Everything lives under HKCU/Software/DesktopSaver, except running on
+// startup, which is our entry in HKCU/.../Run
+class SettingsRegistry : public SettingsStore
+{
+public:
+   SettingsRegistry() : m_program(Registry::CurrentUser, L"DesktopSaver"), m_run(Registry::CU_Run, L""), m_event(CreateEvent(NULL, FALSE, FALSE, NULL))
+   {
+      watch();
+   }
+
+   ~SettingsRegistry() { CloseHandle(m_event); }
+
+   void Load(Settings::Values &values)
+   {
+      for (int i = 0; i < Settings::KeyCount; ++i)
+      {
+         const Settings::Key k = Settings::Key(i);
+         Settings::Value &v = values[k];
+
+         if (Settings::IsText(k)) v.present = key(k).Read(name(k), &v.text, wstring());
+         else v.present = key(k).Read(name(k), &v.number, 0);
+      }
+   }
+
+   void Save(const Settings::Values &values, const vector<bool> &changed)
+   {
+      for (int i = 0; i < Settings::KeyCount; ++i)
+      {
+         const Settings::Key k = Settings::Key(i);
+         if (!changed[k]) continue;
+
+         const Settings::Value &v = values[k];
+         if (!v.present) key(k).Delete(name(k));
+         else if (Settings::IsText(k)) key(k).Write(name(k), v.text);
+         else key(k).Write(name(k), v.number);
+      }
+   }
+
+   bool Changed()
+   {
+      if (WaitForSingleObject(m_event, 0) != WAIT_OBJECT_0) return false;
+
+      // Notifications only fire once
+      watch();
+      return true;
+   }
+
+private:
+   // Explicitly deny copying and assignment
+   SettingsRegistry(const SettingsRegistry&);
+   SettingsRegistry &operator=(const SettingsRegistry&);
+
+   void watch()
+   {
+      m_program.Watch(m_event);
+      m_run.Watch(m_event);
+   }
+
+   Registry &key(Settings::Key k) { return k == Settings::RunOnStartupKey ? m_run : m_program; }
+   wstring name(Settings::Key k) const { return k == Settings::RunOnStartupKey ? L"DesktopSaver" : Settings::KeyName(k); }
+
+   Registry m_program;
+   Registry m_run;
+   HANDLE m_event;
+};
+
+static unique_ptr<SettingsStore> default_store() { return unique_ptr<SettingsStore>(new SettingsRegistry()); }
+
+#elif defined(_WIN32)
+
+// Portable builds keep everything in a SettingsFile, except running on
+// startup: Windows only ever looks for that in HKCU/.../Run
+class SettingsPortable : public SettingsStore
+{
+public:
+   SettingsPortable() : m_file(SettingsFile::DefaultPath()), m_run(Registry::CU_Run, L""), m_event(CreateEvent(NULL, FALSE, FALSE, NULL))
+   {
+      m_run.Watch(m_event);
+   }
+
+   ~SettingsPortable() { CloseHandle(m_event); }
+
+   void Load(Settings::Values &values)
+   {
+      m_file.Load(values);
+
+      Settings::Value &v = values[Settings::RunOnStartupKey];
+      v = Settings::Value();
+      v.present = m_run.Read(RunName, &v.text, wstring());
+   }
+
+   void Save(const Settings::Values &values, const vector<bool> &changed)
+   {
+      Settings::Values in_file(values);
+      in_file[Settings::RunOnStartupKey] = Settings::Value();
+      m_file.Save(in_file, changed);
+
+      if (!changed[Settings::RunOnStartupKey]) return;
+
+      const Settings::Value &v = values[Settings::RunOnStartupKey];
+      if (v.present) m_run.Write(RunName, v.text);
+      else m_run.Delete(RunName);
+   }
+
+   bool Changed()
+   {
+      const bool file = m_file.Changed();
+      if (WaitForSingleObject(m_event, 0) != WAIT_OBJECT_0) return file;
+
+      // Notifications only fire once
+      m_run.Watch(m_event);
+      return true;
+   }
+
+private:
+   // Explicitly deny copying and assignment
+   SettingsPortable(const SettingsPortable&);
+   SettingsPortable &operator=(const SettingsPortable&);
+
+   static const wchar_t *RunName;
+
+   SettingsFile m_file;
+   Registry m_run;
+   HANDLE m_event;
+};
+
+const wchar_t *SettingsPortable::RunName = L"DesktopSaver";
+
+static unique_ptr<SettingsStore> default_store() { return unique_ptr<SettingsStore>(new SettingsPortable()); }
+
+#else
+
+static unique_ptr<SettingsStore> default_store() { return unique_ptr<SettingsStore>(new SettingsFile(SettingsFile::DefaultPath())); }
+
+#endif
+
+Settings &Settings::Current()
+{
+   // NOTE: This isn't thread-safe before VS2015, so the first call has to
+   //       happen before there's more than one thread (DesktopSaver's
+   //       constructor takes care of that).
+   static Settings settings(default_store());
+   return settings;
+}
+
+Settings::Settings(unique_ptr<SettingsStore> store) : m_store(move(store)), m_values(KeyCount), m_dirty(KeyCount, false), m_pending(false), m_stopping(false), m_version(0)
+{
+   m_store->Load(m_values);
+   m_thread = thread(&Settings::run, this);
+}
+
+Settings::~Settings()
+{
+   {
+      lock_guard<mutex> lock(m_mutex);
+      m_stopping = true;
+   }
+   m_wake.notify_one();
+
+   m_thread.join();
+}
+
+void Settings::run()
+{
+   unique_lock<mutex> lock(m_mutex);
+   for (;;)
+   {
+      m_wake.wait(lock, [this] { return m_stopping || m_pending; });
+
+      // Give whatever else is about to change a chance to join in
+      if (!m_stopping) m_wake.wait_for(lock, chrono::milliseconds(WriteDelayMilliseconds), [this] { return m_stopping; });
+
+      flush();
+      if (m_stopping) return;
+   }
+}
+
+void Settings::flush()
+{
+   if (!m_pending) return;
+
+   m_store->Save(m_values, m_dirty);
+
+   m_dirty.assign(KeyCount, false);
+   m_pending = false;
+}
+
+void Settings::Flush()
+{
+   lock_guard<mutex> lock(m_mutex);
+   flush();
+}
+
+void Settings::UseStore(unique_ptr<SettingsStore> store)
+{
+   lock_guard<mutex> lock(m_mutex);
+   flush();
+
+   m_store = move(store);
+   m_values.assign(KeyCount, Value());
+   m_store->Load(m_values);
+   m_version++;
+}
+
+void Settings::refresh()
+{
+   if (!m_store->Changed()) return;
+
+   // Our own changes that haven't gone out yet still win
+   Values fresh(KeyCount);
+   m_store->Load(fresh);
+   for (int k = 0; k < KeyCount; ++k) if (!m_dirty[k]) m_values[k] = fresh[k];
+   m_version++;
+}
+
+unsigned long Settings::Version()
+{
+   lock_guard<mutex> lock(m_mutex);
+   refresh();
+   return m_version;
+}
+
+bool Settings::Has(Key k)
+{
+   lock_guard<mutex> lock(m_mutex);
+   refresh();
+   return m_values[k].present;
+}
+
+int Settings::GetNumber(Key k, int defaultValue)
+{
+   lock_guard<mutex> lock(m_mutex);
+   refresh();
+   return m_values[k].present ? m_values[k].number : defaultValue;
+}
+
+wstring Settings::GetText(Key k, const wstring &defaultValue)
+{
+   lock_guard<mutex> lock(m_mutex);
+   refresh();
+   return m_values[k].present ? m_values[k].text : defaultValue;
+}
+
+void Settings::set(Key k, const Value &value)
+{
+   m_values[k] = value;
+   m_dirty[k] = true;
+   m_version++;
+
+   if (m_pending) return;
+   m_pending = true;
+   m_wake.notify_one();
+}
+
+void Settings::SetNumber(Key k, int value)
+{
+   Value v;
+   v.present = true;
+   v.number = value;
+
+   lock_guard<mutex> lock(m_mutex);
+   set(k, v);
+}
+
+void Settings::SetText(Key k, const wstring &value)
+{
+   Value v;
+   v.present = true;
+   v.text = value;
+
+   lock_guard<mutex> lock(m_mutex);
+   set(k, v);
+}
+
+void Settings::Remove(Key k)
+{
+   lock_guard<mutex> lock(m_mutex);
+   set(k, Value());
+}
+
+
+SettingsFile::SettingsFile(const wstring &path) : m_path(path), m_checked(chrono::steady_clock::now())
+{
+}
+
+wstring SettingsFile::DefaultPath()
+{
+#ifdef _WIN32
+   wchar_t module[MAX_PATH] = L"";
+   GetModuleFileName(NULL, module, MAX_PATH);
+
+   const wstring program(module);
+   const size_t slash = program.find_last_of(L"\\/");
+   return (slash == wstring::npos ? wstring() : program.substr(0, slash + 1)) + L"DesktopSaver.ini";
+#else
+   const char *home = getenv("HOME");
+   return FromUtf8(string(home ? home : ".") + "/.desktopsaver");
+#endif
+}
+
+static FILE *open_file(const wstring &path, const wchar_t *mode)
+{
+   FILE *f = nullptr;
+#ifdef _WIN32
+   if (_wfopen_s(&f, path.c_str(), mode) != 0) return nullptr;
+#else
+   f = fopen(ToUtf8(path).c_str(), ToUtf8(mode).c_str());
+#endif
+   return f;
+}
+
+string SettingsFile::read() const
+{
+   string contents;
+
+   FILE *f = open_file(m_path, L"rb");
+   if (!f) return contents;
+
+   char buffer[1024];
+   size_t count = 0;
+   while ((count = fread(buffer, 1, sizeof(buffer), f)) > 0) contents.append(buffer, count);
+
+   fclose(f);
+   return contents;
+}
+
+void SettingsFile::Load(Settings::Values &values)
+{
+   m_contents = read();
+   m_checked = chrono::steady_clock::now();
+
+   values.assign(Settings::KeyCount, Settings::Value());
+
+   const wstring text = FromUtf8(m_contents);
+   for (size_t start = 0; start < text.length(); )
+   {
+      size_t end = text.find(L'\n', start);
+      if (end == wstring::npos) end = text.length();
+
+      wstring line = text.substr(start, end - start);
+      start = end + 1;
+
+      if (!line.empty() && line.back() == L'\r') line.pop_back();
+
+      const size_t equals = line.find(L'=');
+      if (equals == wstring::npos) continue;
+
+      const wstring name = line.substr(0, equals);
+      const wstring value = line.substr(equals + 1);
+
+      for (int i = 0; i < Settings::KeyCount; ++i)
+      {
+         const Settings::Key k = Settings::Key(i);
+         if (name != Settings::KeyName(k)) continue;
+
+         Settings::Value &v = values[k];
+         v.present = true;
+         if (Settings::IsText(k)) v.text = value;
+         else v.number = int(wcstol(value.c_str(), nullptr, 10));
+      }
+   }
+}
+
+void SettingsFile::Save(const Settings::Values &values, const vector<bool> &)
+{
+   // The file is small enough to just write all of it every time
+   wstring text;
+   for (int i = 0; i < Settings::KeyCount; ++i)
+   {
+      const Settings::Key k = Settings::Key(i);
+      const Settings::Value &v = values[k];
+      if (!v.present) continue;
+
+      text += Settings::KeyName(k);
+      text += L"=";
+      text += Settings::IsText(k) ? v.text : WSTRING(v.number);
+      text += L"\n";
+   }
+
+   FILE *f = open_file(m_path, L"wb");
+   if (!f) return;
+
+   m_contents = ToUtf8(text);
+   fwrite(m_contents.data(), 1, m_contents.size(), f);
+   fclose(f);
+}
+
+bool SettingsFile::Changed()
+{
+   const chrono::steady_clock::time_point now = chrono::steady_clock::now();
+   if (now - m_checked < chrono::milliseconds(CheckIntervalMilliseconds)) return false;
+
+   m_checked = now;
+   return read() != m_contents;
+}
@@ -0,0 +1,145 @@
+// DesktopSaver, (c)2006-2016 Nicholas Piegdon, MIT licensed
+#pragma once
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <chrono>
+
+class SettingsStore;
+
+// Every DesktopSaver setting, loaded once and then served from memory.
+// Changes are written back a moment after they're made, by a background
+// thread, so a burst of them goes out as one batch (and anything still
+// waiting is written before exit).  Edits made to the store from outside
+// are picked up the next time something is read.
+//
+// The store is the registry on Windows (the same values DesktopSaver has
+// always used) or, in portable builds (DESKTOPSAVER_PORTABLE) and anywhere
+// else, a small text file (see SettingsFile).  Running on startup is the
+// exception: on Windows it's always our entry in HKCU/.../Run, since that
+// is the only place Windows looks for it.
+//
+// Safe to use from any thread.
+class Settings
+{
+public:
+   enum Key { PollRateKey, CompactHistoryKey, HistoryBudgetKey, AutostartProfileKey, RunOnStartupKey, MoveToleranceKey, SnapToGridKey, SettleTimeKey, DisplayRestoreKey, PartialRestoreKey, KeyCount };
+
+   struct Value
+   {
+      Value() : present(false), number(0) { }
+
+      bool present;
+      int number;
+      std::wstring text;
+   };
+   typedef std::vector<Value> Values;
+
+   // What each key is called in a store, and whether it holds text or a number
+   static const wchar_t *KeyName(Key k);
+   static bool IsText(Key k);
+
+   // The instance everything in the process shares
+   static Settings &Current();
+
+   explicit Settings(std::unique_ptr<SettingsStore> store);
+
+   // Writes anything still waiting
+   ~Settings();
+
+   bool Has(Key k);
+   int GetNumber(Key k, int defaultValue);
+   bool GetBool(Key k, bool defaultValue) { return GetNumber(k, defaultValue ? 1 : 0) != 0; }
+   std::wstring GetText(Key k, const std::wstring &defaultValue);
+
+   void SetNumber(Key k, int value);
+   void SetBool(Key k, bool value) { SetNumber(k, value ? 1 : 0); }
+   void SetText(Key k, const std::wstring &value);
+   void Remove(Key k);
+
+   // Goes up whenever any setting changes, from here or outside
+   unsigned long Version();
+
+   // Writes anything still waiting, right now
+   void Flush();
+
+   // Switches to another store (after flushing to the old one), e.g. a
+   // SettingsFile in a test
+   void UseStore(std::unique_ptr<SettingsStore> store);
+
+   // How long a change waits for others to be written along with it
+   static const int WriteDelayMilliseconds = 500;
+
+private:
+   // Explicitly deny copying and assignment
+   Settings(const Settings&);
+   Settings &operator=(const Settings&);
+
+   // These expect m_mutex to be held
+   void set(Key k, const Value &value);
+   void refresh();
+   void flush();
+
+   void run();
+
+   std::unique_ptr<SettingsStore> m_store;
+   Values m_values;
+
+   // Changed here but not yet written to the store
+   std::vector<bool> m_dirty;
+   bool m_pending;
+   bool m_stopping;
+
+   unsigned long m_version;
+
+   std::mutex m_mutex;
+   std::condition_variable m_wake;
+   std::thread m_thread;
+};
+
+// Where the settings actually live
+class SettingsStore
+{
+public:
+   virtual ~SettingsStore() { }
+
+   // Reads every key, leaving any that are missing not present
+   virtual void Load(Settings::Values &values) = 0;
+
+   // Writes (or removes) the keys marked in 'changed'
+   virtual void Save(const Settings::Values &values, const std::vector<bool> &changed) = 0;
+
+   // True if something else has changed the store since it was last
+   // loaded or saved
+   virtual bool Changed() = 0;
+};
+
+// One "name=value" line per setting, in UTF-8
+class SettingsFile : public SettingsStore
+{
+public:
+   SettingsFile(const std::wstring &path);
+
+   // Next to the program for portable builds, or in the home directory
+   static std::wstring DefaultPath();
+
+   void Load(Settings::Values &values);
+   void Save(const Settings::Values &values, const std::vector<bool> &changed);
+   bool Changed();
+
+   // How often Changed() actually looks at the file
+   static const int CheckIntervalMilliseconds = 1000;
+
+private:
+   std::string read() const;
+
+   std::wstring m_path;
+
+   // What the file held when we last read or wrote it
+   std::string m_contents;
+   std::chrono::steady_clock::time_point m_checked;
+};
@@ -0,0 +1,187 @@
+// DesktopSaver, (c)2006-2016 Nicholas Piegdon, MIT licensed
+
+#include "snapshot_builder.h"
+#include "icon_history.h"
+#include "coord_compare.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cwchar>
+using namespace std;
+
+void SnapshotBuilder::Reset()
+{
+   m_arena.Reset();
+   m_icons.clear();
+   m_finished = false;
+}
+
+void SnapshotBuilder::AddIcon(const wchar_t *name, size_t length, uint64_t key, long x, long y)
+{
+   wchar_t *copy = m_arena.Allocate<wchar_t>(length);
+   wmemcpy(copy, name, length);
+
+   Entry e;
+   e.name = copy;
+   e.length = uint32_t(length);
+   e.key = key;
+   e.order = uint32_t(m_icons.size());
+   e.x = int(x);
+   e.y = int(y);
+
+   m_icons.push_back(e);
+   m_finished = false;
+}
+
+bool SnapshotBuilder::less(const Entry &a, const Entry &b)
+{
+   // The same order std::wstring uses, so IconHistory::Find still works
+   const int c = wmemcmp(a.name, b.name, min(a.length, b.length));
+   if (c != 0) return c < 0;
+   if (a.length != b.length) return a.length < b.length;
+   if (a.key != b.key) return a.key < b.key;
+   return a.order < b.order;
+}
+
+bool SnapshotBuilder::same_icon(const Entry &a, const Entry &b)
+{
+   return a.key == b.key && a.length == b.length && wmemcmp(a.name, b.name, a.length) == 0;
+}
+
+void SnapshotBuilder::Finish()
+{
+   if (m_finished) return;
+   m_finished = true;
+
+   // Snapshots coming back from the file are already in order
+   bool sorted = true;
+   for (size_t i = 1; i < m_icons.size() && sorted; ++i) sorted = less(m_icons[i - 1], m_icons[i]) && !same_icon(m_icons[i - 1], m_icons[i]);
+
+   if (!sorted)
+   {
+      // Ties are broken by insertion order, so a plain (non-allocating)
+      // sort behaves like a stable one and the first duplicate survives
+      sort(m_icons.begin(), m_icons.end(), less);
+      m_icons.erase(unique(m_icons.begin(), m_icons.end(), same_icon), m_icons.end());
+   }
+
+   m_xs.resize(m_icons.size());
+   m_ys.resize(m_icons.size());
+   for (size_t i = 0; i < m_icons.size(); ++i)
+   {
+      m_xs[i] = m_icons[i].x;
+      m_ys[i] = m_icons[i].y;
+   }
+}
+
+void SnapshotBuilder::snap_axis(vector<int> &coords, int spacing, int tolerance, vector<unsigned> &votes)
+{
+   // The grid's origin is the offset into a cell that most icons share
+   votes.assign(size_t(spacing), 0);
+   for (int c : coords) votes[size_t((c % spacing + spacing) % spacing)]++;
+   const int origin = int(max_element(votes.begin(), votes.end()) - votes.begin());
+
+   for (int &c : coords)
+   {
+      // How far past (or, if negative, short of) the nearest grid line
+      int offset = ((c - origin) % spacing + spacing) % spacing;
+      if (offset > spacing / 2) offset -= spacing;
+
+      if (offset != 0 && offset <= tolerance && offset >= -tolerance) c -= offset;
+   }
+}
+
+void SnapshotBuilder::SnapToGrid(int spacing_x, int spacing_y, int tolerance)
+{
+   Finish();
+   if (m_icons.empty() || tolerance <= 0) return;
+
+   if (spacing_x > 1) snap_axis(m_xs, spacing_x, tolerance, m_votes);
+   if (spacing_y > 1) snap_axis(m_ys, spacing_y, tolerance, m_votes);
+
+   for (size_t i = 0; i < m_icons.size(); ++i)
+   {
+      m_icons[i].x = m_xs[i];
+      m_icons[i].y = m_ys[i];
+   }
+}
+
+void SnapshotBuilder::Settle(const IconHistory &previous, int tolerance)
+{
+   Finish();
+   if (tolerance <= 0) return;
+
+   // Both are in the same order, so this is one merge pass
+   const IconRange before = previous.GetIcons();
+   size_t j = 0;
+   for (size_t i = 0; i < m_icons.size(); ++i)
+   {
+      Entry &e = m_icons[i];
+      while (j < before.size())
+      {
+         const wstring &name = before[j].name;
+         const int c = wmemcmp(name.data(), e.name, min(size_t(e.length), name.length()));
+         if (c > 0 || (c == 0 && (name.length() > e.length || (name.length() == e.length && before[j].key >= e.key)))) break;
+         ++j;
+      }
+
+      if (j == before.size()) break;
+
+      const IconRef b = before[j];
+      if (b.key != e.key || b.name.length() != e.length || wmemcmp(b.name.data(), e.name, e.length) != 0) continue;
+      if (labs(b.x - e.x) > tolerance || labs(b.y - e.y) > tolerance) continue;
+
+      e.x = m_xs[i] = int(b.x);
+      e.y = m_ys[i] = int(b.y);
+   }
+}
+
+bool SnapshotBuilder::matches(const Snapshot &s) const
+{
+   if (m_icons.size() != s.names.size()) return false;
+   if (!CoordCompare::Equal(m_xs.data(), m_ys.data(), s.xs.data(), s.ys.data(), m_xs.size())) return false;
+
+   for (size_t i = 0; i < m_icons.size(); ++i)
+   {
+      if (s.keys[i] != m_icons[i].key) return false;
+
+      const wstring &name = s.names[i];
+      if (name.length() != m_icons[i].length || wmemcmp(name.data(), m_icons[i].name, name.length()) != 0) return false;
+   }
+
+   return true;
+}
+
+bool SnapshotBuilder::Matches(const IconHistory &h)
+{
+   Finish();
+
+   const auto &s = h.GetSnapshot();
+   if (!s) return m_icons.empty();
+   return matches(*s);
+}
+
+void SnapshotBuilder::CompactInto(IconHistory &h)
+{
+   Finish();
+
+   // Layouts repeat a lot (every named profile starts out the same as the
+   // newest history slice), so only build new arrays if we have to
+   SnapshotHasher hasher;
+   for (const Entry &e : m_icons) hasher.Add(e.name, e.length, e.key, e.x, e.y);
+
+   SnapshotStore::Ref existing = SnapshotStore::Find(hasher.Value(), [this](const Snapshot &s) { return matches(s); });
+   if (existing) { h.ShareIcons(existing); return; }
+
+   vector<wstring> names;
+   vector<uint64_t> keys;
+   names.reserve(m_icons.size());
+   keys.reserve(m_icons.size());
+   for (const Entry &e : m_icons)
+   {
+      names.push_back(wstring(e.name, e.length));
+      keys.push_back(e.key);
+   }
+
+   h.ShareIcons(SnapshotStore::Intern(move(names), move(keys), vector<int>(m_xs), vector<int>(m_ys)));
+}
@@ -0,0 +1,95 @@
+// DesktopSaver, (c)2006-2016 Nicholas Piegdon, MIT licensed
+#pragma once
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include "arena.h"
+#include "snapshot_store.h"
+
+class IconHistory;
+
+// Collects the icons for a new snapshot (while polling the desktop or
+// reading the history file) without a separate heap allocation for every
+// name.  Names are copied into an Arena and icons are kept in a plain
+// vector, both of which keep their memory across Reset() calls.
+//
+// A poll that turns out to match the last snapshot is discarded with
+// Reset() and never touches the heap.  Only a snapshot that is actually
+// kept gets copied (at exactly the right size) into an IconHistory.
+class SnapshotBuilder
+{
+public:
+   SnapshotBuilder() : m_finished(false) { }
+
+   void Reset();
+
+   // Without a key, the icon is identified by its name (see MakeIconKey)
+   void AddIcon(const wchar_t *name, size_t length, uint64_t key, long x, long y);
+   void AddIcon(const wchar_t *name, size_t length, long x, long y) { AddIcon(name, length, MakeIconKey(name, length), x, y); }
+   void AddIcon(const std::wstring &name, uint64_t key, long x, long y) { AddIcon(name.c_str(), name.length(), key, x, y); }
+   void AddIcon(const std::wstring &name, long x, long y) { AddIcon(name.c_str(), name.length(), x, y); }
+
+   // Gives the i'th icon added a different key.  Only valid until Finish().
+   void SetKey(size_t i, uint64_t key) { m_icons[i].key = key; }
+
+   // Puts the icons in name (then key) order and drops all but the first
+   // of any that are the same icon.  Icons that only share a name are
+   // both kept.  Called automatically by the functions below if need be.
+   void Finish();
+
+   size_t Count() const { return m_icons.size(); }
+
+   // Moves any icon within 'tolerance' pixels of a point on the desktop
+   // grid onto it.  The grid is 'spacing_x' by 'spacing_y', lined up
+   // with wherever most of the icons are.
+   void SnapToGrid(int spacing_x, int spacing_y, int tolerance);
+
+   // Any icon that is no more than 'tolerance' pixels (in each direction)
+   // from where it was in 'previous' is put back there, so jitter doesn't
+   // count as a change.  Real moves still add up past the tolerance,
+   // because they're always measured from the position last recorded.
+   void Settle(const IconHistory &previous, int tolerance);
+
+   // Equivalent to IconHistory::Identical, but without having to build
+   // the IconHistory first
+   bool Matches(const IconHistory &h);
+
+   // Replaces the icons in 'h' with these (shared with any equal layout
+   // already in the SnapshotStore).  The builder is left as-is.
+   void CompactInto(IconHistory &h);
+
+private:
+   // Explicitly deny copying and assignment
+   SnapshotBuilder(const SnapshotBuilder&);
+   SnapshotBuilder &operator=(const SnapshotBuilder&);
+
+   struct Entry
+   {
+      const wchar_t *name;
+      uint32_t length;
+      uint64_t key;
+
+      // Where the icon was added, so sorting keeps the first duplicate
+      uint32_t order;
+
+      int x, y;
+   };
+
+   bool matches(const Snapshot &s) const;
+
+   static void snap_axis(std::vector<int> &coords, int spacing, int tolerance, std::vector<unsigned> &votes);
+
+   static bool less(const Entry &a, const Entry &b);
+   static bool same_icon(const Entry &a, const Entry &b);
+
+   Arena m_arena;
+   std::vector<Entry> m_icons;
+   bool m_finished;
+
+   // Lined-up coordinates for CoordCompare
+   std::vector<int> m_xs, m_ys;
+
+   // How many icons sit at each offset into a grid cell, for SnapToGrid
+   std::vector<unsigned> m_votes;
+};
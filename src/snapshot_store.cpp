@@ -0,0 +1,129 @@
+// DesktopSaver, (c)2006-2016 Nicholas Piegdon, MIT licensed
+
+#include "snapshot_store.h"
+
+#include <mutex>
+#include <unordered_map>
+using namespace std;
+
+typedef unordered_multimap<uint64_t, weak_ptr<const Snapshot>> SnapshotMap;
+
+static mutex store_mutex;
+static SnapshotMap store;
+
+void Fnv64::AddText(const wchar_t *text, size_t length)
+{
+   for (size_t i = 0; i < length; ++i)
+   {
+      const uint32_t c = uint32_t(text[i]);
+      if (c < 0x10000) { AddUnit(c); continue; }
+
+      // Where wchar_t is UTF-32, hash the equivalent surrogate pair
+      AddUnit(0xD800 + ((c - 0x10000) >> 10));
+      AddUnit(0xDC00 + ((c - 0x10000) & 0x3FF));
+   }
+}
+
+uint64_t MakeIconKey(const wchar_t *identity, size_t length)
+{
+   Fnv64 key;
+   key.AddText(identity, length);
+   return key.Value();
+}
+
+void SnapshotHasher::Add(const wchar_t *name, size_t length, uint64_t key, int x, int y)
+{
+   m_hash.AddText(name, length);
+
+   // Names can't contain a null, so this marks the end unambiguously
+   m_hash.AddUnit(0);
+
+   add_int(x);
+   add_int(y);
+
+   if (key == MakeIconKey(name, length)) return;
+   for (int shift = 0; shift < 64; shift += 16) m_hash.AddUnit(uint32_t(key >> shift) & 0xFFFF);
+}
+
+static bool same_icons(const Snapshot &s, const vector<wstring> &names, const vector<uint64_t> &keys, const vector<int> &xs, const vector<int> &ys)
+{
+   return s.xs == xs && s.ys == ys && s.keys == keys && s.names == names;
+}
+
+// Anything that turns out not to match is handed back in 'rejected'.
+// Dropping one of those could be the last reference, whose release()
+// needs the lock, so callers keep them until they've unlocked.
+static SnapshotStore::Ref find(uint64_t hash, const function<bool(const Snapshot&)> &matches, vector<SnapshotStore::Ref> &rejected)
+{
+   const auto range = store.equal_range(hash);
+   for (auto i = range.first; i != range.second; ++i)
+   {
+      SnapshotStore::Ref s = i->second.lock();
+      if (!s) continue;
+      if (matches(*s)) return s;
+
+      rejected.push_back(move(s));
+   }
+
+   return SnapshotStore::Ref();
+}
+
+SnapshotStore::Ref SnapshotStore::Intern(vector<wstring> &&names, vector<uint64_t> &&keys, vector<int> &&xs, vector<int> &&ys)
+{
+   SnapshotHasher hasher;
+   for (size_t i = 0; i < names.size(); ++i) hasher.Add(names[i].c_str(), names[i].length(), keys[i], xs[i], ys[i]);
+   const uint64_t hash = hasher.Value();
+
+   vector<Ref> rejected;
+   lock_guard<mutex> lock(store_mutex);
+
+   Ref existing = find(hash, [&](const Snapshot &s) { return same_icons(s, names, keys, xs, ys); }, rejected);
+   if (existing) return existing;
+
+   Snapshot *s = new Snapshot;
+   s->names.swap(names);
+   s->keys.swap(keys);
+   s->xs.swap(xs);
+   s->ys.swap(ys);
+   s->hash = hash;
+
+   s->bytes = sizeof(Snapshot);
+   for (const auto &name : s->names) s->bytes += sizeof(wstring) + (name.length() + 1) * sizeof(wchar_t) + sizeof(uint64_t) + 2 * sizeof(int);
+
+   s->sketch.Build(s->names.data(), s->xs.data(), s->ys.data(), s->names.size());
+
+   Ref ref(s, release);
+   store.insert(make_pair(hash, weak_ptr<const Snapshot>(ref)));
+   return ref;
+}
+
+SnapshotStore::Ref SnapshotStore::Find(uint64_t hash, const function<bool(const Snapshot&)> &matches)
+{
+   vector<Ref> rejected;
+   lock_guard<mutex> lock(store_mutex);
+   return find(hash, matches, rejected);
+}
+
+size_t SnapshotStore::Count()
+{
+   lock_guard<mutex> lock(store_mutex);
+   return store.size();
+}
+
+void SnapshotStore::release(const Snapshot *s)
+{
+   {
+      // By now our own entry has expired.  (Another thread may have
+      // interned an equal layout in the meantime, which is left alone.)
+      lock_guard<mutex> lock(store_mutex);
+
+      auto range = store.equal_range(s->hash);
+      for (auto i = range.first; i != range.second; )
+      {
+         if (i->second.expired()) i = store.erase(i);
+         else ++i;
+      }
+   }
+
+   delete s;
+}
@@ -0,0 +1,114 @@
+// DesktopSaver, (c)2006-2016 Nicholas Piegdon, MIT licensed
+#pragma once
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <functional>
+#include <cstdint>
+#include "layout_sketch.h"
+
+// The icons (and nothing else) from one desktop layout: structure-of-
+// arrays, sorted by name (and then by key, for icons that share a name).
+// No two icons in a snapshot have the same key.  A Snapshot never changes once it has been
+// created, so any number of history slices and named profiles can share
+// the same one.
+class Snapshot
+{
+public:
+   std::vector<std::wstring> names;
+   std::vector<uint64_t> keys;
+   std::vector<int> xs;
+   std::vector<int> ys;
+
+   // See SnapshotHasher
+   uint64_t hash;
+
+   // Roughly what keeping this layout around costs, in bytes
+   size_t bytes;
+
+   // For quickly ranking layouts by how close they are to each other
+   LayoutSketch sketch;
+
+   Snapshot() : hash(0), bytes(0) { }
+
+private:
+   // Explicitly deny copying and assignment
+   Snapshot(const Snapshot&);
+   Snapshot &operator=(const Snapshot&);
+};
+
+// FNV-1a (64-bit) over a string as UTF-16 code units, so the result is
+// the same on every platform
+class Fnv64
+{
+public:
+   Fnv64() : m_hash(14695981039346656037ULL) { }
+
+   void AddUnit(uint32_t unit)
+   {
+      m_hash = (m_hash ^ (unit & 0xFF)) * 1099511628211ULL;
+      m_hash = (m_hash ^ (unit >> 8 & 0xFF)) * 1099511628211ULL;
+   }
+
+   void AddText(const wchar_t *text, size_t length);
+   uint64_t Value() const { return m_hash; }
+
+private:
+   uint64_t m_hash;
+};
+
+// A stable identity for one desktop icon: the hash of the shell's parsing
+// name for it (usually its full path), or of its display name if the shell
+// didn't give us one.  Unlike display names, two different icons never
+// share a parsing name.  Keys are written to the history file, so this
+// must never change.
+uint64_t MakeIconKey(const wchar_t *identity, size_t length);
+inline uint64_t MakeIconKey(const std::wstring &identity) { return MakeIconKey(identity.c_str(), identity.length()); }
+
+// FNV-1a (64-bit) over each icon's name and coordinates, in order, plus
+// any key that didn't just come from the display name (so layouts saved
+// before there were keys still hash the same).  The value is written to
+// the history file, so it must never change.
+class SnapshotHasher
+{
+public:
+   void Add(const wchar_t *name, size_t length, uint64_t key, int x, int y);
+   uint64_t Value() const { return m_hash.Value(); }
+
+private:
+   void add_int(int v)
+   {
+      m_hash.AddUnit(uint32_t(v) & 0xFFFF);
+      m_hash.AddUnit(uint32_t(v) >> 16);
+   }
+
+   Fnv64 m_hash;
+};
+
+// A process-wide, content-addressed set of every Snapshot in use.  Equal
+// layouts are only ever stored once: interning one that already exists
+// hands back the existing copy.  Snapshots are reference counted and
+// leave the store when the last IconHistory using them goes away.
+//
+// Because of that, two different live Snapshot pointers always hold
+// different layouts.  Safe to use from any thread.
+class SnapshotStore
+{
+public:
+   typedef std::shared_ptr<const Snapshot> Ref;
+
+   // Takes ownership of the (already sorted) icons, unless an equal
+   // layout is already in the store, in which case that's returned
+   static Ref Intern(std::vector<std::wstring> &&names, std::vector<uint64_t> &&keys, std::vector<int> &&xs, std::vector<int> &&ys);
+
+   // An existing snapshot with this hash that 'matches' accepts, so a
+   // caller can skip building the arrays at all.  Null if there isn't one.
+   static Ref Find(uint64_t hash, const std::function<bool(const Snapshot&)> &matches);
+
+   // The number of distinct layouts currently in memory
+   static size_t Count();
+
+private:
+   static void release(const Snapshot *s);
+};
@@ -1,14 +1,95 @@
-// DesktopSaver, (c)2006-2016 Nicholas Piegdon, MIT licensed
-#pragma once
-
-// Handy string macros
-
-#ifndef STRING
-#include <sstream>
-#define STRING(v) ((static_cast<std::ostringstream&>(std::ostringstream().flush() << v)).str())
-#endif
-
-#ifndef WSTRING
-#include <sstream>
-#define WSTRING(v) ((static_cast<std::wostringstream&>(std::wostringstream().flush() << v)).str())
-#endif
+// DesktopSaver, (c)2006-2016 Nicholas Piegdon, MIT licensed
+#pragma once
+
+// Handy string macros
+
+#ifndef STRING
+#include <sstream>
+#define STRING(v) ((static_cast<std::ostringstream&>(std::ostringstream().flush() << v)).str())
+#endif
+
+#ifndef WSTRING
+#include <sstream>
+#define WSTRING(v) ((static_cast<std::wostringstream&>(std::wostringstream().flush() << v)).str())
+#endif
+
+// UTF-8 conversion that works the same whether wchar_t is UTF-16 (Windows)
+// or UTF-32 (everywhere else).  Invalid input becomes U+FFFD.
+#include <string>
+
+inline void AppendUtf8(std::string &out, unsigned long c)
+{
+   if (c < 0x80) { out += char(c); return; }
+   if (c < 0x800) { out += char(0xC0 | (c >> 6)); out += char(0x80 | (c & 0x3F)); return; }
+   if (c < 0x10000) { out += char(0xE0 | (c >> 12)); out += char(0x80 | ((c >> 6) & 0x3F)); out += char(0x80 | (c & 0x3F)); return; }
+
+   out += char(0xF0 | (c >> 18));
+   out += char(0x80 | ((c >> 12) & 0x3F));
+   out += char(0x80 | ((c >> 6) & 0x3F));
+   out += char(0x80 | (c & 0x3F));
+}
+
+inline std::string ToUtf8(const wchar_t *text, size_t length)
+{
+   std::string out;
+   out.reserve(length);
+
+   for (size_t i = 0; i < length; ++i)
+   {
+      unsigned long c = (unsigned long)text[i];
+
+      if (sizeof(wchar_t) == 2 && c >= 0xD800 && c < 0xDC00 && i + 1 < length && text[i + 1] >= 0xDC00 && text[i + 1] < 0xE000)
+      {
+         c = 0x10000 + ((c - 0xD800) << 10) + ((unsigned long)text[i + 1] - 0xDC00);
+         ++i;
+      }
+      else if ((c >= 0xD800 && c < 0xE000) || c > 0x10FFFF) c = 0xFFFD;
+
+      AppendUtf8(out, c);
+   }
+
+   return out;
+}
+
+inline std::string ToUtf8(const std::wstring &text) { return ToUtf8(text.c_str(), text.length()); }
+
+inline std::wstring FromUtf8(const char *text, size_t length)
+{
+   std::wstring out;
+   out.reserve(length);
+
+   const unsigned char *p = reinterpret_cast<const unsigned char*>(text);
+   for (size_t i = 0; i < length; )
+   {
+      unsigned long c = p[i];
+      size_t extra = 0;
+
+      if (c < 0x80) { }
+      else if (c < 0xC0) { c = 0xFFFD; }
+      else if (c < 0xE0) { c &= 0x1F; extra = 1; }
+      else if (c < 0xF0) { c &= 0x0F; extra = 2; }
+      else if (c < 0xF8) { c &= 0x07; extra = 3; }
+      else { c = 0xFFFD; }
+
+      ++i;
+      for (size_t k = 0; k < extra; ++k, ++i)
+      {
+         if (i >= length || (p[i] & 0xC0) != 0x80) { c = 0xFFFD; break; }
+         c = (c << 6) | (p[i] & 0x3F);
+      }
+
+      if (c > 0x10FFFF || (c >= 0xD800 && c < 0xE000)) c = 0xFFFD;
+
+      if (sizeof(wchar_t) == 2 && c >= 0x10000)
+      {
+         c -= 0x10000;
+         out += wchar_t(0xD800 + (c >> 10));
+         out += wchar_t(0xDC00 + (c & 0x3FF));
+      }
+      else out += wchar_t(c);
+   }
+
+   return out;
+}
+
+inline std::wstring FromUtf8(const std::string &text) { return FromUtf8(text.c_str(), text.length()); }
@@ -0,0 +1,116 @@
+// DesktopSaver, (c)2006-2016 Nicholas Piegdon, MIT licensed
+
+#include "timeline_retention.h"
+using namespace std;
+
+static const int64_t Hour = 60 * 60;
+static const int64_t Day = 24 * Hour;
+static const int64_t Week = 7 * Day;
+
+TimelineRetention::Tier TimelineRetention::TierOf(int64_t time, int64_t now)
+{
+   const int64_t age = now - time;
+   if (age < Day) return Recent;
+   if (age < Week) return Hourly;
+   if (age < 5 * Week) return Daily;
+   return Weekly;
+}
+
+int64_t TimelineRetention::BucketLength(Tier tier)
+{
+   switch (tier)
+   {
+   case Hourly: return Hour;
+   case Daily:  return Day;
+   case Weekly: return Week;
+   default:     return 1;
+   }
+}
+
+void TimelineRetention::Appended(Timeline &t, int64_t now)
+{
+   if (t.empty()) return;
+   add(t.back());
+
+   // Thinning is O(n), so doing it after every n/2 appends (and no more
+   // often) keeps the cost per slice constant
+   if (++m_appended * 2 >= t.size()) thin(t, now);
+   trim(t);
+}
+
+void TimelineRetention::Reset(Timeline &t, int64_t now)
+{
+   m_uses.clear();
+   m_bytes = 0;
+   for (const auto &h : t) add(h);
+
+   thin(t, now);
+   trim(t);
+}
+
+void TimelineRetention::thin(Timeline &t, int64_t now)
+{
+   m_appended = 0;
+
+   // Slices only ever drop out when a later one in the same bucket
+   // replaces them, so the newest slice always survives
+   size_t kept = 0;
+   for (size_t i = 0; i < t.size(); ++i)
+   {
+      const int64_t time = t[i].GetTime();
+
+      // Slices from older versions don't have a time, so they're left alone
+      bool redundant = false;
+      if (time != 0 && i + 1 < t.size())
+      {
+         const int64_t length = BucketLength(TierOf(time, now));
+         redundant = (length > 1 && time / length == t[i + 1].GetTime() / length);
+      }
+
+      if (redundant) { remove(t[i]); continue; }
+
+      if (kept != i) t[kept] = t[i];
+      kept++;
+   }
+
+   t.erase(t.begin() + kept, t.end());
+}
+
+void TimelineRetention::trim(Timeline &t)
+{
+   while (m_bytes > m_budget && t.size() > 1)
+   {
+      remove(t.front());
+      t.pop_front();
+   }
+}
+
+static size_t slice_bytes(const IconHistory &h)
+{
+   return sizeof(IconHistory) + h.GetName().length() * sizeof(wchar_t);
+}
+
+void TimelineRetention::add(const IconHistory &h)
+{
+   m_bytes += slice_bytes(h);
+
+   const Snapshot *s = h.GetSnapshot().get();
+   if (!s) return;
+
+   if (m_uses[s]++ == 0) m_bytes += s->bytes;
+}
+
+void TimelineRetention::remove(const IconHistory &h)
+{
+   m_bytes -= slice_bytes(h);
+
+   const Snapshot *s = h.GetSnapshot().get();
+   if (!s) return;
+
+   auto found = m_uses.find(s);
+   if (found == m_uses.end()) return;
+
+   if (--found->second > 0) return;
+   m_bytes -= s->bytes;
+   m_uses.erase(found);
+}
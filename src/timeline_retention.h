@@ -0,0 +1,61 @@
+// DesktopSaver, (c)2006-2016 Nicholas Piegdon, MIT licensed
+#pragma once
+
+#include <deque>
+#include <unordered_map>
+#include <cstdint>
+#include "icon_history.h"
+
+// Every change to the desktop, in the order it was captured
+typedef std::deque<IconHistory> Timeline;
+
+// Keeps a Timeline within a byte budget.  Recent slices are all kept,
+// and older ones are thinned out to one per hour, then one per day, then
+// one per week (always the last slice of each of those periods, which is
+// the layout that was still in effect when it ended).  If that isn't
+// enough, the oldest slices go.
+//
+// A layout shared by several slices (see SnapshotStore) only counts
+// against the budget once.
+class TimelineRetention
+{
+public:
+   enum Tier { Recent, Hourly, Daily, Weekly, TierCount };
+
+   TimelineRetention(size_t budget) : m_budget(budget), m_bytes(0), m_appended(0) { }
+
+   size_t Budget() const { return m_budget; }
+   void SetBudget(size_t budget) { m_budget = budget; }
+
+   // What the timeline is currently estimated to cost
+   size_t Bytes() const { return m_bytes; }
+
+   // Call after each new slice is pushed onto the back of the timeline.
+   // Thinning runs once for every so many new slices (proportional to the
+   // length of the timeline), so this is O(1) amortized.
+   void Appended(Timeline &t, int64_t now);
+
+   // Starts over with a whole timeline (after loading it, say), thinning
+   // and trimming it right away
+   void Reset(Timeline &t, int64_t now);
+
+   // Every slice in a tier is thinned to one per bucket this many seconds long
+   static Tier TierOf(int64_t time, int64_t now);
+   static int64_t BucketLength(Tier tier);
+
+private:
+   void thin(Timeline &t, int64_t now);
+   void trim(Timeline &t);
+
+   void add(const IconHistory &h);
+   void remove(const IconHistory &h);
+
+   size_t m_budget;
+   size_t m_bytes;
+
+   // How many slices have been appended since the last thinning
+   size_t m_appended;
+
+   // How many slices are using each layout
+   std::unordered_map<const Snapshot*, size_t> m_uses;
+};
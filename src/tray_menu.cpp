@@ -0,0 +1,312 @@
+// DesktopSaver, (c)2006-2016 Nicholas Piegdon, MIT licensed
+
+#include <ctime>
+
+#include "tray_menu.h"
+#include "settings.h"
+#include "alloc_stats.h"
+#include "string_util.h"
+#include "ErrorTracker.h"
+using namespace std;
+
+TrayMenu::TrayMenu() : m_rebuilt(0) { }
+TrayMenu::~TrayMenu() { destroy_menus(); }
+
+wstring TrayMenu::FormatTime(int64_t time)
+{
+   if (time == 0) return wstring();
+
+   const time_t t = time_t(time);
+   tm local;
+   if (localtime_s(&local, &t) != 0) return wstring();
+
+   wchar_t text[64];
+   if (wcsftime(text, 64, L"%b %d, %H:%M", &local) == 0) return wstring();
+   return text;
+}
+
+UINT TrayMenu::ProfileCommand(size_t profile, ProfileAction action)
+{
+   return UINT(WM_Tray_Profile_Command + profile * ProfileActionCount + action);
+}
+
+TrayMenu::MenuKey TrayMenu::make_key(int64_t a, int64_t b, int64_t c, int64_t d)
+{
+   MenuKey key = { { a, b, c, d } };
+   return key;
+}
+
+int64_t TrayMenu::option_flags(const SaverView &view)
+{
+   int64_t flags = 0;
+   if (view.compact) flags |= CompactFlag;
+   if (view.snap_to_grid) flags |= SnapToGridFlag;
+   if (view.display_restore) flags |= DisplayRestoreFlag;
+   return flags;
+}
+
+void TrayMenu::replace(MenuPart &part, const MenuKey &key, HMENU menu)
+{
+   if (part.menu) DestroyMenu(part.menu);
+
+   part.menu = menu;
+   part.key = key;
+   part.built = true;
+}
+
+void TrayMenu::detach_menu_parts()
+{
+   if (!m_menu.menu) return;
+
+   for (int i = GetMenuItemCount(m_menu.menu) - 1; i >= 0; --i)
+   {
+      const HMENU submenu = GetSubMenu(m_menu.menu, i);
+      if (!submenu) continue;
+
+      for (int p = 0; p < MenuPartCount; ++p)
+      {
+         if (submenu == m_parts[p].menu) { RemoveMenu(m_menu.menu, i, MF_BYPOSITION); break; }
+      }
+   }
+
+   // DestroyMenu is recursive, so it handles whatever submenus are left
+   DestroyMenu(m_menu.menu);
+   m_menu = MenuPart();
+}
+
+void TrayMenu::destroy_menus()
+{
+   detach_menu_parts();
+   for (int p = 0; p < MenuPartCount; ++p)
+   {
+      if (m_parts[p].menu) DestroyMenu(m_parts[p].menu);
+      m_parts[p] = MenuPart();
+   }
+}
+
+HMENU TrayMenu::Build(const shared_ptr<const SaverView> &latest, bool restoring)
+{
+   ALLOC_SCOPE(BuildDynamicMenu);
+
+   m_view = latest;
+   const SaverView &view = *m_view;
+
+   const int64_t settings = int64_t(Settings::Current().Version());
+   const int64_t hour = int64_t(time(nullptr)) / 3600;
+
+   // The older layouts are grouped by age, so they move around a little as time passes
+   MenuKey keys[MenuPartCount];
+   keys[OptionsPart] = make_key(settings, view.rate, option_flags(view));
+   keys[OlderPart] = make_key(view.history_version, hour);
+   keys[IconsPart] = make_key(view.history_version);
+   keys[OverwritePart] = make_key(view.profiles_version);
+   keys[DeletePart] = make_key(view.profiles_version);
+   keys[AutostartPart] = make_key(view.profiles_version, settings);
+   const MenuKey main_key = make_key(view.history_version, view.profiles_version, view.rate, restoring);
+
+   bool rebuild = stale(m_menu, main_key);
+   for (int p = 0; p < MenuPartCount; ++p) rebuild = rebuild || stale(m_parts[p], keys[p]);
+   if (!rebuild) return m_menu.menu;
+
+   // The main menu holds onto every part, so it has to let go
+   // of them before any can be replaced
+   detach_menu_parts();
+   m_rebuilt++;
+
+   if (stale(m_parts[OverwritePart], keys[OverwritePart]))
+   {
+      const HistoryList &named_profiles = view.named_profiles.All();
+
+      m_profile_names.clear();
+      for (HistoryRevIter i = named_profiles.rbegin(); i != named_profiles.rend(); ++i) m_profile_names.push_back(i->GetName());
+   }
+
+   if (stale(m_parts[OptionsPart], keys[OptionsPart]))     replace(m_parts[OptionsPart], keys[OptionsPart], build_options_menu(view));
+   if (stale(m_parts[OlderPart], keys[OlderPart]))         replace(m_parts[OlderPart], keys[OlderPart], build_older_menu(view));
+   if (stale(m_parts[IconsPart], keys[IconsPart]))         replace(m_parts[IconsPart], keys[IconsPart], build_icons_menu(view));
+   if (stale(m_parts[OverwritePart], keys[OverwritePart])) replace(m_parts[OverwritePart], keys[OverwritePart], build_profile_menu(ProfileOverwrite));
+   if (stale(m_parts[DeletePart], keys[DeletePart]))       replace(m_parts[DeletePart], keys[DeletePart], build_profile_menu(ProfileDelete));
+   if (stale(m_parts[AutostartPart], keys[AutostartPart])) replace(m_parts[AutostartPart], keys[AutostartPart], build_profile_menu(ProfileAutostart));
+
+   replace(m_menu, main_key, build_main_menu(view, restoring));
+   return m_menu.menu;
+}
+
+HMENU TrayMenu::build_options_menu(const SaverView &view)
+{
+   HMENU options = CreatePopupMenu();
+
+   // Find out whether the run-at-startup options should be checked
+   long registry_checked = (DesktopSaver::GetRunOnStartup() ? MF_CHECKED : 0);
+   AppendMenu(options, MF_STRING | registry_checked, WM_Tray_On_Startup, L"&Run at Startup");
+   AppendMenu(options, MF_STRING | (view.compact ? MF_CHECKED : 0), WM_Tray_Compact_History, L"&Compact history file");
+   AppendMenu(options, MF_STRING | (view.snap_to_grid ? MF_CHECKED : 0), WM_Tray_Snap_To_Grid, L"Ignore small moves off the &grid");
+   AppendMenu(options, MF_STRING | (view.display_restore ? MF_CHECKED : 0), WM_Tray_Display_Restore, L"Restore when the &monitors change");
+
+   AppendMenu(options, MF_STRING, WM_Tray_Show_Stats, L"Show &statistics...");
+
+   AppendMenu(options, MF_SEPARATOR, 0, 0);
+
+   PollRate p = view.rate;
+
+   // Decide which of these gets the checkmark
+   AppendMenu(options, MF_STRING | (p==DisableHistory?MF_CHECKED:0), WM_Tray_Disable_History, L"&Disable History");
+   AppendMenu(options, MF_STRING | (p==PollEndpoints?MF_CHECKED:0),  WM_Tray_Poll_Endpoints, L"Poll at Startup and Shutdown only");
+   AppendMenu(options, MF_STRING | (p==Interval1?MF_CHECKED:0),      WM_Tray_Poll_Interval1, L"Poll every 5 minutes");
+   AppendMenu(options, MF_STRING | (p==Interval2?MF_CHECKED:0),      WM_Tray_Poll_Interval2, L"Poll every 20 minutes");
+   AppendMenu(options, MF_STRING | (p==Interval3?MF_CHECKED:0),      WM_Tray_Poll_Interval3, L"Poll every 60 minutes");
+   AppendMenu(options, MF_STRING | (p==Interval4?MF_CHECKED:0),      WM_Tray_Poll_Interval4, L"Poll every 360 minutes");
+
+   return options;
+}
+
+HMENU TrayMenu::build_profile_menu(ProfileAction action)
+{
+   HMENU menu = CreatePopupMenu();
+
+   // Only the auto-start menu has anything to check
+   const wstring autostart_profilename = (action == ProfileAutostart) ? DesktopSaver::GetAutostartProfileName() : wstring();
+
+   for (size_t i = 0; i < m_profile_names.size(); ++i)
+   {
+      const wstring &name = m_profile_names[i];
+      AppendMenu(menu, MF_STRING | (action == ProfileAutostart && name == autostart_profilename ? MF_CHECKED : 0), ProfileCommand(i, action), name.c_str());
+   }
+
+   return menu;
+}
+
+HMENU TrayMenu::build_older_menu(const SaverView &view)
+{
+   const HistoryList &history = view.history;
+
+   // Everything on the timeline older than the history list, grouped
+   // the same way it has been thinned out
+   m_timeline_choices.clear();
+   const int64_t now = int64_t(time(nullptr));
+   const Timeline &timeline = view.timeline;
+   const int64_t oldest_listed = history.empty() ? 0 : history.front().GetTime();
+
+   HMENU older = CreatePopupMenu();
+   HMENU tiers[TimelineRetention::TierCount] = { };
+   const wchar_t *tier_names[TimelineRetention::TierCount] = { L"Earlier &today", L"Earlier this &week", L"Earlier this &month", L"&Before that" };
+
+   for (auto i = timeline.rbegin(); i != timeline.rend() && m_timeline_choices.size() < MaxTimelineChoices; ++i)
+   {
+      if (i->GetTime() == 0 || i->GetTime() >= oldest_listed) continue;
+
+      const TimelineRetention::Tier tier = TimelineRetention::TierOf(i->GetTime(), now);
+      if (!tiers[tier]) tiers[tier] = CreatePopupMenu();
+
+      const wstring label = i->GetName() + L"\t" + FormatTime(i->GetTime());
+      AppendMenu(tiers[tier], MF_STRING, WM_Tray_Timeline + int(m_timeline_choices.size()), label.c_str());
+      m_timeline_choices.push_back(*i);
+   }
+
+   for (int t = 0; t < TimelineRetention::TierCount; ++t)
+   {
+      if (tiers[t]) AppendMenu(older, MF_STRING | MF_POPUP, (UINT_PTR)tiers[t], tier_names[t]);
+   }
+
+   return older;
+}
+
+HMENU TrayMenu::build_icons_menu(const SaverView &view)
+{
+   // The most recently moved icons, each with the places it has been
+   HMENU icons = CreatePopupMenu();
+   m_icon_choices.clear();
+
+   for (const auto &moved : view.moved_icons)
+   {
+      const wstring &name = moved.name;
+      const IconIndex::Trail &trail = moved.trail;
+
+      // Everywhere else it has been, most recent first
+      HMENU positions = CreatePopupMenu();
+      int position_count = 0;
+      for (auto p = trail.rbegin() + 1; p != trail.rend() && position_count < MaxIconPositions; ++p)
+      {
+         if (!p->present) continue;
+         if (p->x == trail.back().x && p->y == trail.back().y) continue;
+
+         const wstring when = FormatTime(p->time);
+         const wstring label = WSTRING(L"(" << p->x << L", " << p->y << L")" << (when.empty() ? L"" : L"\t") << when);
+         AppendMenu(positions, MF_STRING, WM_Tray_Icon_Position + int(m_icon_choices.size()), label.c_str());
+
+         m_icon_choices.push_back(IconChoice{ name, moved.key, p->x, p->y });
+         position_count++;
+      }
+
+      AppendMenu(icons, MF_STRING | MF_POPUP, (UINT_PTR)positions, name.c_str());
+   }
+
+   return icons;
+}
+
+HMENU TrayMenu::build_main_menu(const SaverView &view, bool restoring)
+{
+   HMENU menu = CreatePopupMenu();
+
+   if (restoring)
+   {
+      AppendMenu(menu, MF_STRING, WM_Tray_Cancel_Restore, L"Ca&ncel restore");
+      AppendMenu(menu, MF_SEPARATOR, 0, 0);
+   }
+
+   const HistoryList &history = view.history;
+
+   // This shouldn't happen (but is non-critical)
+   if (history.size() > DesktopSaver::MaxIconHistoryCount) INTERNAL_ERROR(L"History List too long!");
+
+   // If History is disabled, don't show the history list at all
+   if (view.rate != DisableHistory)
+   {
+      // Build up each history menu item
+      int history_choice = 0;
+      for (HistoryRevIter i = history.rbegin(); i != history.rend(); ++i)
+      {
+         const wstring when = FormatTime(i->GetTime());
+         const wstring label = when.empty() ? i->GetName() : i->GetName() + L"\t" + when;
+         AppendMenu(menu, MF_STRING, WM_Tray_History + history_choice++, label.c_str());
+      }
+
+      AppendMenu(menu, MF_STRING | MF_POPUP | (m_timeline_choices.empty() ? MF_GRAYED : 0), (UINT_PTR)m_parts[OlderPart].menu, L"&Older layouts");
+
+      // Going back to a particular time searches the whole timeline, not just the list above
+      HMENU as_of = CreatePopupMenu();
+      AppendMenu(as_of, MF_STRING, WM_Tray_As_Of_Hour, L"1 hour ago");
+      AppendMenu(as_of, MF_STRING, WM_Tray_As_Of_Day, L"1 day ago");
+      AppendMenu(as_of, MF_STRING, WM_Tray_As_Of_Week, L"1 week ago");
+      AppendMenu(menu, MF_STRING | MF_POPUP | (history.empty() ? MF_GRAYED : 0), (UINT_PTR)as_of, L"Restore &layout from");
+      AppendMenu(menu, MF_STRING | (history.empty() && m_profile_names.empty() ? MF_GRAYED : 0), WM_Tray_Restore_Closest, L"Restore closest la&yout");
+
+      AppendMenu(menu, MF_STRING | MF_POPUP | (view.moved_icons.empty() ? MF_GRAYED : 0), (UINT_PTR)m_parts[IconsPart].menu, L"Move an &icon back");
+
+      // Decide whether to gray-out the "Clear History" option, if we don't
+      // have any history slices to clear
+      long additional_clear_flags = MF_GRAYED;
+      if (history.size() > 0) additional_clear_flags = 0;
+      AppendMenu(menu, MF_STRING | additional_clear_flags, WM_Tray_History_Clear, L"&Clear History");
+
+      AppendMenu(menu, MF_SEPARATOR, 0, 0);
+   }
+
+   // Add each named profile to this list
+   for (size_t i = 0; i < m_profile_names.size(); ++i) AppendMenu(menu, MF_STRING, ProfileCommand(i, ProfileRestore), m_profile_names[i].c_str());
+
+   bool have_profiles = !m_profile_names.empty();
+   AppendMenu(menu, MF_STRING, WM_Tray_Profile_Create, L"&Create new named profile...");
+   AppendMenu(menu, MF_STRING | MF_POPUP | (have_profiles?0:MF_GRAYED), (UINT_PTR)m_parts[OverwritePart].menu, L"&Overwrite named profile");
+   AppendMenu(menu, MF_STRING | MF_POPUP | (have_profiles?0:MF_GRAYED), (UINT_PTR)m_parts[DeletePart].menu, L"&Delete named profile");
+   AppendMenu(menu, MF_STRING | MF_POPUP | (have_profiles?0:MF_GRAYED), (UINT_PTR)m_parts[AutostartPart].menu, L"&Set profile to auto-load at startup");
+
+   AppendMenu(menu, MF_SEPARATOR, 0, 0);
+
+   AppendMenu(menu, MF_STRING | MF_POPUP, (UINT_PTR)m_parts[OptionsPart].menu, L"&Options");
+
+   // Let them quit the program if they want  :)
+   AppendMenu(menu, MF_STRING, WM_Tray_Exit, L"E&xit");
+
+   return menu;
+}
@@ -0,0 +1,143 @@
+// DesktopSaver, (c)2006-2016 Nicholas Piegdon, MIT licensed
+#pragma once
+
+#include <windows.h>
+#include <string>
+#include <vector>
+#include <memory>
+#include <cstdint>
+#include <array>
+#include "saver.h"
+
+// Main Menu
+static const int WM_Tray_History_Clear =   WM_USER + 2;
+static const int WM_Tray_Exit =            WM_USER + 3;
+static const int WM_Tray_Profile_Create =  WM_USER + 4;
+
+// Options
+static const int WM_Tray_On_Startup =      WM_USER + 5;
+static const int WM_Tray_Disable_History = WM_USER + 6;
+static const int WM_Tray_Poll_Endpoints =  WM_USER + 7;
+static const int WM_Tray_Poll_Interval1 =  WM_USER + 8;
+static const int WM_Tray_Poll_Interval2 =  WM_USER + 9;
+static const int WM_Tray_Poll_Interval3 =  WM_USER + 10;
+static const int WM_Tray_Poll_Interval4 =  WM_USER + 11;
+static const int WM_Tray_Compact_History = WM_USER + 12;
+static const int WM_Tray_Show_Stats =      WM_USER + 13;
+static const int WM_Tray_Snap_To_Grid =    WM_USER + 19;
+static const int WM_Tray_Display_Restore = WM_USER + 20;
+
+// Restore as of
+static const int WM_Tray_As_Of_Hour =      WM_USER + 14;
+static const int WM_Tray_As_Of_Day =       WM_USER + 15;
+static const int WM_Tray_As_Of_Week =      WM_USER + 16;
+static const int WM_Tray_Restore_Closest = WM_USER + 17;
+static const int WM_Tray_Cancel_Restore =  WM_USER + 18;
+
+// How many places to offer for each recently moved icon
+static const int MaxIconPositions = 10;
+
+// How many of the thinned, older timeline slices to offer
+static const int MaxTimelineChoices = 100;
+
+// Lookups
+// NOTE: Order is very significant here
+static const int WM_Lookup_Begin =           WM_USER + 21;
+static const int WM_Tray_History =           WM_Lookup_Begin;
+static const int WM_Tray_Icon_Position =     WM_Tray_History + DesktopSaver::MaxIconHistoryCount;
+static const int WM_Tray_Timeline =          WM_Tray_Icon_Position + DesktopSaver::MaxMovedIcons * MaxIconPositions;
+
+// There can be any number of profiles, so their commands are handed out
+// from here on as the menu is built (see TrayMenu::ProfileCommand)
+static const int WM_Tray_Profile_Command =   WM_Tray_Timeline + MaxTimelineChoices;
+static const int WM_Lookup_End =             0xF000;
+
+// The tray icon's popup menu, built from a SaverView.  It's kept from one
+// click to the next: each part of it remembers the versions of the data
+// it was built from (see SaverView and Settings::Version) and is only
+// rebuilt once those change.
+class TrayMenu
+{
+public:
+   TrayMenu();
+   ~TrayMenu();
+
+   // The menu for 'view' (with a way to cancel them if there are restores
+   // in progress).  It belongs to the TrayMenu, and is good until the
+   // next call.
+   HMENU Build(const std::shared_ptr<const SaverView> &view, bool restoring);
+
+   // The view the current (or last) menu was built from, which is where
+   // its choices are looked up.  Null before the first one.
+   const std::shared_ptr<const SaverView> &View() const { return m_view; }
+
+   // How many times Build had to rebuild any part of the menu
+   unsigned long RebuildCount() const { return m_rebuilt; }
+
+   // The profiles in the order the menu lists them.  Each has a command
+   // for every action, numbered from WM_Tray_Profile_Command.
+   enum ProfileAction { ProfileRestore, ProfileOverwrite, ProfileDelete, ProfileAutostart, ProfileActionCount };
+   const std::vector<std::wstring> &ProfileNames() const { return m_profile_names; }
+   static UINT ProfileCommand(size_t profile, ProfileAction action);
+
+   // The single-icon positions offered in the last menu, numbered from
+   // WM_Tray_Icon_Position
+   struct IconChoice
+   {
+      std::wstring name;
+      uint64_t key;
+      long x, y;
+   };
+   const std::vector<IconChoice> &IconChoices() const { return m_icon_choices; }
+
+   // The older timeline slices offered in the last menu, numbered from
+   // WM_Tray_Timeline
+   const std::vector<IconHistory> &TimelineChoices() const { return m_timeline_choices; }
+
+   // A short, local-time version of a capture time for menus
+   static std::wstring FormatTime(int64_t time);
+
+private:
+   // Explicitly deny copying and assignment
+   TrayMenu(const TrayMenu&);
+   TrayMenu &operator=(const TrayMenu&);
+
+   std::shared_ptr<const SaverView> m_view;
+   unsigned long m_rebuilt;
+
+   std::vector<std::wstring> m_profile_names;
+   std::vector<IconChoice> m_icon_choices;
+   std::vector<IconHistory> m_timeline_choices;
+
+   typedef std::array<int64_t, 4> MenuKey;
+   static MenuKey make_key(int64_t a, int64_t b = 0, int64_t c = 0, int64_t d = 0);
+
+   // The on/off options shown in the menu, as one part of a MenuKey
+   enum OptionFlag { CompactFlag = 1 << 0, SnapToGridFlag = 1 << 1, DisplayRestoreFlag = 1 << 2 };
+   static int64_t option_flags(const SaverView &view);
+
+   struct MenuPart
+   {
+      MenuPart() : menu(NULL), built(false) { }
+
+      HMENU menu;
+      MenuKey key;
+      bool built;
+   };
+   static bool stale(const MenuPart &part, const MenuKey &key) { return !part.built || part.key != key; }
+   static void replace(MenuPart &part, const MenuKey &key, HMENU menu);
+
+   enum MenuPartId { OptionsPart, OlderPart, IconsPart, OverwritePart, DeletePart, AutostartPart, MenuPartCount };
+   MenuPart m_parts[MenuPartCount];
+   MenuPart m_menu;
+
+   HMENU build_options_menu(const SaverView &view);
+   HMENU build_older_menu(const SaverView &view);
+   HMENU build_icons_menu(const SaverView &view);
+   HMENU build_profile_menu(ProfileAction action);
+   HMENU build_main_menu(const SaverView &view, bool restoring);
+
+   // Takes the parts back out of the main menu and destroys what's left
+   void detach_menu_parts();
+   void destroy_menus();
+};
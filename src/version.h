@@ -1,10 +1,10 @@
-// DesktopSaver, (c)2006-2017 Nicholas Piegdon, MIT licensed
-#pragma once
-
-static wchar_t DesktopSaverName[] = L"DesktopSaver";
-
-// Update the version number in the following places:
-// - Here, below
-// - nsis_installer_script.nsi (at the top)
-// - saver.rc (in 2 places)
-static wchar_t DesktopSaverVersion[] = L"3.2";
+// DesktopSaver, (c)2006-2017 Nicholas Piegdon, MIT licensed
+#pragma once
+
+static wchar_t DesktopSaverName[] = L"DesktopSaver";
+
+// Update the version number in the following places:
+// - Here, below
+// - nsis_installer_script.nsi (at the top)
+// - saver.rc (in 2 places)
+static wchar_t DesktopSaverVersion[] = L"3.2";